@@ -75,7 +75,6 @@ Life = require "life"
 Stack = require "stack"
 keymap = require "keymap"
 Progress = require "progress_bar"
-Hcache = require "header_cache"
 Threader = require "threader"
 
 --
@@ -116,6 +115,15 @@ local prev_maildir = nil
 local global_msgs = nil
 
 
+--
+-- Called when messages appear in, or disappear from, the currently
+-- selected maildir.  Flush our cache so the changes are shown.
+--
+function on_messages_changed()
+  global_msgs = nil
+end
+
+
 --
 -- Define some utility functions
 --
@@ -470,10 +478,6 @@ do
 
   -- Restore to the previous mode
   function previous_mode ()
-    if Config:get("global.mode") == "index" then
-      -- Write the header cache of this maildir to disk
-      Hcache.save()
-    end
     local prev = mode_stack:pop()
     if prev == nil then
       prev = "maildir"
@@ -517,18 +521,11 @@ end
 --
 -- Count the number of attachments a message has.
 --
+-- This is cached in the maildir-index, so the message is only parsed
+-- the first time.
+--
 function Message.count_attachments (msg)
-
-  local parts = mimeparts2table(msg)
-  local count = 0
-
-  for i, o in ipairs(parts) do
-    if o['filename'] ~= nil and o['filename'] ~= "" then
-      count = count + 1
-    end
-  end
-
-  return count
+  return msg:attachment_count()
 end
 
 
@@ -580,7 +577,8 @@ end
 --
 --   Lookup the value of the sort-method (via `index.sort`).
 --
---   Call the function compare_by_$METHOD to do the comparison.
+--   The built-in methods (date, file, from, subject) are sorted natively,
+--   otherwise call the function compare_by_$METHOD to do the comparison.
 --
 -- If there is no `compare_by_foo` method then we return the table
 -- unsorted.
@@ -614,31 +612,25 @@ function sort_messages (input)
     return res
   else
     --
-    -- If the method is `file` we'll invoke `compare_by_file`, etc.
-    --
-    local func = "compare_by_" .. method
-
-    --
-    -- Is the desired sort-method defined?
+    -- The built-in methods are handled natively, otherwise if the
+    -- method is `foo` we'll invoke `compare_by_foo`.
     --
-    if _G[func] and (type(_G[func]) == "function") then
-
-      --
-      -- If there is record the time, do the sort, and record the time again
-      --
-      local t_start = os.time()
-      table.sort(input, _G[func])
-      local t_end = os.time()
-
-      -- Now show how long it took.
-      Panel:append("Sort method $[WHITE|BOLD]" .. method .. "$[WHITE] took $[WHITE|BOLD]" .. (t_end - t_start) .. "$[WHITE] seconds with " .. "$[WHITE|BOLD]" .. #input .. "$[WHITE] messages")
+    local t_start = os.time()
+    local res = Global:sort_messages(input, method)
+    local t_end = os.time()
 
-    else
+    if res == nil then
       --
       -- There is no defined `compare_by_$foo` function.
       --
       error_msg("Unknown sorting method " .. method)
+      return input
     end
+
+    -- Now show how long it took.
+    Panel:append("Sort method $[WHITE|BOLD]" .. method .. "$[WHITE] took $[WHITE|BOLD]" .. (t_end - t_start) .. "$[WHITE] seconds with " .. "$[WHITE|BOLD]" .. #input .. "$[WHITE] messages")
+
+    return res
   end
   return input
 end
@@ -845,118 +837,21 @@ function get_messages ()
     return global_msgs
   end
 
-  global_msgs = {}
-
-  --
-  -- Otherwise fetch all the current messages.
   --
-  local msgs = Global:current_messages()
-
-  --
-  -- How many steps do we expect to update for our progress-bar?
-  --
-  local steps = math.floor(#msgs / Screen:width())
-  if steps == 0 then
-    steps = 1
-  end
-
-  --
-  -- Now apply any limit which should be present.
+  -- Otherwise fetch the current messages, applying any limit which
+  -- should be present.
   --
   -- Valid limits are:
   --
   --   All      -> All messages.
   --   New      -> All messages which are unread.
+  --   Attach   -> All messages which have attachments.
   --   Today    -> Show messages arrived today.
   --  "pattern" -> All messages matching the given pattern.
   --
-  local limit = Config.get_with_default("index.limit", "all")
-
-  if limit == "all" then
-    --
-    -- "All"
-    --
-    --  This could be simplified to the following:
-    --     global_msgs = msgs
-    --
-    for i, o in ipairs(msgs) do
-      -- Bump our progress-bar
-      if math.fmod(i, steps) then
-        Progress:show_percent(i, #msgs)
-      end
-
-      table.insert(global_msgs, o)
-    end
-  elseif limit == "new" then
-    --
-    -- "New"
-    --
-    for i, o in ipairs(msgs) do
-      -- Bump our progress-bar
-      if math.fmod(i, steps) then
-        Progress:show_percent(i, #msgs)
-      end
-
-      -- If the message is new add it.
-      if o:is_new() then
-        table.insert(global_msgs, o)
-      end
-    end
-
-  elseif limit == "attach" then
-
-    --
-    -- Messages with attachments.
-    --
-    for i, o in ipairs(msgs) do
-      -- Bump our progress-bar
-      if math.fmod(i, steps) then
-        Progress:show_percent(i, #msgs)
-      end
-
-      -- If there are attachments add the message.
-      if Message.count_attachments(o) > 0 then
-        table.insert(global_msgs, o)
-      end
-    end
-
-  elseif limit == "today" then
-    --
-    -- "Today"
-    --
-    local time = os.time()
-    local today = time - (60 * 60 * 24)
-
-    for i, o in ipairs(msgs) do
-      -- Bump our progress-bar
-      if math.fmod(i, steps) then
-        Progress:show_percent(i, #msgs)
-      end
-
-      -- get the creation-date of the message
-      local ctime = o:to_ctime()
-
-      -- if it was within the past 24 hours then add it
-      if ctime > today then
-        table.insert(global_msgs, o)
-      end
-    end
-  else
-    --
-    -- "Pattern"
-    --
-    for i, o in ipairs(msgs) do
-      -- Bump our progress-bar
-      if math.fmod(i, steps) then
-        Progress:show_percent(i, #msgs)
-      end
-
-      local fmt = o:format()
-      if string.find(fmt, limit) then
-        table.insert(global_msgs, o)
-      end
-    end
-  end
+  -- These may be combined, for example "new AND from:steve".
+  --
+  global_msgs = Global:limit_messages(Config.get_with_default("index.limit", "all"))
 
   --
   -- Sort and return the set
@@ -2014,15 +1909,9 @@ function Maildir.select (desired, change_mode_too)
     local path = object:path()
     if string.ends(path, desired) then
 
-      -- Save the header cache of the previous selected maildir if possible.
-      Hcache.save()
-
       -- Select the maildir, to make it current.
       Global:select_maildir(object)
 
-      -- Load the header cache of the new selected maildir.
-      Hcache.load()
-
       -- And update the current selection.
       Config:set("maildir.current", index - 1)
 
@@ -2081,12 +1970,10 @@ function write_mime_part( path )
   --  If we found the part.
   if found then
 
-     -- Open the file for writing
-     local file = assert(io.open(path, "w"))
-
-     -- save the content there
-     file:write(found['object']:content())
-     file:close()
+     -- Stream the content there.
+     if not found['object']:save_to(path) then
+        return false
+     end
 
      return found
   else
@@ -2295,132 +2182,29 @@ end
 -- This function formats a single message for display in index-mode,
 -- it is called by the `index_view()` function defined next.
 --
+-- The format-string `index.format` is expanded natively, see API.md for
+-- the fields which are available.  If you wish to format messages in
+-- some other fashion you may redefine this function.
+--
 function Message:format (thread_indent, index)
-  local path = self:path()
-  local time = self:mtime()
-
-  --
-  -- Cache key is conditional on the sort-method,
-  -- the index-format, and the path of the message.
-  --
-  -- That means changing any of them will flush the cached value.
-  --
-  local ckey = path .. "message:" .. Config.get_with_default("index.sort", "index.sort") .. Config.get_with_default("index.format", "index.format") .. time
-
-  -- Do we have this cached?  If so return it
-  if cache:get(ckey) then
-    return (cache:get(ckey))
-  end
-
-  if not thread_indent then
-    thread_indent = ""
-  end
-
-  --
-  -- Basics from the message
-  --
-  local flags     = self:flags()
-  local subject   = self:header "Subject"
-  local sender    = self:header "From"
-  local recipient = self:header "To"
-  local date      = self:header "Date"
-  local id        = self:header "Message-ID"
-
-  --
-  -- Try to parse out sender into "email" + "name".
-  --
-  local email = string.match(sender, "<(.*)>") or sender
-  local name = string.gsub(sender, "<(.*)>", "")
-  if name:len() < 1 then
-    name = sender
-  end
-
-  --
-  -- Again for recipient.
-  --
-  local recipient_email = string.match(recipient, "<(.*)>") or recipient
-  local recipient_name = string.gsub(recipient, "<(.*)>", "")
-  if recipient_name:len() < 1 then
-    recipient_name = recipient_name
-  end
-
-  --
-  -- Compatibility updates
-  --
-  local sender_email = email
-  local sender_name  = name
-
-  --
-  -- The user might have a filter-function to cleanup
-  -- the name of the sender.
-  --
-  -- (This is mostly to handle transforming a string
-  -- such as "Steve Kemp (via Twitter)" into "Steve Kemp")
-  --
-  if type(on_clean_name) == "function" then
-    name = on_clean_name(name)
-  end
-
-  --
-  -- Get the message-flags - these flags are informational, and
-  -- unrelated to the flags a message might have.
-  --
-  --   A => Message has attachments.
-  --   S => Message is signed.
-  --
-  local m_flags = ""
-  local parts = mimeparts2table(self)
-  local a_count = 0
-  for i, o in ipairs(parts) do
-    if o['type'] == "text/x-gpg-output" then
-      m_flags = m_flags .. "S"
-    end
-    if o['filename'] ~= nil and o['filename'] ~= "" then
-      a_count = a_count + 1
-    end
-  end
-  if a_count > 0 then
-    m_flags = "A" .. m_flags
-  end
+  return self:format_native(thread_indent or "", index)
+end
 
 
-  --
-  -- The format-string we use for display.
-  --
-  local format = Config.get_with_default("index.format", "[${4|flags}] ${2|message_flags} - ${20|sender} - ${indent}${subject}")
-
-  --
-  -- Format this message for display
-  --
-  local output = (string.interp(format, {
-      flags           = flags,
-      message_flags   = m_flags,
-      sender          = sender,
-      sender_name     = sender_name,
-      sender_email    = sender_email,
-      email           = email,           -- depreciated
-      name            = name,            -- depreciated
-      indent          = thread_indent,
-      subject         = subject,
-      number          = index,
-      date            = date,
-      id              = id,
-      recipient       = recipient,
-      recipient_name  = recipient_name,
-      recipient_email = recipient_email,
-    }))
+--
+-- This function returns the number of lines displayed in `index`-mode.
+--
+-- Because it is defined the `index_view()` function will only be asked
+-- for the messages which are visible on the screen.
+--
+function index_view_count ()
+  local messages = get_messages()
 
-  --
-  -- If the message is unread then show it in the "unread" colour
-  --
-  if self:is_new() then
-    output = "$[UNREAD]" .. output
+  if messages == nil then
+    return 0
   end
 
-  -- Update the cache.
-  cache:set(ckey, output)
-
-  return output
+  return #messages
 end
 
 
@@ -2428,13 +2212,11 @@ end
 -- This function displays the screen when in `index`-mode.
 --
 -- It fetches the list of current messages, and calls `Message:format()`
--- on each one.
+-- on the `count` messages starting from the (zero-based) offset `first`.
 --
--- As an optimization, primarily useful for large Maildirs, or when
--- using IMAP we can instead elect to only format the visible messages
--- if the setting `index.fast` is enabled.
+-- If no range is given then every message is formatted.
 --
-function index_view ()
+function index_view (first, count)
   local result = {}
 
   -- Get the available messages.
@@ -2446,7 +2228,6 @@ function index_view ()
   end
 
   -- Get the current offset
-  local mode = Config:get "global.mode"
   local cur = tonumber(Config.get_with_default("index.current", 0))
 
   --
@@ -2457,41 +2238,29 @@ function index_view ()
     cur = #messages - 1
   end
 
-  -- Find the height of the screen.
-  local height = Screen:height()
+  --
+  -- If we're viewing an IMAP folder then fetch the messages we're about
+  -- to draw in a single request, rather than one at a time as they're
+  -- formatted, and those around the current one in the background.
+  --
+  Global:prefetch_messages(messages, cur, first, count)
 
-  -- The minimum message number we're going to format
-  local min = cur - height
-  if min < 0 then
-    min = 0
+  --
+  -- The range of messages to format.
+  --
+  if first == nil then
+    first = 0
+    count = #messages
   end
 
-  -- The maximum message-number we're going to format.
-  local max = cur + height
-
-  -- Are we optimizing?
-  local fast = Config.get_with_default("index.fast", 0)
-  for offset, object in ipairs(messages) do
-
-    local str = "INVISIBLE"
-
-    -- If optimizing
-    if fast ~= 0 then
-
-      --
-      -- Only show the message if it will fit on the screen
-      --
-      if (offset >= min) and (offset < max) then
-        str = object:format(threads_indentation[object], offset)
-      else
-        str = "INVISIBLE - Outside the viewport!"
-      end
-    else
-      -- Else format all entries
-      str = object:format(threads_indentation[object], offset)
-    end
+  local last = first + count
+  if last > #messages then
+    last = #messages
+  end
 
-    table.insert(result, str)
+  for offset = first + 1, last do
+    local object = messages[offset]
+    table.insert(result, object:format(threads_indentation[object], offset))
   end
 
   --
@@ -2998,12 +2767,14 @@ function message_view (msg)
   --
   -- Is there any GPG-signature?
   --
-  local parts = mimeparts2table(msg)
-  for i, o in ipairs(parts) do
-    if o['type'] == "text/x-gpg-output" then
-      local gpg = o['object']:content()
-      for ii, oo in pairs(string.to_table(gpg)) do
-        output = output .. "$[RED]" .. oo .. "\n"
+  if msg:has_gpg_output() then
+    local parts = mimeparts2table(msg)
+    for i, o in ipairs(parts) do
+      if o['type'] == "text/x-gpg-output" then
+        local gpg = o['object']:content()
+        for ii, oo in pairs(string.to_table(gpg)) do
+          output = output .. "$[RED]" .. oo .. "\n"
+        end
       end
     end
   end
@@ -3179,9 +2950,6 @@ function select ()
       end
     end
 
-    -- Populate the header cache for this maildir
-    Hcache.load()
-
     --
     -- Change to the index-mode, so we can see the messages in
     -- the folder.
@@ -18,6 +18,12 @@ function setContains(set, key)
     return false
 end
 
+--
+-- This view returns every message, rather than only the visible ones,
+-- so we remove the function which would count them.
+--
+index_view_count = nil
+
 function index_view()
     local result = {}
 
@@ -64,6 +64,53 @@ std::vector<std::string> CBasicView::get_text(std::string function)
 }
 
 
+/*
+ * Get the visible text to display by calling the specified lua-function.
+ */
+std::vector<std::string> CBasicView::get_visible_text(std::string function, std::string counter, int &offset)
+{
+    CLua *lua       = CLua::instance();
+    CConfig *config = CConfig::instance();
+
+    /*
+     * Find the total number of lines, and store it.
+     */
+    int max = lua->function2integer(counter, 0);
+    config->set(m_name + ".max", max);
+
+    /*
+     * Find which lines will be visible.
+     */
+    int cur = config->get_integer(m_name + ".current");
+
+    if (cur >= max)
+        cur = max - 1;
+
+    if (cur < 0)
+        cur = 0;
+
+    int rows;
+    CScreen::instance()->viewport(cur, max, m_simple, offset, rows);
+
+    /*
+     * Call the view-function for just those lines.
+     */
+    std::vector<std::string> result = lua->function2table(function, offset, rows);
+
+    /*
+     * If we received more lines than we asked for then the function
+     * ignored the range, and returned every line.
+     */
+    if ((int)result.size() > rows)
+    {
+        offset = 0;
+        config->set(m_name + ".max", result.size());
+    }
+
+    return (result);
+}
+
+
 /*
  * This is the virtual function which is called to refresh the display.
  *
@@ -90,8 +137,20 @@ void CBasicView::draw()
     /*
      * Get the text we're supposed to display, by invoking our
      * lua function.
+     *
+     * If there is a function to count the lines then we only need
+     * to fetch those which are visible.
      */
-    std::vector<std::string> txt = get_text(m_function);
+    CLua *lua  = CLua::instance();
+    int offset = 0;
+
+    std::string counter = m_function + "_count";
+    std::vector<std::string> txt;
+
+    if (lua->function_exists(counter))
+        txt = get_visible_text(m_function, counter, offset);
+    else
+        txt = get_text(m_function);
 
     /*
      * No text was output?  Return.
@@ -133,7 +192,7 @@ void CBasicView::draw()
      * do the opposite.
      */
     CScreen *screen = CScreen::instance();
-    screen->draw_text_lines(txt, cur, max, m_simple);
+    screen->draw_text_lines(txt, cur, max, m_simple, offset);
 
     /**
      * Free the text we have.
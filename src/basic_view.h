@@ -32,6 +32,10 @@
  *
  *  1.  A lua function is called to get some text to display.
  *
+ *      If the function `foo_view` has a companion `foo_view_count`, which
+ *      returns the total number of lines, then `foo_view(first, count)`
+ *      is only asked for the lines which are visible.
+ *
  *  2.  The text is drawn, in either simple or complex modes.
  *
  *  3.  The `on_idle` function does nothing.
@@ -88,6 +92,15 @@ private:
      */
     std::vector<std::string> get_text(std::string function);
 
+    /**
+     * Get only the visible lines of display text, by calling the
+     * lua-function with the range of lines we want.
+     *
+     * `counter` is the lua-function which returns the total number of
+     * lines, and `offset` is set to the index of the first line returned.
+     */
+    std::vector<std::string> get_visible_text(std::string function, std::string counter, int &offset);
+
     /**
      * The name of this mode.  e.g. "lua", "index", etc.
      */
@@ -17,280 +17,319 @@
  */
 
 
-#include <algorithm>
-#include <assert.h>
-#include <malloc.h>
-#include <pcrecpp.h>
+#include <ctype.h>
+#include <deque>
+#include <string.h>
+#include <unordered_map>
+#include <wchar.h>
 
 #include "colour_string.h"
 #include "util.h"
 
 
 /*
- * Parse a string into an array of "string + colour" pairs,
- * which will be useful for drawing strings.
+ * The names of the colours we've seen, indexed by handle, and the
+ * reverse mapping.
  *
- * The output of this routine will be an array of COLOUR_STRING
- * objects - each object will contain a colour and ONE CHARACTER
- * of text to draw.
- *
- * This needs re-emphasising:  The entries will contain one character
- * which may be displayed, even if that character might be made from
- * multiple *BYTES*.
+ * These are allocated on first use, and never freed, so that they're
+ * available regardless of the order of static initialization.
+ */
+static std::deque<std::string> *g_colour_names = NULL;
+static std::unordered_map<std::string, size_t> *g_colour_handles = NULL;
+
+
+/*
+ * Parse the given string into spans, in a single pass.
  */
-std::vector<COLOUR_STRING *> CColourString::parse_coloured_string(std::string input, int offset, int tab_width)
+CColourString::CColourString(const std::string &input, int offset, int tab_width)
 {
-    /**
-     * Vector we use while building.
-     */
-    std::vector<COLOUR_STRING *> temp;
+    m_skip      = (offset > 0) ? offset : 0;
+    m_tab_width = tab_width;
+    m_glyphs    = 0;
 
-    /**
-     * Returned to the caller.
+    /*
+     * The current colour, and the most recent colour which wasn't
+     * escaped.  Text before the first colour-marker is white.
      */
-    std::vector<COLOUR_STRING *> results;
+    size_t colour      = intern("white");
+    size_t prev_colour = colour;
 
     /*
-     * I know this is horrid.
-     *
-     * NOTE: We're trying to be greedy but searching from the
-     * back of the string forward.  This is definitely the simpler
-     * of the approaches I trialled.
+     * The start of the text we've not yet appended.
      */
-    pcrecpp::RE re("^(.*)\\$\\[([#a-zA-Z|]+)\\](.*)$");
+    size_t start = 0;
+    size_t max   = input.size();
 
-    std::string pre;
-    std::string col;
-    std::string txt;
-
-    while (re.FullMatch(input, &pre, &col, &txt))
+    for (size_t i = 0; i < max; i++)
     {
+        if ((input[i] != '$') || (i + 1 >= max) || (input[i + 1] != '['))
+            continue;
+
         /*
-         * Allocate a structure to hold this match.
+         * Look for the end of a "$[NAME]" marker, where the name
+         * is made from [#a-zA-Z|].
          */
-        COLOUR_STRING *tmp = (COLOUR_STRING *)malloc(sizeof(COLOUR_STRING));
+        size_t end = i + 2;
+
+        while ((end < max) && (isalpha((unsigned char)input[end]) ||
+                               (input[end] == '#') || (input[end] == '|')))
+            end++;
+
+        if ((end == i + 2) || (end >= max) || (input[end] != ']'))
+            continue;
 
         /*
-         * Save our match away.
+         * The text before the marker is in the current colour.
          */
-        tmp->colour = new std::string(col);
-        tmp->string = new std::string(txt);
-        temp.push_back(tmp);
+        append(input.data() + start, i - start, colour);
 
-        input = pre;
+        if (input[i + 2] == '#')
+        {
+            /*
+             * Expand "$[#RED]" to the literal "$[RED]", drawn in the
+             * colour which was in effect before.
+             */
+            colour = prev_colour;
+
+            std::string escaped = "$[" + input.substr(i + 3, end - i - 3) + "]";
+            append(escaped.data(), escaped.size(), colour);
+        }
+        else
+        {
+            colour      = intern(input.substr(i + 2, end - i - 2));
+            prev_colour = colour;
+        }
+
+        start = end + 1;
+        i     = end;
     }
 
     /*
-     * If input is non-empty then we have leading match.  Handle that
-     * as a special case.
+     * Any trailing text.
      */
-    if (! input.empty())
+    append(input.data() + start, max - start, colour);
+}
+
+
+/*
+ * Append text in the given colour.
+ */
+void CColourString::append(const char *input, size_t length, size_t colour)
+{
+    for (size_t i = 0; i < length;)
     {
+        const unsigned char byte = input[i];
+
         /*
-         * Allocate a structure to hold this match.
+         * TAB is a special-case, and is replaced by spaces.
          */
-        COLOUR_STRING *tmp = (COLOUR_STRING *)malloc(sizeof(COLOUR_STRING));
-        tmp->colour = new std::string("white");
-        tmp->string = new std::string(input);
-        temp.push_back(tmp);
-    }
+        if (byte == '\t')
+        {
+            for (int j = 0; j < m_tab_width; j++)
+                append_glyph(" ", 1, colour);
 
-    /*
-     * Remember we searched backwards?  Reverse so all makes sense.
-     */
-    std::reverse(temp.begin(), temp.end());
-
-
-    /**
-     * At this point we're half done.
-     *
-     * We've turned this input:
-     *
-     *   $[RED]This is red $[BLUE]This is blue
-     *
-     * Into this intermediary step:
-     *
-     *  [colour:RED, text:"This is red "],
-     *  [colour:BLUE, text:"This is blue"],
-     *
-     * We now need to turn that middle-step into:
-     *
-     *  [colour:RED, text:T]
-     *  [colour:RED, text:h]
-     *  [colour:RED, text:i]
-     *  [colour:RED, text:s]
-     *  [colour:RED, text: ]
-     *  [colour:RED, text:i]
-     *  [colour:RED, text:s]
-     *  [colour:RED, text: ]
-     *  [colour:RED, text:r]
-     *  [colour:RED, text:e]
-     *  [colour:RED, text:d]
-     *  [colour:RED, text: ]
-     *  [colour:BLUE, text:T]
-     *  [colour:BLUE, text:h]
-     *  [colour:BLUE, text:i]
-     *  ..
-     *
-     * We do this because it is significantly more efficient to handle
-     * scrolling when we have a set of characters, since we just remove
-     * the ones to the left of the scroll-index.
-     */
+            i += 1;
+            continue;
+        }
 
+        /*
+         * Lookup the size of the UTF-character, in bytes.
+         *
+         * If that failed because the UTF-8 is invalid we're
+         * gonna have to fake it.
+         */
+        size_t size = dsutil_utf8_charlen(byte);
+
+        if (size == 0)
+        {
+            append_glyph("?", 1, colour);
+            i += 1;
+            continue;
+        }
+
+        if (i + size > length)
+            size = length - i;
+
+        append_glyph(input + i, size, colour);
+        i += size;
+    }
+}
 
-    /*
-     * Starting/Previous colour.
-     */
-    std::string prev_colour = "white";
+
+/*
+ * Append a single character, unless it has been scrolled out of view.
+ */
+void CColourString::append_glyph(const char *input, size_t length, size_t colour)
+{
+    if (m_skip > 0)
+    {
+        m_skip -= 1;
+        return;
+    }
 
     /*
-     * Iterate over the entries.
+     * Start a new span if the colour has changed.
      */
-    for (std::vector<COLOUR_STRING *>::iterator it = temp.begin(); it != temp.end() ; ++it)
+    if (m_spans.empty() || (m_spans.back().colour != colour))
     {
-        std::string *colour = (*it)->colour;
-        std::string *text   = (*it)->string;
+        COLOUR_SPAN span;
+        span.colour = colour;
+        span.offset = m_text.size();
+        span.length = 0;
+        span.glyphs = 0;
+        m_spans.push_back(span);
+    }
 
-        /**
-         * Expand "$[#RED]", appropriately.
-         */
-        if ((colour->size() > 0) && (colour->at(0) == '#'))
-        {
-            /* Rewrite the text - i.e escape the whole damn thing. */
-            *text = "$[" + colour->substr(1) + "]" + *text;
+    m_text.append(input, length);
 
-            /* avoid using the selected colour */
-            delete(colour);
+    m_spans.back().length += length;
+    m_spans.back().glyphs += 1;
+    m_glyphs += 1;
+}
 
-            (*it)->colour = new std::string(prev_colour);
-            colour        = (*it)->colour;
-        }
-        else
-        {
-            /*
-             * Record the previous colour, to handle the case of a future
-             * string not updating itself because it is escaped.
-             */
-            prev_colour = *colour;
-        }
 
+/*
+ * The text to draw.
+ */
+const std::string &CColourString::text() const
+{
+    return (m_text);
+}
 
-        /*
-         * Copy the colour, and the one-character string.
-         */
-        int max = (int)text->length();
 
-        for (int i = 0; i < max; i++)
-        {
-            /*
-             * The "single character" we'll draw, which might
-             * actually be comprised of multiple bytes.
-             */
-            std::string chr;
+/*
+ * The spans of text.
+ */
+const std::vector<COLOUR_SPAN> &CColourString::spans() const
+{
+    return (m_spans);
+}
 
-            /*
-             * Get the single byte at the position.
-             * We'll test this to see if it is a multi-byte chacter
-             * and if it is we'll bump it up.
-             */
-            const char byte = text->at(i);
 
-            /*
-             * TAB is a special-case.
-             */
-            if (byte == '\t')
-            {
-                /*
-                 * Width of a TAB is 8 characters by default, but
-                 * the user might have changed it.
-                 *
-                 * NOTE: We could improve things here by counting
-                 * the width of our parts, and using that to snap
-                 * to boundaries - for the moment we're just replacing
-                 * the TAB => "    ".
-                 *
-                 * TODO: Improve this :)
-                 *
-                 */
-                for (int j = 0; j < tab_width ; j++)
-                {
-                    COLOUR_STRING *tmp = (COLOUR_STRING *)malloc(sizeof(COLOUR_STRING));
-                    tmp->colour = new std::string(*colour);
-                    tmp->string = new std::string(" ");
-                    results.push_back(tmp);
-                }
-
-                continue;
-
-            }
+/*
+ * The name of the colour a span should be drawn in.
+ */
+const std::string &CColourString::colour(const COLOUR_SPAN &span) const
+{
+    return (name(span.colour));
+}
 
-            /*
-             * Lookup the size of the UTF-character, in bytes.
-             */
-            int size = dsutil_utf8_charlen(byte);
 
-            /*
-             * If that failed because the UTF-8 is invalid we're
-             * gonna have to fake it.
-             */
-            if (size == 0)
-            {
-                chr = "?";
-            }
-            else
-            {
-                /*
-                 * Otherwise add each byte
-                 */
-                for (int j = 0; j < size; j++)
-                {
-                    if (i + j < max)
-                        chr += text->at(i + j);
-                }
-
-                /*
-                 * Bump past the bytes we've added
-                 */
-                i += (size - 1);
-            }
-
-            COLOUR_STRING *tmp = (COLOUR_STRING *)malloc(sizeof(COLOUR_STRING));
-            tmp->colour = new std::string(*colour);
-            tmp->string = new std::string(chr);
-            results.push_back(tmp);
+/*
+ * The number of bytes which make up the first N characters of a span.
+ */
+size_t CColourString::bytes(const COLOUR_SPAN &span, size_t glyphs) const
+{
+    if (glyphs >= span.glyphs)
+        return (span.length);
 
-        }
+    size_t end = span.offset + span.length;
+    size_t pos = span.offset;
+
+    for (size_t i = 0; i < glyphs && pos < end; i++)
+    {
+        size_t size = dsutil_utf8_charlen(m_text[pos]);
+
+        if (size == 0)
+            size = 1;
+
+        if (pos + size > end)
+            size = end - pos;
+
+        pos += size;
     }
 
+    return (pos - span.offset);
+}
 
-    /*
-     * Free the array we built in the middle.
-     */
-    for (std::vector<COLOUR_STRING *>::iterator it = temp.begin(); it != temp.end() ; ++it)
+
+/*
+ * The number of bytes which make up the leading characters of the given
+ * span that fit within the given number of columns.
+ */
+size_t CColourString::fit(const COLOUR_SPAN &span, size_t columns, size_t &glyphs) const
+{
+    size_t end  = span.offset + span.length;
+    size_t pos  = span.offset;
+    size_t used = 0;
+
+    glyphs = 0;
+
+    while (pos < end)
     {
-        COLOUR_STRING *i = (*it);
-        delete(i->string);
-        delete(i->colour);
-        free(i);
+        size_t size = dsutil_utf8_charlen(m_text[pos]);
+
+        if (size == 0)
+            size = 1;
+
+        if (pos + size > end)
+            size = end - pos;
+
+        /*
+         * Characters we can't measure are assumed to take one column.
+         */
+        mbstate_t state;
+        memset(&state, 0, sizeof(state));
+
+        wchar_t wc;
+        int width = 1;
+
+        if (mbrtowc(&wc, m_text.data() + pos, size, &state) == size)
+            width = wcwidth(wc);
+
+        if (width < 0)
+            width = 1;
+
+        if (used + width > columns)
+            break;
+
+        used   += width;
+        pos    += size;
+        glyphs += 1;
     }
 
+    return (pos - span.offset);
+}
 
 
-    /*
-     * Now remove the parts that we should skip because we have
-     * scrolling in effect.
-     */
-    for (int i = 0; i < offset && ((int)results.size() >= 1); i++)
+/*
+ * The total number of characters to draw.
+ */
+size_t CColourString::glyphs() const
+{
+    return (m_glyphs);
+}
+
+
+/*
+ * Find the handle for the named colour.
+ */
+size_t CColourString::intern(const std::string &name)
+{
+    if (g_colour_names == NULL)
     {
-        COLOUR_STRING *x = results.at(0);
-        delete(x->string);
-        delete(x->colour);
-        free(x);
-        results.erase(results.begin(), results.begin() + 1);
+        g_colour_names   = new std::deque<std::string>();
+        g_colour_handles = new std::unordered_map<std::string, size_t>();
     }
 
-    /*
-     * Return the results.
-     */
-    return results;
+    auto it = g_colour_handles->find(name);
+
+    if (it != g_colour_handles->end())
+        return (it->second);
+
+    size_t handle = g_colour_names->size();
+
+    g_colour_names->push_back(name);
+    (*g_colour_handles)[name] = handle;
+
+    return (handle);
+}
+
+
+/*
+ * The name of the colour with the given handle.
+ */
+const std::string &CColourString::name(size_t handle)
+{
+    return (g_colour_names->at(handle));
 }
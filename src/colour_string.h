@@ -39,27 +39,39 @@
  *
  * <code>$[RED]This is red$[YELLOW]This is yellow.</code>
  *
- * Internally the line of text is parsed into segments of text, each of
- * which contains:
+ * Internally the line of text is parsed into a single buffer of text to
+ * draw, with the markup removed, along with a list of spans.  Each span
+ * contains:
  *
- * * The colour to draw
- * * The text to draw.
+ * * The colour to draw, as a handle - see `CColourString::intern()`.
+ * * The range of bytes, within the text, to draw in that colour.
  *
- * This structure is used to hold that result.
+ * This structure is used to hold a single span.
  */
-typedef struct _COLOUR_STRING
+typedef struct _COLOUR_SPAN
 {
     /**
-     * The colour to use for this segment.
+     * The handle of the colour to use for this span.
      */
-    std::string *colour;
+    size_t colour;
 
     /**
-     * The text to draw for this segment.
+     * The offset of the first byte of this span, within the text.
      */
-    std::string *string;
+    size_t offset;
 
-} COLOUR_STRING;
+    /**
+     * The number of bytes in this span.
+     */
+    size_t length;
+
+    /**
+     * The number of characters in this span, which may be smaller
+     * than the number of bytes if there are multi-byte characters.
+     */
+    size_t glyphs;
+
+} COLOUR_SPAN;
 
 
 
@@ -68,18 +80,101 @@ class CColourString
 public:
 
     /**
-     * Parse a string into an array of "string + colour" pairs,
-     * which will be useful for drawing strings.
+     * Parse a string into runs of text which share a colour, in a single
+     * pass.
      *
-     * The output of this routine will be an array of COLOUR_STRING
-     * objects - each object will contain a colour and ONE CHARACTER
-     * of text to draw.
+     * TAB characters are expanded to `tab_width` spaces, invalid UTF-8
+     * bytes are replaced by "?", and the first `offset` characters are
+     * dropped - which is how we implement horizontal scrolling.
+     */
+    CColourString(const std::string &input, int offset, int tab_width);
+
+    /**
+     * The text to draw, with any colour-markup removed.
+     */
+    const std::string &text() const;
+
+    /**
+     * The spans of text, in order.  Adjacent spans always differ
+     * in colour.
+     */
+    const std::vector<COLOUR_SPAN> &spans() const;
+
+    /**
+     * The name of the colour a span should be drawn in.
+     */
+    const std::string &colour(const COLOUR_SPAN &span) const;
+
+    /**
+     * The number of bytes which make up the first `glyphs` characters
+     * of the given span.
+     */
+    size_t bytes(const COLOUR_SPAN &span, size_t glyphs) const;
+
+    /**
+     * The number of bytes which make up the leading characters of the
+     * given span that fit within `columns` columns of the screen - wide
+     * characters taking two.  The number of characters is stored in
+     * `glyphs`.
+     */
+    size_t fit(const COLOUR_SPAN &span, size_t columns, size_t &glyphs) const;
+
+    /**
+     * The total number of characters to draw.
+     */
+    size_t glyphs() const;
+
+    /**
+     * Find the handle for the named colour, allocating one if this is
+     * the first time we've seen the name.
      *
-     * This needs re-emphasising:  The entries will contain one character
-     * which may be displayed, even if that character might be made from
-     * multiple *BYTES*.
+     * Handles are small integers which are never reused, so they may be
+     * used to index a table of attributes - see `CScreen::colour_attr()`.
+     */
+    static size_t intern(const std::string &name);
+
+    /**
+     * The name of the colour with the given handle.
      */
-    static std::vector<COLOUR_STRING *> parse_coloured_string(std::string input, int offset, int tab_width);
+    static const std::string &name(size_t handle);
 
+private:
+
+    /**
+     * Append text in the given colour, expanding TABs, and skipping
+     * characters which have been scrolled out of view.
+     */
+    void append(const char *input, size_t length, size_t colour);
 
+    /**
+     * Append a single character, which has already been expanded.
+     */
+    void append_glyph(const char *input, size_t length, size_t colour);
+
+private:
+
+    /**
+     * The text to draw.
+     */
+    std::string m_text;
+
+    /**
+     * The spans of text we've found.
+     */
+    std::vector<COLOUR_SPAN> m_spans;
+
+    /**
+     * The number of characters we've still to skip.
+     */
+    size_t m_skip;
+
+    /**
+     * The width of a TAB character.
+     */
+    int m_tab_width;
+
+    /**
+     * The number of characters in `m_text`.
+     */
+    size_t m_glyphs;
 };
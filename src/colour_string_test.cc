@@ -20,6 +20,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <locale.h>
 #include <malloc.h>
 
 #include "colour_string.h"
@@ -28,27 +29,30 @@
 
 
 /**
- * Test an empty string parses to zero parts.
+ * Test an empty string parses to zero spans.
  */
 void TestEmptyString(CuTest * tc)
 {
     std::string input = "";
 
-    std::vector<COLOUR_STRING *> parts = CColourString::parse_coloured_string(input, 0, 8);
+    CColourString parsed(input, 0, 8);
 
-    CuAssertIntEquals(tc, parts.size(), 0);
+    CuAssertIntEquals(tc, 0, parsed.spans().size());
+    CuAssertIntEquals(tc, 0, parsed.glyphs());
 }
 
 
 /**
- * Test a blank string parses to one parts.
+ * Test a blank string parses to one span.
  */
 void TestBlankString(CuTest * tc)
 {
     std::string input = " ";
-    std::vector<COLOUR_STRING *> parts = CColourString::parse_coloured_string(input, 0, 8);
 
-    CuAssertIntEquals(tc, parts.size(), 1);
+    CColourString parsed(input, 0, 8);
+
+    CuAssertIntEquals(tc, 1, parsed.spans().size());
+    CuAssertIntEquals(tc, 1, parsed.glyphs());
 }
 
 
@@ -60,93 +64,95 @@ void TestNoColours(CuTest * tc)
 
     std::string input = "Steve Kemp";
 
-    std::vector<COLOUR_STRING *> parts;
-    parts = CColourString::parse_coloured_string(input, 0, 8);
+    CColourString parsed(input, 0, 8);
 
     /*
-     * We expect one part for each character
+     * We expect one span, which defaults to 'white'.
      */
-    CuAssertIntEquals(tc, strlen("Steve Kemp"), parts.size());
-
-    /*
-     * Each part will default to 'white'.
-     */
-    for (std::vector<COLOUR_STRING *>::iterator it = parts.begin(); it != parts.end() ; ++it)
-    {
-        std::string *colour = (*it)->colour;
-
-        CuAssertStrEquals(tc, "white", colour->c_str());
-    }
+    CuAssertIntEquals(tc, 1, parsed.spans().size());
+    CuAssertStrEquals(tc, "white", parsed.colour(parsed.spans()[0]).c_str());
 }
 
 
 /**
- * Test a single string expands to parts of one character each.
+ * Test a single string is counted in characters.
  */
 void TestStringPartLength(CuTest * tc)
 {
 
     std::string input = "Steve Kemp";
 
-    std::vector<COLOUR_STRING *> parts;
-    parts = CColourString::parse_coloured_string(input, 0, 8);
-
-    /*
-     * We expect one part for each character
-     */
-    CuAssertIntEquals(tc, strlen("Steve Kemp"), parts.size());
+    CColourString parsed(input, 0, 8);
 
     /*
-     * Each part should only be one byte.
+     * We expect one character for each byte.
      */
-    for (std::vector<COLOUR_STRING *>::iterator it = parts.begin(); it != parts.end() ; ++it)
-    {
-        std::string *text   = (*it)->string;
+    const COLOUR_SPAN &span = parsed.spans()[0];
 
-        CuAssertIntEquals(tc, 1, text->length());
-    }
+    CuAssertIntEquals(tc, strlen("Steve Kemp"), span.glyphs);
+    CuAssertIntEquals(tc, strlen("Steve Kemp"), span.length);
+    CuAssertStrEquals(tc, "Steve Kemp", parsed.text().c_str());
 }
 
 
 /**
- * Test a multibyte string expands to characters still.
+ * Test a multibyte string is counted in characters still.
  */
 void TestSimpleMultiByte(CuTest * tc)
 {
     std::string input = "的展会";
 
-    std::vector<COLOUR_STRING *> parts;
-    parts = CColourString::parse_coloured_string(input, 0, 8);
+    CColourString parsed(input, 0, 8);
 
     /*
-     * We expect three parts, since there are three characters.
+     * We expect three characters.
      */
-    CuAssertIntEquals(tc, 3, parts.size());
+    CuAssertIntEquals(tc, 3, parsed.glyphs());
 
     /*
-     * But the input text will still be longer.
+     * But the text will still be longer, and we've not dropped
+     * any bytes.
      */
-    int length = 0;
+    CuAssertIntEquals(tc, input.length(), parsed.spans()[0].length);
+    CuAssertStrEquals(tc, input.c_str(), parsed.text().c_str());
+
+    /*
+     * The first two characters are six bytes.
+     */
+    CuAssertIntEquals(tc, 6, parsed.bytes(parsed.spans()[0], 2));
+}
+
+
+/**
+ * Test that text is clipped by the columns it occupies.
+ */
+void TestFitColumns(CuTest * tc)
+{
+    CColourString parsed("a的展会", 0, 8);
+    const COLOUR_SPAN &span = parsed.spans()[0];
+    size_t glyphs = 0;
 
     /*
-     * Add up the length of each text-part so we can see we've not dropped
-     * a character.
+     * The measurement of wide characters depends upon the locale.
      */
-    for (std::vector<COLOUR_STRING *>::iterator it = parts.begin(); it != parts.end() ; ++it)
+    std::string old = setlocale(LC_CTYPE, NULL);
+
+    if (setlocale(LC_CTYPE, "C.UTF-8") != NULL)
     {
-        std::string *text = (*it)->string;
-        int len           = text->length();
+        CuAssertIntEquals(tc, 1, parsed.fit(span, 2, glyphs));
+        CuAssertIntEquals(tc, 1, glyphs);
 
-        length += len;
+        CuAssertIntEquals(tc, 4, parsed.fit(span, 3, glyphs));
+        CuAssertIntEquals(tc, 2, glyphs);
 
-        /*
-         * Because we're using multibytes we know each length
-         * will be more than one character.
-         */
-        CuAssertTrue(tc, len > 1);
+        CuAssertIntEquals(tc, 10, parsed.fit(span, 80, glyphs));
+        CuAssertIntEquals(tc, 4, glyphs);
     }
 
-    CuAssertIntEquals(tc, input.length(), length);
+    setlocale(LC_CTYPE, old.c_str());
+
+    CuAssertIntEquals(tc, 0, parsed.fit(span, 0, glyphs));
+    CuAssertIntEquals(tc, 0, glyphs);
 }
 
 
@@ -163,36 +169,121 @@ void TestTabWidth(CuTest * tc)
     {
         std::string input = "Steve\tKemp";
 
-        std::vector<COLOUR_STRING *> parts;
-        parts = CColourString::parse_coloured_string(input, 0, i);
+        CColourString parsed(input, 0, i);
 
         /*
-         * We expect one part for each character plus N-spaces
+         * We expect one character for each character plus N-spaces
          * for the tab-character.
          */
         int expected = strlen("Steve");
         expected += strlen("Kemp");
         expected += i;
 
-        CuAssertIntEquals(tc, expected, parts.size());
+        CuAssertIntEquals(tc, expected, parsed.glyphs());
 
         /*
          * And of course for each width we want that many spaces
          */
-        int spaces = 0;
+        std::string text = "Steve" + std::string(i, ' ') + "Kemp";
+        CuAssertStrEquals(tc, text.c_str(), parsed.text().c_str());
+    }
+}
 
-        for (std::vector<COLOUR_STRING *>::iterator it = parts.begin(); it != parts.end() ; ++it)
-        {
-            std::string *text = (*it)->string;
 
-            if (strcmp(text->c_str(), " ") == 0)
-                spaces += 1;
-        }
+/**
+ * Test that colours split the text into spans.
+ */
+void TestColourSpans(CuTest * tc)
+{
+    std::string input = "Hi $[RED]red$[BLUE]blue$[RED]again";
 
-        CuAssertIntEquals(tc, spaces, i);
-    }
+    CColourString parsed(input, 0, 8);
+
+    CuAssertStrEquals(tc, "Hi redblueagain", parsed.text().c_str());
+
+    std::vector<COLOUR_SPAN> spans = parsed.spans();
+    CuAssertIntEquals(tc, 4, spans.size());
+
+    CuAssertStrEquals(tc, "white", parsed.colour(spans[0]).c_str());
+    CuAssertStrEquals(tc, "RED", parsed.colour(spans[1]).c_str());
+    CuAssertStrEquals(tc, "BLUE", parsed.colour(spans[2]).c_str());
+    CuAssertStrEquals(tc, "RED", parsed.colour(spans[3]).c_str());
+
+    /*
+     * Repeated colours share an index.
+     */
+    CuAssertIntEquals(tc, spans[1].colour, spans[3].colour);
+
+    CuAssertIntEquals(tc, 3, spans[1].offset);
+    CuAssertIntEquals(tc, 3, spans[1].length);
+    CuAssertIntEquals(tc, 6, spans[2].offset);
+    CuAssertIntEquals(tc, 4, spans[2].length);
+}
+
+
+/**
+ * Test that escaped colours are drawn literally, in the previous colour.
+ */
+void TestEscapedColour(CuTest * tc)
+{
+    std::string input = "$[RED]a $[#BLUE] b$[oops";
+
+    CColourString parsed(input, 0, 8);
+
+    CuAssertStrEquals(tc, "a $[BLUE] b$[oops", parsed.text().c_str());
+    CuAssertIntEquals(tc, 1, parsed.spans().size());
+    CuAssertStrEquals(tc, "RED", parsed.colour(parsed.spans()[0]).c_str());
 }
 
+
+/**
+ * Test that the horizontal offset removes leading characters.
+ */
+void TestScrollOffset(CuTest * tc)
+{
+    std::string input = "$[RED]ab\t$[BLUE]的展会";
+
+    /*
+     * Skip "ab", and half the TAB.
+     */
+    CColourString parsed(input, 4, 4);
+
+    CuAssertStrEquals(tc, "  的展会", parsed.text().c_str());
+    CuAssertIntEquals(tc, 5, parsed.glyphs());
+    CuAssertIntEquals(tc, 2, parsed.spans().size());
+
+    /*
+     * Skip everything.
+     */
+    CColourString all(input, 100, 4);
+    CuAssertIntEquals(tc, 0, all.spans().size());
+    CuAssertStrEquals(tc, "", all.text().c_str());
+}
+
+
+/**
+ * Test that colour names are interned to handles.
+ */
+void TestColourHandles(CuTest * tc)
+{
+    size_t red  = CColourString::intern("red|bold");
+    size_t blue = CColourString::intern("blue");
+
+    CuAssertTrue(tc, red != blue);
+    CuAssertIntEquals(tc, red, CColourString::intern("red|bold"));
+    CuAssertStrEquals(tc, "red|bold", CColourString::name(red).c_str());
+
+    /*
+     * The parser emits the same handles.
+     */
+    CColourString parsed("$[red|bold]x$[blue]y", 0, 8);
+
+    CuAssertIntEquals(tc, 2, parsed.spans().size());
+    CuAssertIntEquals(tc, red, parsed.spans()[0].colour);
+    CuAssertIntEquals(tc, blue, parsed.spans()[1].colour);
+}
+
+
 CuSuite *
 coloured_string_getsuite()
 {
@@ -202,6 +293,11 @@ coloured_string_getsuite()
     SUITE_ADD_TEST(suite, TestNoColours);
     SUITE_ADD_TEST(suite, TestStringPartLength);
     SUITE_ADD_TEST(suite, TestSimpleMultiByte);
+    SUITE_ADD_TEST(suite, TestFitColumns);
     SUITE_ADD_TEST(suite, TestTabWidth);
+    SUITE_ADD_TEST(suite, TestColourSpans);
+    SUITE_ADD_TEST(suite, TestEscapedColour);
+    SUITE_ADD_TEST(suite, TestScrollOffset);
+    SUITE_ADD_TEST(suite, TestColourHandles);
     return suite;
 }
@@ -17,12 +17,36 @@
  */
 
 
+#include <algorithm>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 #include "directory.h"
 #include "util.h"
 
+
+#ifdef __linux__
+/**
+ * The record returned by the getdents64 system-call.
+ */
+struct linux_dirent64
+{
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+#endif
+
 /*
  * Does the directory exist?
  */
@@ -38,9 +62,9 @@ bool CDirectory::exists(std::string path)
 
 
 /*
- * Return a sorted list of files beneath the directory.
+ * Return a list of files beneath the directory, sorted by default.
  */
-std::vector < std::string > CDirectory::entries(std::string prefix)
+std::vector < std::string > CDirectory::entries(std::string prefix, bool sorted)
 {
     std::vector < std::string > result;
 
@@ -64,9 +88,11 @@ std::vector < std::string > CDirectory::entries(std::string prefix)
         }
     }
 
-    closedir(dp);
+    if (dp != NULL)
+        closedir(dp);
 
-    std::sort(result.begin(), result.end());
+    if (sorted)
+        std::sort(result.begin(), result.end());
 
     return result;
 }
@@ -96,3 +122,145 @@ void CDirectory::mkdir_p(std::string path)
                 mkdir(todo.c_str(), 0755);
     }
 }
+
+
+/*
+ * Constructor.  Open the given directory.
+ */
+CDirectoryIterator::CDirectoryIterator(std::string path)
+{
+    m_len    = 0;
+    m_offset = 0;
+    m_dir    = NULL;
+    m_name   = NULL;
+    m_type   = DT_UNKNOWN;
+    m_inode  = 0;
+
+    m_fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (m_fd < 0)
+        return;
+
+#ifdef __linux__
+    m_buf.resize(32768);
+#else
+    m_dir = fdopendir(m_fd);
+
+    if (m_dir == NULL)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+
+#endif
+}
+
+
+/*
+ * Destructor.
+ */
+CDirectoryIterator::~CDirectoryIterator()
+{
+    if (m_dir != NULL)
+        closedir(m_dir);
+    else if (m_fd >= 0)
+        close(m_fd);
+}
+
+
+/*
+ * Was the directory opened successfully?
+ */
+bool CDirectoryIterator::valid()
+{
+    return (m_fd >= 0);
+}
+
+
+/*
+ * Advance to the next entry.
+ */
+bool CDirectoryIterator::next()
+{
+    if (m_fd < 0)
+        return false;
+
+    while (true)
+    {
+#ifdef __linux__
+
+        /*
+         * Read the entries in large batches, straight from the kernel.
+         */
+        if (m_offset >= m_len)
+        {
+            m_len    = syscall(SYS_getdents64, m_fd, m_buf.data(), m_buf.size());
+            m_offset = 0;
+
+            if (m_len <= 0)
+                return false;
+        }
+
+        struct linux_dirent64 *de = (struct linux_dirent64 *)(m_buf.data() + m_offset);
+        m_offset += de->d_reclen;
+#else
+        struct dirent *de = readdir(m_dir);
+
+        if (de == NULL)
+            return false;
+
+#endif
+
+        if ((strcmp(de->d_name, ".") == 0) || (strcmp(de->d_name, "..") == 0))
+            continue;
+
+        m_name  = de->d_name;
+        m_type  = de->d_type;
+        m_inode = de->d_ino;
+        return true;
+    }
+}
+
+
+/*
+ * The name of the current entry.
+ */
+const char *CDirectoryIterator::name()
+{
+    return (m_name);
+}
+
+
+/*
+ * The inode of the current entry.
+ */
+ino_t CDirectoryIterator::inode()
+{
+    return (m_inode);
+}
+
+
+/*
+ * Is the current entry a directory?
+ */
+bool CDirectoryIterator::is_directory()
+{
+    if (m_type != DT_UNKNOWN)
+        return (m_type == DT_DIR);
+
+    struct stat sb;
+
+    if (fstatat(m_fd, m_name, &sb, AT_SYMLINK_NOFOLLOW) != 0)
+        return false;
+
+    return (S_ISDIR(sb.st_mode));
+}
+
+
+/*
+ * The file-descriptor of the directory.
+ */
+int CDirectoryIterator::fd()
+{
+    return (m_fd);
+}
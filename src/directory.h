@@ -20,8 +20,10 @@
 #pragma once
 
 
+#include <dirent.h>
 #include <vector>
 #include <string>
+#include <sys/types.h>
 
 /**
  *
@@ -42,9 +44,12 @@ public:
     static bool exists(std::string path);
 
     /**
-     * Return a sorted list of files beneath the directory.
+     * Return a list of files beneath the directory.
+     *
+     * The list is sorted unless `sorted` is false, in which case the
+     * entries are returned in the order the filesystem provided them.
      */
-    static std::vector < std::string > entries(std::string prefix);
+    static std::vector < std::string > entries(std::string prefix, bool sorted = true);
 
     /**
      * Make the directory, including any parents.
@@ -52,3 +57,100 @@ public:
     static void mkdir_p(std::string path);
 
 };
+
+
+
+/**
+ * Iterate over the entries in a single directory, without sorting
+ * them, building paths, or allocating memory for each one.
+ *
+ * The entries "." and ".." are skipped, everything else is returned
+ * in the order the filesystem provides:
+ *
+ * <pre>
+ * CDirectoryIterator it("/tmp");
+ *
+ * while (it.next())
+ *     if (! it.is_directory())
+ *         printf("%s\n", it.name());
+ * </pre>
+ */
+class CDirectoryIterator
+{
+
+public:
+
+    /**
+     * Constructor.  Open the given directory.
+     */
+    CDirectoryIterator(std::string path);
+
+    /**
+     * Destructor.
+     */
+    ~CDirectoryIterator();
+
+    /**
+     * Was the directory opened successfully?
+     */
+    bool valid();
+
+    /**
+     * Advance to the next entry, returning false when there are
+     * no more.
+     */
+    bool next();
+
+    /**
+     * The name of the current entry.
+     *
+     * This is only valid until `next()` is called again.
+     */
+    const char *name();
+
+    /**
+     * The inode of the current entry.
+     */
+    ino_t inode();
+
+    /**
+     * Is the current entry a directory?
+     *
+     * This uses the type reported with the entry, and only calls
+     * `fstatat` if the filesystem didn't supply one.  Symlinks are
+     * not followed.
+     */
+    bool is_directory();
+
+    /**
+     * The file-descriptor of the directory, for use with `fstatat`
+     * and friends.
+     */
+    int fd();
+
+private:
+
+    /**
+     * The open directory, or -1.
+     */
+    int m_fd;
+
+    /**
+     * The buffer entries are read into, and our position within it.
+     */
+    std::vector<char> m_buf;
+    long m_len;
+    long m_offset;
+
+    /**
+     * The directory-stream, where getdents64 is not available.
+     */
+    DIR *m_dir;
+
+    /**
+     * The current entry.
+     */
+    const char *m_name;
+    unsigned char m_type;
+    ino_t m_inode;
+};
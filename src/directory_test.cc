@@ -18,8 +18,10 @@
 
 
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -64,6 +66,56 @@ void TestDirectoryEntries(CuTest * tc)
 }
 
 
+/**
+ * Test CDirectoryIterator.
+ */
+void TestDirectoryIterator(CuTest * tc)
+{
+    char tmpl[] = "/tmp/lumail.XXXXXX";
+    std::string prefix = mkdtemp(tmpl);
+
+    CDirectory::mkdir_p(prefix + "/subdir");
+    std::ofstream(prefix + "/one");
+    std::ofstream(prefix + "/two");
+
+    std::vector<std::string> files;
+    std::vector<std::string> dirs;
+
+    CDirectoryIterator it(prefix);
+    CuAssertTrue(tc, it.valid());
+
+    while (it.next())
+    {
+        if (it.is_directory())
+            dirs.push_back(it.name());
+        else
+            files.push_back(it.name());
+    }
+
+    /*
+     * "." and ".." are skipped, and the order isn't defined.
+     */
+    std::sort(files.begin(), files.end());
+
+    CuAssertIntEquals(tc, 1, dirs.size());
+    CuAssertStrEquals(tc, "subdir", dirs[0].c_str());
+
+    CuAssertIntEquals(tc, 2, files.size());
+    CuAssertStrEquals(tc, "one", files[0].c_str());
+    CuAssertStrEquals(tc, "two", files[1].c_str());
+
+    std::string cmd = "rm -rf " + prefix;
+    CuAssertIntEquals(tc, 0, system(cmd.c_str()));
+
+    /*
+     * A missing directory has no entries.
+     */
+    CDirectoryIterator missing(prefix);
+    CuAssertTrue(tc, !missing.valid());
+    CuAssertTrue(tc, !missing.next());
+}
+
+
 /**
  * Test CDirectory::exists()
  */
@@ -167,6 +219,7 @@ directory_getsuite()
 {
     CuSuite *suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, TestDirectoryEntries);
+    SUITE_ADD_TEST(suite, TestDirectoryIterator);
     SUITE_ADD_TEST(suite, TestDirectoryExists);
     SUITE_ADD_TEST(suite, TestDirectoryMkdir);
     return suite;
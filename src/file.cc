@@ -28,6 +28,7 @@
 #include <unistd.h>
 #include <wordexp.h>
 
+#include "directory.h"
 #include "file.h"
 
 
@@ -146,6 +147,62 @@ int CFile::size(std::string path)
 }
 
 
+/*
+ * Is the named entry, beneath the given directory, a maildir?
+ *
+ * This is `CFile::is_maildir` for an entry we already know to be a
+ * directory, resolving the paths relative to its parent.
+ */
+static bool is_maildir_at(int dirfd, std::string name)
+{
+    static const char *subdirs[] = { "/cur", "/tmp", "/new" };
+
+    for (const char *subdir : subdirs)
+    {
+        struct stat sb;
+
+        if ((fstatat(dirfd, std::string(name + subdir).c_str(), &sb, 0) != 0) ||
+                !S_ISDIR(sb.st_mode))
+            return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Append the maildirs beneath the given directory to the result.
+ *
+ * We don't descend into maildirs, and if `prefix` is itself a
+ * maildir then its `cur/`, `new/`, and `tmp/` directories are skipped
+ * as they only contain messages.
+ */
+static void find_maildirs(std::string prefix, bool maildir, std::vector < std::string > &result)
+{
+    CDirectoryIterator it(prefix);
+
+    while (it.next())
+    {
+        if (! it.is_directory())
+            continue;
+
+        const char *name = it.name();
+
+        if (maildir && ((strcmp(name, "cur") == 0) ||
+                        (strcmp(name, "new") == 0) ||
+                        (strcmp(name, "tmp") == 0)))
+            continue;
+
+        std::string path = prefix + "/" + name;
+
+        if (is_maildir_at(it.fd(), name))
+            result.push_back(path);
+        else
+            find_maildirs(path, false, result);
+    }
+}
+
+
 /*
  * Return a sorted list of maildirs beneath the given prefix.
  */
@@ -153,58 +210,20 @@ std::vector < std::string > CFile::get_all_maildirs(std::string prefix)
 {
     std::vector < std::string > result;
 
-    dirent *de;
-    DIR *dp;
+    if (! CFile::is_directory(prefix))
+        return result;
 
-    dp = opendir(prefix.c_str());
+    bool maildir = CFile::is_maildir(prefix);
 
-    if (dp)
-    {
-        if (CFile::is_maildir(prefix))
-            result.push_back(prefix);
-
-        while (true)
-        {
-            de = readdir(dp);
-
-            if (de == NULL)
-                break;
-
-            if ((strcmp(de->d_name, ".") != 0) &&
-                    (strcmp(de->d_name, "..") != 0) &&
-                    ((de->d_type == DT_UNKNOWN) || (de->d_type == DT_DIR)))
-            {
-                std::string subdir_name = std::string(de->d_name);
-                std::string subdir_path =
-                    std::string(prefix + "/" + subdir_name);
-
-                if (CFile::is_maildir(subdir_path))
-                    result.push_back(subdir_path);
-                else
-                {
-                    if (subdir_name != "." && subdir_name != "..")
-                    {
-                        DIR *sdp = opendir(subdir_path.c_str());
-
-                        if (sdp)
-                        {
-                            closedir(sdp);
-                            std::vector < std::string > sub_maildirs;
-                            sub_maildirs = CFile::get_all_maildirs(subdir_path);
-
-                            for (std::string sub_maildir : sub_maildirs)
-                            {
-                                result.push_back(sub_maildir);
-                            }
-                        }
-                    }
-                }
-            }
-        }
-
-        closedir(dp);
-        std::sort(result.begin(), result.end());
-    }
+    if (maildir)
+        result.push_back(prefix);
+
+    find_maildirs(prefix, maildir, result);
+
+    /*
+     * Sort once, rather than at each level.
+     */
+    std::sort(result.begin(), result.end());
 
     return result;
 }
@@ -20,6 +20,7 @@
 
 #include <fstream>
 #include <iostream>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
@@ -428,6 +429,44 @@ void TestFileMaildir(CuTest * tc)
 }
 
 
+/**
+ * Test CFile::get_all_maildirs()
+ */
+void TestFileAllMaildirs(CuTest * tc)
+{
+    char tmpl[] = "/tmp/lumail.XXXXXX";
+    std::string prefix = mkdtemp(tmpl);
+
+    /*
+     * The prefix is itself a maildir, with a maildir++ folder, and a
+     * plain directory containing another maildir.
+     */
+    const char *maildirs[] = { "", "/.Sent", "/lists/debian" };
+
+    for (const char *m : maildirs)
+    {
+        CDirectory::mkdir_p(prefix + m + "/cur");
+        CDirectory::mkdir_p(prefix + m + "/new");
+        CDirectory::mkdir_p(prefix + m + "/tmp");
+    }
+
+    std::ofstream(prefix + "/cur/1.host:2,S");
+    CDirectory::mkdir_p(prefix + "/empty");
+
+    std::vector < std::string > found = CFile::get_all_maildirs(prefix);
+
+    CuAssertIntEquals(tc, 3, found.size());
+    CuAssertStrEquals(tc, prefix.c_str(), found[0].c_str());
+    CuAssertStrEquals(tc, std::string(prefix + "/.Sent").c_str(), found[1].c_str());
+    CuAssertStrEquals(tc, std::string(prefix + "/lists/debian").c_str(), found[2].c_str());
+
+    std::string cmd = "rm -rf " + prefix;
+    CuAssertIntEquals(tc, 0, system(cmd.c_str()));
+
+    CuAssertIntEquals(tc, 0, CFile::get_all_maildirs(prefix).size());
+}
+
+
 /**
  * Test CFile::expand_path()
  */
@@ -474,6 +513,7 @@ CuSuite *
 file_getsuite()
 {
     CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestFileAllMaildirs);
     SUITE_ADD_TEST(suite, TestFileBasename);
     SUITE_ADD_TEST(suite, TestFileCopy);
     SUITE_ADD_TEST(suite, TestFileDirectory);
@@ -16,6 +16,7 @@
  * General Public License can be found in `/usr/share/common-licenses/GPL-2'
  */
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 
@@ -31,6 +32,8 @@
 #include "lua.h"
 #include "maildir.h"
 #include "message.h"
+#include "message_filter.h"
+#include "thread_pool.h"
 #include "util.h"
 
 /*
@@ -40,6 +43,8 @@ CGlobalState::CGlobalState() : Observer(CConfig::instance())
 {
     m_messages = NULL;
     m_current_message = NULL;
+    m_listing_folders = false;
+    m_relist_folders  = false;
     update_messages();
     update_maildirs();
 
@@ -181,6 +186,7 @@ void CGlobalState::update(std::string key_name, CConfigEntry *old)
         {
             CIMAPProxy *proxy = CIMAPProxy::instance();
             proxy->terminate();
+            update_maildirs();
         }
     }
     else if (key_name == "imap.password")
@@ -195,6 +201,7 @@ void CGlobalState::update(std::string key_name, CConfigEntry *old)
         {
             CIMAPProxy *proxy = CIMAPProxy::instance();
             proxy->terminate();
+            update_maildirs();
         }
     }
     else if (key_name == "imap.server")
@@ -209,6 +216,7 @@ void CGlobalState::update(std::string key_name, CConfigEntry *old)
         {
             CIMAPProxy *proxy = CIMAPProxy::instance();
             proxy->terminate();
+            update_maildirs();
         }
     }
 }
@@ -237,13 +245,6 @@ std::vector<std::shared_ptr<CMaildir>> CGlobalState::get_maildirs()
  */
 void CGlobalState::update_maildirs()
 {
-    /*
-     * If we have items already then remove them.
-     */
-    if (!m_maildirs.empty())
-        m_maildirs.clear();
-
-
     /*
      *
      * If `imap.server`, `imap.user`, and `imap.password` are set
@@ -252,60 +253,51 @@ void CGlobalState::update_maildirs()
      */
     CConfig *config = CConfig::instance();
 
+    /*
+     * If we're already fetching the list of IMAP folders then whatever
+     * changed has made that out of date, so we start again once it
+     * completes.
+     */
+    if (m_listing_folders)
+    {
+        m_relist_folders = true;
+        return;
+    }
+
     if ((config->get_string("imap.username", "") != "") &&
             (config->get_string("imap.password", "") != "") &&
             (config->get_string("imap.server", "") != ""))
     {
         /*
-         * Read the output from our IMAP proxy.
+         * This happens in the background, and we keep the current
+         * list until the new one arrives.
          */
-        CIMAPProxy *proxy = CIMAPProxy::instance();
-        std::string json  = proxy->read_imap_output("list_folders\n");
-
-        /*
-         * Now parse the JSON into objects.
-         */
-        Json::Value root;
-        Json::Reader reader;
-        bool parsingSuccessful = reader.parse(json, root);
-
-        if (!parsingSuccessful)
-        {
-            CLua *lua = CLua::instance();
-            lua->on_error("Failed to parse JSON response to 'list_folders': " + json);
-
-            config->set("maildir.max", 0);
-            return;
-        }
-
-        Json::Value folders = root["folders"];
+        m_listing_folders = true;
 
-        int count  = 0;
-
-        for (Json::ValueConstIterator it = folders.begin(); it != folders.end(); ++it)
+        CIMAPProxy *proxy = CIMAPProxy::instance();
+        proxy->send_async("list_folders\n", [this](std::string json)
         {
-            /*
-             * Get the values from the JSON array.
-             */
-            Json::Value single = (*it);
-            int unread       = single["unread"].asInt();
-            int total        = single["total"].asInt();
-            std::string path = single["name"].asString();
-
-            std::shared_ptr<CMaildir> m = std::shared_ptr<CMaildir>(new CMaildir(path, false));
-            m->set_total(total);
-            m->set_unread(unread);
-
-            m_maildirs.push_back(m);
+            m_listing_folders = false;
 
-            count += 1;
-        }
-
-        config->set("maildir.max", count);
+            if (m_relist_folders)
+            {
+                m_relist_folders = false;
+                update_maildirs();
+            }
+            else
+                set_imap_folders(json);
+        });
         return;
     }
 
 
+    /*
+     * If we have items already then remove them.
+     */
+    if (!m_maildirs.empty())
+        m_maildirs.clear();
+
+
     /*
      * Get the maildir prefix - note that we allow an array to be used.
      */
@@ -342,6 +334,31 @@ void CGlobalState::update_maildirs()
         }
     }
 
+    /*
+     * Counting the messages in each maildir means reading its
+     * directories, which is slow on network-filesystems, so we
+     * do that in parallel here.
+     *
+     * The results are cached within each object, so they're ready
+     * when the maildir-view is drawn.
+     */
+    int threads = config->get_integer("maildir.scan_threads", CThreadPool::default_size());
+
+    if ((threads > 1) && (m_maildirs.size() > 1))
+    {
+        CThreadPool pool(threads);
+
+        for (std::shared_ptr<CMaildir> m : m_maildirs)
+        {
+            pool.add([m]()
+            {
+                m->unread_messages();
+            });
+        }
+
+        pool.wait();
+    }
+
     /*
      * Setup the size.
      */
@@ -349,19 +366,87 @@ void CGlobalState::update_maildirs()
 }
 
 
+/*
+ * Replace our maildir-list with the folders in the given output of
+ * the IMAP proxy's `list_folders` command.
+ */
+void CGlobalState::set_imap_folders(std::string json)
+{
+    CConfig *config = CConfig::instance();
+
+    if (!m_maildirs.empty())
+        m_maildirs.clear();
+
+    /*
+     * Now parse the JSON into objects.
+     */
+    Json::Value root;
+    Json::Reader reader;
+    bool parsingSuccessful = reader.parse(json, root);
+
+    if (!parsingSuccessful)
+    {
+        CLua *lua = CLua::instance();
+        lua->on_error("Failed to parse JSON response to 'list_folders': " + json);
+
+        config->set("maildir.max", 0);
+        return;
+    }
+
+    Json::Value folders = root["folders"];
+
+    int count  = 0;
+
+    for (Json::ValueConstIterator it = folders.begin(); it != folders.end(); ++it)
+    {
+        /*
+         * Get the values from the JSON array.
+         */
+        Json::Value single = (*it);
+        int unread       = single["unread"].asInt();
+        int total        = single["total"].asInt();
+        std::string path = single["name"].asString();
+
+        std::shared_ptr<CMaildir> m = std::shared_ptr<CMaildir>(new CMaildir(path, false));
+        m->set_total(total);
+        m->set_unread(unread);
+
+        m_maildirs.push_back(m);
+
+        count += 1;
+    }
+
+    config->set("maildir.max", count);
+}
+
+
 /*
  * Update the cached list of messages.
  */
 void CGlobalState::update_messages(bool force)
 {
-    CLogger *logger = CLogger::instance();
-    logger->log("CGlobalState", "Updating list of messages.");
-
     /*
      * Get the currently selected maildir.
      */
     std::shared_ptr<CMaildir> current = current_maildir();
 
+    /*
+     * If we're watching the current maildir then we just apply the
+     * changes which have happened since we last looked - unless we
+     * can't, in which case we must rebuild.
+     */
+    if ((force == false) && current && current->is_maildir() &&
+            (m_messages != NULL) && (m_watcher.path() == current->path()))
+    {
+        if (apply_changes(current))
+            return;
+
+        force = true;
+    }
+
+    CLogger *logger = CLogger::instance();
+    logger->log("CGlobalState", "Updating list of messages.");
+
     /*
      * If we already have messages open, and the
      * ctime of the directory has not changed, then
@@ -402,6 +487,12 @@ void CGlobalState::update_messages(bool force)
      * create a new store.
      */
     m_messages = new CMessageList;
+    m_message_paths.clear();
+
+    /*
+     * Our threads refer to the old messages.
+     */
+    reset_threads();
 
     /*
      *
@@ -417,6 +508,8 @@ void CGlobalState::update_messages(bool force)
     {
         logger->log("imap", "IMAP is in use.");
 
+        m_watcher.unwatch();
+
         /*
          * If we don't have a currently-selected folder then return.
          */
@@ -483,6 +576,12 @@ void CGlobalState::update_messages(bool force)
             int id_val            = single["id"].asInt();
             std::string flags_val = single["flags"].asString();
 
+            /*
+             * The time the server received the message, if the proxy
+             * told us.
+             */
+            int64_t date_val = single.isMember("date") ? single["date"].asInt64() : -1;
+
             /*
              * Create a path to hold the IMAP message.
              *
@@ -543,6 +642,9 @@ void CGlobalState::update_messages(bool force)
             t->set_imap_flags(f);
             t->set_imap_id(id_val);
 
+            if (date_val > 0)
+                t->set_imap_date(date_val);
+
             /*
              * Add the message to our list.
              */
@@ -561,14 +663,31 @@ void CGlobalState::update_messages(bool force)
      */
     if (current)
     {
+        /*
+         * Start watching before we read the maildir, so that nothing
+         * is missed.  Any changes we see twice are ignored.
+         */
+        if (! m_watcher.watch(current->path()))
+            logger->log("maildir", "Failed to watch %s", current->path().c_str());
+
+        /*
+         * Unless `index.sort` is "none" our Lua code will sort the
+         * messages itself, so there's no point in doing so here.
+         */
+        std::string method = config->get_string("index.sort");
+        bool sorted = (method.empty() || (method == "none"));
+
         logger->log("maildir", "%s", "Fetching messages.");
-        CMessageList contents = current->getMessages();
+        CMessageList contents = current->getMessages(sorted);
 
         for (std::shared_ptr<CMessage> content : contents)
         {
             m_messages->push_back(content) ;
+            m_message_paths[content->path()] = content;
         }
     }
+    else
+        m_watcher.unwatch();
 
     logger->log("maildir", "Found %d message(s).", m_messages->size());
 
@@ -576,6 +695,254 @@ void CGlobalState::update_messages(bool force)
 }
 
 
+/*
+ * Fetch the bodies of the given IMAP messages, in a single round-trip.
+ */
+void CGlobalState::prefetch_messages(std::vector<std::shared_ptr<CMessage> > visible,
+                                     std::vector<std::shared_ptr<CMessage> > others)
+{
+    std::shared_ptr<CMaildir> current = current_maildir();
+
+    if (!current || !current->is_imap())
+        return;
+
+    CMessage::prefetch(visible);
+    CMessage::prefetch(others, true);
+}
+
+
+/*
+ * Apply the changes our watcher has seen to the cached messages.
+ */
+bool CGlobalState::apply_changes(std::shared_ptr<CMaildir> current)
+{
+    std::vector<MAILDIR_CHANGE> changes;
+
+    if (! m_watcher.changes(changes))
+        return false;
+
+    if (changes.empty())
+        return true;
+
+    CLogger *logger = CLogger::instance();
+    logger->log("maildir", "Applying %d change(s).", changes.size());
+
+    /*
+     * The messages which have been removed.
+     */
+    std::unordered_map<CMessage *, bool> removed;
+
+    for (MAILDIR_CHANGE change : changes)
+    {
+        /*
+         * A message has been renamed - if we know about it then just
+         * update the path.  (If we renamed it ourselves that has
+         * already been done.)
+         */
+        if (!change.from.empty() && !change.to.empty())
+        {
+            auto it = m_message_paths.find(change.from);
+
+            if (it != m_message_paths.end())
+            {
+                std::shared_ptr<CMessage> msg = it->second;
+                m_message_paths.erase(it);
+
+                msg->path(change.to);
+                m_message_paths[change.to] = msg;
+
+                current->message_renamed(change.from, change.to);
+                continue;
+            }
+        }
+
+        /*
+         * A message has been removed.
+         */
+        if (!change.from.empty() && change.to.empty())
+        {
+            auto it = m_message_paths.find(change.from);
+
+            if (it != m_message_paths.end())
+            {
+                removed[it->second.get()] = true;
+                m_message_paths.erase(it);
+            }
+
+            current->message_removed(change.from);
+        }
+
+        /*
+         * A message has been added, or renamed from a path we
+         * didn't know about.
+         */
+        if (!change.to.empty() && (m_message_paths.find(change.to) == m_message_paths.end()))
+        {
+            std::shared_ptr<CMessage> msg = current->message_added(change.to);
+
+            m_messages->push_back(msg);
+            m_message_paths[change.to] = msg;
+        }
+    }
+
+    if (! removed.empty())
+    {
+        m_messages->erase(std::remove_if(m_messages->begin(), m_messages->end(),
+                                         [&removed](const std::shared_ptr<CMessage> &m)
+        {
+            return (removed.find(m.get()) != removed.end());
+        }), m_messages->end());
+    }
+
+    CConfig *config = CConfig::instance();
+    config->set("index.max", m_messages->size());
+
+    /*
+     * Let our Lua code know the list has changed, so it can flush any
+     * cached copy.
+     */
+    CLua *lua = CLua::instance();
+
+    if (lua->function_exists("on_messages_changed"))
+        lua->execute("on_messages_changed()");
+
+    return true;
+}
+
+
+/*
+ * Group the given messages into threads.
+ */
+std::vector<THREAD_LINE> CGlobalState::thread_messages(const std::vector<std::shared_ptr<CMessage> > &messages,
+        const std::string &output, const std::string &sort,
+        CThreader::COMPARE compare)
+{
+    if (!m_threads || (m_threads_output != output) || (m_threads_sort != sort))
+    {
+        m_threads        = std::make_shared<CThreadIndex>(output);
+        m_threads_output = output;
+        m_threads_sort   = sort;
+        m_threaded.clear();
+    }
+
+    /*
+     * Messages are keyed by their address, which remains unique for as
+     * long as we hold a reference to them.
+     */
+    std::unordered_map<THREAD_KEY, size_t> offsets;
+
+    for (size_t i = 0; i < messages.size(); i++)
+        offsets[(THREAD_KEY) messages[i].get()] = i;
+
+    if (compare)
+    {
+        m_threads->set_compare([&offsets, &compare](THREAD_KEY a, THREAD_KEY b)
+        {
+            return compare(offsets[a], offsets[b]);
+        });
+    }
+
+    /*
+     * NOTE: sort_date() uses the date cached in the maildir index, so
+     * threading doesn't read each message.
+     */
+    m_threads->set_date([this](THREAD_KEY key)
+    {
+        return m_threaded[key]->sort_date();
+    });
+
+    /*
+     * Remove the messages which have gone.
+     */
+    std::vector<THREAD_KEY> removed;
+
+    for (auto &threaded : m_threaded)
+    {
+        if (offsets.find(threaded.first) == offsets.end())
+            removed.push_back(threaded.first);
+    }
+
+    m_threads->remove(removed);
+
+    for (THREAD_KEY key : removed)
+        m_threaded.erase(key);
+
+    /*
+     * Add those which are new.
+     */
+    std::vector<THREAD_KEY> added;
+    std::vector<THREAD_MESSAGE> headers;
+
+    for (std::shared_ptr<CMessage> msg : messages)
+    {
+        THREAD_KEY key = (THREAD_KEY) msg.get();
+
+        if (m_threaded.find(key) != m_threaded.end())
+            continue;
+
+        THREAD_MESSAGE h;
+        h.message_id  = msg->header("Message-ID");
+        h.references  = msg->header("References");
+        h.in_reply_to = msg->header("In-Reply-To");
+        h.subject     = msg->header("Subject");
+
+        m_threaded[key] = msg;
+        added.push_back(key);
+        headers.push_back(h);
+    }
+
+    if (!added.empty())
+    {
+        CLogger *logger = CLogger::instance();
+        logger->log("threads", "Threading %d new message(s), removing %d.", added.size(), removed.size());
+    }
+
+    m_threads->insert(added, headers);
+
+    /*
+     * Our functions refer to our arguments, so mustn't outlive them.
+     */
+    m_threads->set_compare(nullptr);
+    m_threads->set_date(nullptr);
+
+    std::vector<THREAD_LINE> lines = m_threads->lines();
+
+    for (THREAD_LINE &line : lines)
+        line.message = offsets[line.message];
+
+    return (lines);
+}
+
+
+/*
+ * Discard our threads.
+ */
+void CGlobalState::reset_threads()
+{
+    m_threads = nullptr;
+    m_threaded.clear();
+}
+
+
+/*
+ * Return the messages which match the given limit.
+ */
+std::vector<std::shared_ptr<CMessage> > CGlobalState::limit_messages(const std::string &limit)
+{
+    CMessageFilter filter(limit);
+
+    if (!filter.error().empty())
+    {
+        CLua *lua = CLua::instance();
+        lua->on_error("Invalid index.limit: " + filter.error());
+
+        return (*m_messages);
+    }
+
+    return (filter.filter(*m_messages));
+}
+
+
 /*
  * Return the currently-selected maildir.
  */
@@ -591,6 +958,12 @@ std::shared_ptr<CMaildir>CGlobalState::current_maildir()
  */
 void CGlobalState::set_maildir(std::shared_ptr<CMaildir> updated)
 {
+    /*
+     * Persist the metadata-index of the folder we're leaving.
+     */
+    if (m_current_maildir && (m_current_maildir != updated))
+        m_current_maildir->save_index();
+
     m_current_maildir = updated;
 
     update_messages();
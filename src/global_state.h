@@ -22,12 +22,15 @@
 
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "maildir.h"
+#include "maildir_watcher.h"
 #include "message.h"
 #include "observer.h"
 #include "singleton.h"
+#include "thread_index.h"
 
 
 /**
@@ -95,15 +98,73 @@ public:
     /**
      * Update our cache of messages, that cached list is returned
      * via `get_messages`.
+     *
+     * For local maildirs we watch for changes, and apply them to the
+     * existing list rather than rebuilding it, unless `force` is set.
      */
     void update_messages(bool force = false);
 
+    /**
+     * If the current folder is an IMAP one then fetch the bodies of
+     * any of the given messages which haven't yet been retrieved,
+     * in a single round-trip.
+     *
+     * We wait for the `visible` messages, but not for the `others`.
+     */
+    void prefetch_messages(std::vector<std::shared_ptr<CMessage> > visible,
+                           std::vector<std::shared_ptr<CMessage> > others);
+
+    /**
+     * Group the given messages, from the current folder, into threads,
+     * returning them in display order.
+     *
+     * `output` holds the signs used for indentation, and `compare`, if
+     * set, sorts the messages - by offset - using the method named `sort`.
+     *
+     * The threads are retained, and when this is next called only those
+     * affected by messages which have come or gone are updated.  They are
+     * discarded when the messages are reloaded, or `output` or `sort`
+     * change.
+     */
+    std::vector<THREAD_LINE> thread_messages(const std::vector<std::shared_ptr<CMessage> > &messages,
+            const std::string &output, const std::string &sort,
+            CThreader::COMPARE compare);
+
+    /**
+     * Discard the threads retained by `thread_messages`.
+     */
+    void reset_threads();
+
+    /**
+     * Return those messages in the current folder which match the given
+     * limit-expression, as per CMessageFilter, in order.
+     *
+     * If the expression is invalid the error is reported via Lua, and
+     * every message is returned.
+     */
+    std::vector<std::shared_ptr<CMessage> > limit_messages(const std::string &limit);
+
     /**
      * This method is called when a configuration key changes,
      * via our observer implementation.
      */
     void update(std::string key_name, CConfigEntry *old);
 
+private:
+
+    /**
+     * Apply the changes our watcher has seen to the cached messages.
+     *
+     * Returns false if the messages must be rebuilt from scratch.
+     */
+    bool apply_changes(std::shared_ptr<CMaildir> current);
+
+    /**
+     * Replace our maildir-list with the folders in the given output of
+     * the IMAP proxy's `list_folders` command.
+     */
+    void set_imap_folders(std::string json);
+
 private:
 
     /**
@@ -121,8 +182,40 @@ private:
      */
     std::vector<std::shared_ptr<CMessage> > *m_messages;
 
+    /**
+     * The messages above, keyed by their path.
+     *
+     * **NOTE**: This is only maintained for local maildirs.
+     */
+    std::unordered_map<std::string, std::shared_ptr<CMessage> > m_message_paths;
+
+    /**
+     * Watches the current maildir for changes.
+     */
+    CMaildirWatcher m_watcher;
+
+    /**
+     * Set while we're waiting for the list of IMAP folders.
+     */
+    bool m_listing_folders;
+
+    /**
+     * Set if the list of IMAP folders must be fetched again once the
+     * current request completes, as the settings have changed.
+     */
+    bool m_relist_folders;
+
     /**
      * The currently selected message.
      */
     std::shared_ptr<CMessage> m_current_message;
+
+    /**
+     * The threads of the current messages, the signs and sort-method
+     * they were built with, and the messages they contain, by key.
+     */
+    std::shared_ptr<CThreadIndex> m_threads;
+    std::string m_threads_output;
+    std::string m_threads_sort;
+    std::unordered_map<THREAD_KEY, std::shared_ptr<CMessage> > m_threaded;
 };
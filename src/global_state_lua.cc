@@ -24,8 +24,10 @@
 #include "global_state.h"
 #include "maildir_lua.h"
 #include "message_lua.h"
+#include "message_sort.h"
 #include "lua.h"
 #include "screen.h"
+#include "thread_pool.h"
 
 
 /**
@@ -144,6 +146,101 @@ int l_CGlobalState_current_messages(lua_State * l)
 
 
 
+/**
+ * Implementation of `Global:limit_messages`.
+ *
+ * Return the messages in the current folder which match the given
+ * limit-expression, which defaults to the value of `index.limit`.
+ */
+int l_CGlobalState_limit_messages(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_limit_messages");
+
+    CConfig *config = CConfig::instance();
+    std::string limit = config->get_string("index.limit", "all");
+
+    if (lua_isstring(l, 2))
+        limit = lua_tostring(l, 2);
+
+    CGlobalState *global = CGlobalState::instance();
+    std::vector<std::shared_ptr<CMessage> > msgs = global->limit_messages(limit);
+
+    lua_createtable(l, msgs.size(), 0);
+
+    for (size_t i = 0; i < msgs.size(); i++)
+    {
+        push_cmessage(l, msgs[i]);
+        lua_rawseti(l, -2, i + 1);
+    }
+
+    return 1;
+}
+
+
+/**
+ * Implementation of `Global:prefetch_messages`.
+ */
+int l_CGlobalState_prefetch_messages(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_prefetch_messages");
+
+    luaL_checktype(l, 2, LUA_TTABLE);
+    int current = luaL_optinteger(l, 3, 0);
+
+    /*
+     * The rows which are about to be drawn, if any.
+     */
+    int shown = luaL_optinteger(l, 4, 0);
+    int count = luaL_optinteger(l, 5, 0);
+
+    /*
+     * By default we fetch a screen's worth of messages either side of
+     * the current one.
+     */
+    CConfig *config = CConfig::instance();
+    int window = config->get_integer("imap.prefetch", CScreen::height());
+
+    int first = std::max(current - std::max(window, 0), 0);
+    int last  = current + std::max(window, 0);
+
+    if (count > 0)
+    {
+        first = std::min(first, shown);
+        last  = std::max(last, shown + count - 1);
+    }
+
+    std::vector<std::shared_ptr<CMessage> > visible;
+    std::vector<std::shared_ptr<CMessage> > others;
+
+    for (int i = first; i <= last; i++)
+    {
+        bool drawn = (i >= shown) && (i < shown + count);
+
+        if (!drawn && (window < 1))
+            continue;
+
+        lua_rawgeti(l, 2, i + 1);
+
+        if (lua_isnil(l, -1))
+        {
+            lua_pop(l, 1);
+            break;
+        }
+
+        if (drawn)
+            visible.push_back(l_CheckCMessage(l, -1));
+        else
+            others.push_back(l_CheckCMessage(l, -1));
+
+        lua_pop(l, 1);
+    }
+
+    CGlobalState *global = CGlobalState::instance();
+    global->prefetch_messages(visible, others);
+    return 0;
+}
+
+
 /**
  * Return all the registered view-modes to the caller.
  */
@@ -186,6 +283,270 @@ int l_CGlobalState_select_message(lua_State * l)
 }
 
 
+
+/**
+ * Read the table of messages at the given stack-index.
+ */
+static std::vector<std::shared_ptr<CMessage> > check_messages(lua_State * l, int index)
+{
+    std::vector<std::shared_ptr<CMessage> > messages;
+
+    for (int i = 1; ; i++)
+    {
+        lua_rawgeti(l, index, i);
+
+        if (lua_isnil(l, -1))
+        {
+            lua_pop(l, 1);
+            break;
+        }
+
+        messages.push_back(l_CheckCMessage(l, -1));
+        lua_pop(l, 1);
+    }
+
+    return (messages);
+}
+
+
+/**
+ * Return a function which compares the messages, by offset, in the
+ * table at stack-index 2 via the Lua function `compare_by_$method`,
+ * or nullptr if there is no such function.
+ *
+ * If the Lua function fails then all further comparisons return false,
+ * and the error is stored in `error`.
+ */
+static CThreader::COMPARE lua_compare(lua_State * l, const std::string &method, std::string &error)
+{
+    std::string func = "compare_by_" + method;
+
+    lua_getglobal(l, func.c_str());
+    bool found = lua_isfunction(l, -1);
+    lua_pop(l, 1);
+
+    if (!found)
+        return nullptr;
+
+    return [l, func, &error](size_t a, size_t b)
+    {
+        if (!error.empty())
+            return false;
+
+        lua_getglobal(l, func.c_str());
+        lua_rawgeti(l, 2, a + 1);
+        lua_rawgeti(l, 2, b + 1);
+
+        if (lua_pcall(l, 2, 1, 0) != 0)
+        {
+            const char *err = lua_tostring(l, -1);
+            error = err ? err : func;
+            lua_pop(l, 1);
+            return false;
+        }
+
+        bool result = lua_toboolean(l, -1);
+        lua_pop(l, 1);
+        return result;
+    };
+}
+
+
+/**
+ * Implementation of `Global:sort_messages`.
+ *
+ * Return the given table of messages sorted by the given method, which
+ * defaults to the value of `index.sort`.
+ *
+ * The built-in methods are implemented natively, by CMessageSort, and
+ * others via the Lua function `compare_by_$method`.  If there is no
+ * such function then nil is returned.
+ */
+int l_CGlobalState_sort_messages(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_sort_messages");
+
+    luaL_checktype(l, 2, LUA_TTABLE);
+
+    CConfig *config = CConfig::instance();
+    std::string method = config->get_string("index.sort", "none");
+
+    if (lua_isstring(l, 3))
+        method = lua_tostring(l, 3);
+
+    if (method == "none")
+    {
+        lua_pushvalue(l, 2);
+        return 1;
+    }
+
+    std::vector<std::shared_ptr<CMessage> > messages = check_messages(l, 2);
+    std::vector<size_t> offsets;
+
+    std::shared_ptr<CMessageSort> sorter = CMessageSort::create(method, messages);
+
+    if (sorter)
+    {
+        /*
+         * Large folders are sorted across all our CPUs.
+         */
+        int threads = 1;
+        int threshold = config->get_integer("index.parallel_sort", 50000);
+
+        if ((threshold > 0) && (messages.size() >= (size_t)threshold))
+            threads = CThreadPool::default_size();
+
+        offsets = sorter->sorted(threads);
+    }
+    else
+    {
+        std::string error;
+        CThreader::COMPARE compare = lua_compare(l, method, error);
+
+        if (!compare)
+        {
+            lua_pushnil(l);
+            return 1;
+        }
+
+        for (size_t i = 0; i < messages.size(); i++)
+            offsets.push_back(i);
+
+        std::stable_sort(offsets.begin(), offsets.end(), compare);
+
+        /*
+         * On failure return the messages unsorted.
+         */
+        if (!error.empty())
+        {
+            CLua *lua = CLua::instance();
+            lua->on_error(error);
+
+            lua_pushvalue(l, 2);
+            return 1;
+        }
+    }
+
+    lua_createtable(l, offsets.size(), 0);
+
+    for (size_t i = 0; i < offsets.size(); i++)
+    {
+        lua_rawgeti(l, 2, offsets[i] + 1);
+        lua_rawseti(l, -2, i + 1);
+    }
+
+    return 1;
+}
+
+
+/**
+ * Implementation of `Global:thread_messages`.
+ *
+ * Thread the given table of messages, returning:
+ *
+ *   1. The messages in threaded order.
+ *   2. A table of their indentation, keyed by message.
+ *   3. The first message of each thread, in order, and keyed by message
+ *      to the number of its thread.
+ *
+ * The messages within each thread are sorted by the method named by
+ * `threads.sort`, as per `Global:sort_messages`, if that exists.
+ *
+ * The threads are retained by CGlobalState, so when this is called
+ * again only the messages which have come or gone are re-threaded.
+ */
+int l_CGlobalState_thread_messages(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_thread_messages");
+
+    luaL_checktype(l, 2, LUA_TTABLE);
+
+    std::vector<std::shared_ptr<CMessage> > messages = check_messages(l, 2);
+
+    CConfig *config = CConfig::instance();
+    std::string output = config->get_string("threads.output", " ;`;-> ");
+    std::string sort   = config->get_string("threads.sort");
+
+    /*
+     * Sort natively, if we can, otherwise via the Lua comparison
+     * function, if there is one.
+     */
+    std::string error;
+    CThreader::COMPARE compare = nullptr;
+    std::shared_ptr<CMessageSort> sorter = CMessageSort::create(sort, messages);
+
+    if (sorter)
+    {
+        compare = [sorter](size_t a, size_t b)
+        {
+            return (*sorter)(a, b);
+        };
+    }
+    else
+        compare = lua_compare(l, sort, error);
+
+    if (!compare)
+        sort = "";
+
+    CGlobalState *global = CGlobalState::instance();
+    std::vector<THREAD_LINE> lines = global->thread_messages(messages, output, sort, compare);
+
+    /*
+     * If the comparison failed then our threads are in an unknown order,
+     * so they can't be reused.
+     */
+    if (!error.empty())
+    {
+        global->reset_threads();
+
+        CLua *lua = CLua::instance();
+        lua->on_error(error);
+    }
+
+    /*
+     * Build up our results.
+     */
+    lua_createtable(l, lines.size(), 0);
+    int flat = lua_gettop(l);
+
+    lua_newtable(l);
+    int indentation = lua_gettop(l);
+
+    lua_newtable(l);
+    int roots = lua_gettop(l);
+    int thread = 0;
+
+    for (size_t i = 0; i < lines.size(); i++)
+    {
+        THREAD_LINE &line = lines[i];
+
+        lua_rawgeti(l, 2, line.message + 1);
+        lua_pushvalue(l, -1);
+        lua_rawseti(l, flat, i + 1);
+
+        lua_pushvalue(l, -1);
+        lua_pushstring(l, line.indent.c_str());
+        lua_rawset(l, indentation);
+
+        if (line.root)
+        {
+            thread += 1;
+
+            lua_pushvalue(l, -1);
+            lua_rawseti(l, roots, thread);
+
+            lua_pushvalue(l, -1);
+            lua_pushinteger(l, thread);
+            lua_rawset(l, roots);
+        }
+
+        lua_pop(l, 1);
+    }
+
+    return 3;
+}
+
+
 /**
  * Register the global `Global` object to the Lua environment,
  * and setup our public methods upon which the user may operate.
@@ -197,10 +558,14 @@ void InitGlobalState(lua_State * l)
         {"current_maildir", l_CGlobalState_current_maildir},
         {"current_message", l_CGlobalState_current_message},
         {"current_messages", l_CGlobalState_current_messages},
+        {"limit_messages", l_CGlobalState_limit_messages},
         {"maildirs", l_CGlobalState_maildirs},
         {"modes", l_CGlobalState_modes},
+        {"prefetch_messages", l_CGlobalState_prefetch_messages},
         {"select_maildir", l_CGlobalState_select_maildir},
         {"select_message", l_CGlobalState_select_message},
+        {"sort_messages", l_CGlobalState_sort_messages},
+        {"thread_messages", l_CGlobalState_thread_messages},
         {NULL, NULL}
     };
     luaL_newmetatable(l, "luaL_CGlobalState");
@@ -0,0 +1,114 @@
+/*
+ * imap_lua.cc - IMAP functions bound to lua.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <string>
+
+#include "imap_proxy.h"
+#include "lua.h"
+
+
+/**
+ * @file imap_lua.cc
+ *
+ * This file implements the exporting of an IMAP-class to Lua, which
+ * allows commands to be sent to our IMAP-proxy in the background.
+ * Usage looks like this:
+ *
+ *<code>
+ *   -- Fetch the list of remote folders<br />
+ *   IMAP:send( "list_folders\n", function( output )<br />
+ *      Panel:append( "Folders: " .. output )<br />
+ *   end )<br />
+ *</code>
+ *
+ */
+
+
+
+/**
+ * Send a command to the IMAP-proxy without waiting for the result.
+ *
+ * If a function is given it is invoked, from the main loop, with the
+ * output of the command once it completes.
+ */
+int l_CIMAP_send(lua_State * l)
+{
+    CLuaLog("l_CIMAP_send");
+
+    const char *cmd = luaL_checkstring(l, 2);
+
+    std::function<void(std::string)> done = nullptr;
+
+    if (lua_isfunction(l, 3))
+    {
+        /*
+         * Keep the function alive until the command completes.
+         */
+        lua_pushvalue(l, 3);
+        int ref = luaL_ref(l, LUA_REGISTRYINDEX);
+
+        done = [l, ref](std::string output)
+        {
+            lua_rawgeti(l, LUA_REGISTRYINDEX, ref);
+            luaL_unref(l, LUA_REGISTRYINDEX, ref);
+            lua_pushlstring(l, output.data(), output.size());
+
+            if (lua_pcall(l, 1, 0, 0) != 0)
+            {
+                const char *err = lua_tostring(l, -1);
+                std::string msg = err ? err : "IMAP:send callback failed";
+                lua_pop(l, 1);
+
+                CLua::instance()->on_error(msg);
+            }
+        };
+    }
+
+    CIMAPProxy *proxy = CIMAPProxy::instance();
+    proxy->send_async(cmd, done);
+
+    return 0;
+}
+
+
+/**
+ * Export the IMAP object to Lua, this only contains the single static
+ * method `send`.
+ */
+void InitIMAP(lua_State * l)
+{
+    luaL_Reg sFooRegs[] =
+    {
+        {"send",  l_CIMAP_send},
+        {NULL,    NULL}
+    };
+    luaL_newmetatable(l, "luaL_CIMAP");
+
+#if LUA_VERSION_NUM == 501
+    luaL_register(l, NULL, sFooRegs);
+#elif LUA_VERSION_NUM == 502 || LUA_VERSION_NUM == 503
+    luaL_setfuncs(l, sFooRegs, 0);
+#else
+#error We are only tested under Lua 5.1, 5.2, or 5.3.
+#endif
+
+    lua_pushvalue(l, -1);
+    lua_setfield(l, -1, "__index");
+    lua_setglobal(l, "IMAP");
+}
@@ -17,10 +17,14 @@
  */
 
 
+#include <algorithm>
 #include <cstdlib>
+#include <errno.h>
 #include <fcntl.h>
 #include <memory>
+#include <poll.h>
 #include <signal.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
@@ -34,12 +38,172 @@
 #include "config.h"
 #include "file.h"
 #include "imap_proxy.h"
+#include "lua.h"
 #include "statuspanel.h"
 
 
+/*
+ * The largest frame we'll accept from the proxy.  A length beyond this
+ * means the stream is corrupt, rather than that we should allocate it.
+ */
+#define MAX_FRAME (256 * 1024 * 1024)
+
+
+/*
+ * How long, in seconds, we give a newly-launched proxy to start.
+ */
+#define LAUNCH_TIMEOUT 10
+
+
+/*
+ * Connect to the Unix domain-socket at the given path, returning the
+ * file-descriptor, or -1 on failure.
+ */
+static int connect_socket(const std::string &path)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (path.size() >= sizeof(addr.sun_path))
+        return -1;
+
+    strcpy(addr.sun_path, path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd < 0)
+        return -1;
+
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/*
+ * Write a request frame to the given socket.
+ */
+static bool write_frame(int fd, uint32_t id, const std::string &payload)
+{
+    std::string frame = std::to_string(id) + " " + std::to_string(payload.size()) + "\n" + payload;
+    size_t done = 0;
+
+    while (done < frame.size())
+    {
+        ssize_t n = ::send(fd, frame.data() + done, frame.size() - done, MSG_NOSIGNAL);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0)
+            return false;
+
+        done += n;
+    }
+
+    return true;
+}
+
+
+/*
+ * Remove a single response frame from the start of `buffer`, if it
+ * holds a complete one.
+ *
+ * Returns 1 if a frame was found, 0 if more data is required, and -1
+ * if the data is malformed, including a frame which is oversized.
+ */
+static int parse_frame(std::string &buffer, uint32_t &id, std::string &payload)
+{
+    size_t eol = buffer.find('\n');
+
+    if (eol == std::string::npos)
+        return ((buffer.size() > 64) ? -1 : 0);
+
+    std::string header = buffer.substr(0, eol);
+    unsigned long i   = 0;
+    unsigned long len = 0;
+
+    if (sscanf(header.c_str(), "%lu %lu", &i, &len) != 2)
+        return -1;
+
+    /*
+     * A protocol error - our caller will close the connection.
+     */
+    if (len > MAX_FRAME)
+        return -1;
+
+    if (buffer.size() - (eol + 1) < len)
+    {
+        buffer.reserve(eol + 1 + len);
+        return 0;
+    }
+
+    id      = i;
+    payload = buffer.substr(eol + 1, len);
+    buffer.erase(0, eol + 1 + len);
+    return 1;
+}
+
+
+/*
+ * Read a single response frame from the given socket, waiting for it
+ * if necessary.
+ *
+ * `buffer` holds data which has been read but not yet consumed, and
+ * must be preserved between calls.
+ *
+ * Returns false on error, including a malformed or oversized frame.
+ */
+static bool read_frame_from(int fd, std::string &buffer, uint32_t &id, std::string &payload)
+{
+    char buf[65536];
+
+    while (true)
+    {
+        int found = parse_frame(buffer, id, payload);
+
+        if (found != 0)
+            return (found > 0);
+
+        ssize_t n = read(fd, buf, sizeof(buf));
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0)
+            return false;
+
+        buffer.append(buf, n);
+    }
+}
+
+
+/*
+ * Can the given file-descriptor be read without blocking?
+ */
+static bool readable(int fd)
+{
+    struct pollfd pfd;
+    pfd.fd      = fd;
+    pfd.events  = POLLIN;
+    pfd.revents = 0;
+
+    return ((poll(&pfd, 1, 0) > 0) && (pfd.revents != 0));
+}
+
+
 CIMAPProxy::CIMAPProxy()
 {
-    m_child = -1;
+    m_child    = -1;
+    m_fd       = -1;
+    m_ready    = -1;
+    m_launched = 0;
+    m_next_id  = 1;
 
     /*
      * Use ~/.imap.sock as the path.
@@ -63,6 +227,23 @@ CIMAPProxy::~CIMAPProxy()
  */
 void CIMAPProxy::terminate()
 {
+    disconnect();
+
+    if (m_ready >= 0)
+        close(m_ready);
+
+    m_ready = -1;
+
+    /*
+     * Commands which were waiting for the proxy fail too, and all of
+     * their handlers are invoked by the next `run_completions()`.
+     */
+    while (!m_queue.empty())
+    {
+        fail(m_queue.front());
+        m_queue.pop_front();
+    }
+
     if (m_child != -1)
     {
         kill(m_child, SIGKILL);
@@ -71,66 +252,114 @@ void CIMAPProxy::terminate()
 }
 
 
-
 /*
- * Launch the child, if not already running.
+ * Start the child, if not already running, without waiting for it.
  */
-void CIMAPProxy::launch()
+bool CIMAPProxy::spawn()
 {
     size_t unused __attribute__((unused));
 
-    if (m_child == -1)
-    {
-        /*
-         * Get the path to the proxy
-         */
-        CConfig *config = CConfig::instance();
-        std::string path = config->get_string("imap.proxy");
+    if (m_child != -1)
+        return true;
 
-        if (path.empty())
-            path = "/usr/share/lumail/imap-proxy" ;
+    /*
+     * Get the path to the proxy
+     */
+    CConfig *config = CConfig::instance();
+    std::string path = config->get_string("imap.proxy");
 
+    if (path.empty())
+        path = "/usr/share/lumail/imap-proxy" ;
 
-        /*
-         * If the proxy exists then we can launch it, if not we'll
-         * error.
-         */
-        if (CFile::exists(path))
-        {
-            CStatusPanel *panel = CStatusPanel::instance();
-            int i;
 
-            panel->add_text("Launching IMAP proxy " + path);
+    /*
+     * If the proxy exists then we can launch it, if not we'll
+     * error.
+     */
+    CStatusPanel *panel = CStatusPanel::instance();
+
+    if (! CFile::exists(path))
+    {
+        panel->add_text("IMAP proxy not found at " + path);
+        return false;
+    }
 
-            unlink(m_sock_path.c_str());
-            m_child = fork();
+    panel->add_text("Launching IMAP proxy " + path);
 
-            if (m_child == 0)
-            {
-                unused = execl(path.c_str(), CFile::basename(path).c_str(), NULL);
-                exit(1);
-            }
+    /*
+     * The child inherits the writing end of this pipe, and closes it
+     * once it is listening.
+     */
+    int ready[2];
 
-            for (i = 0; i < 100; i++)
-            {
-                if (access(m_sock_path.c_str(), F_OK) == 0)
-                {
-                    /*
-                     * Done waiting, successfully.
-                     */
-                    return;
-                }
-                usleep(100000);
-            }
-            panel->add_text("Timed out waiting for IMAP proxy");
-        }
-        else
+    if (pipe2(ready, O_CLOEXEC) != 0)
+        ready[0] = ready[1] = -1;
+
+    unlink(m_sock_path.c_str());
+    m_child = fork();
+
+    if (m_child == 0)
+    {
+        if (ready[1] >= 0)
         {
-            CStatusPanel *panel = CStatusPanel::instance();
-            panel->add_text("IMAP proxy not found at " + path);
-            return;
+            fcntl(ready[1], F_SETFD, 0);
+            setenv("LUMAIL_PROXY_READY", std::to_string(ready[1]).c_str(), 1);
         }
+
+        unused = execl(path.c_str(), CFile::basename(path).c_str(), NULL);
+        exit(1);
+    }
+
+    if (ready[1] >= 0)
+        close(ready[1]);
+
+    if (m_child == -1)
+    {
+        if (ready[0] >= 0)
+            close(ready[0]);
+
+        return false;
+    }
+
+    m_ready    = ready[0];
+    m_launched = time(NULL);
+    return true;
+}
+
+
+/*
+ * Launch the child, if not already running, and wait for it to
+ * start listening.
+ */
+void CIMAPProxy::launch()
+{
+    if (! spawn())
+        return;
+
+    if (m_ready < 0)
+        return;
+
+    /*
+     * The pipe becomes readable when the proxy closes it, or exits.
+     */
+    struct pollfd pfd;
+    pfd.fd     = m_ready;
+    pfd.events = POLLIN;
+
+    int timeout = (LAUNCH_TIMEOUT - (time(NULL) - m_launched)) * 1000;
+    int ret;
+
+    while ((ret = poll(&pfd, 1, std::max(timeout, 0))) < 0 && errno == EINTR)
+        ;
+
+    if (ret == 0)
+    {
+        CStatusPanel *panel = CStatusPanel::instance();
+        panel->add_text("Timed out waiting for IMAP proxy");
     }
+
+    close(m_ready);
+    m_ready = -1;
 }
 
 
@@ -140,51 +369,334 @@ void CIMAPProxy::launch()
  */
 std::string CIMAPProxy::read_imap_output(std::string cmd)
 {
-    int sockfd;
-    sockaddr_un addr;
-    size_t unused __attribute__((unused));
-    std::string result = "";
+    return (receive(send(cmd)));
+}
+
 
+/*
+ * Send a command to our IMAP proxy, without waiting for the result.
+ */
+uint32_t CIMAPProxy::send(std::string cmd)
+{
     /*
-     * Launch the child.
+     * If the proxy has been restarted our connection will be stale, so
+     * we reconnect and try again once.
      */
-    launch();
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        if (! connect_proxy())
+        {
+            launch();
 
+            if (! connect_proxy())
+                return 0;
+        }
 
-    sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
-    addr.sun_family = AF_UNIX;
+        uint32_t id = write_request(cmd);
 
-    strcpy(addr.sun_path, m_sock_path.c_str());
+        if (id != 0)
+            return id;
+    }
 
-    if (connect(sockfd, (sockaddr*)&addr, sizeof(addr)) < 0)
-    {
+    return 0;
+}
+
+
+/*
+ * Wait for, and return, the result of the command with the given ID.
+ */
+std::string CIMAPProxy::receive(uint32_t id)
+{
+    if (id == 0)
         return ("Connection failed!");
+
+    auto it = m_responses.find(id);
+
+    while (it == m_responses.end())
+    {
+        if (! read_frame())
+            return ("Connection failed!");
+
+        it = m_responses.find(id);
     }
 
-    unused = write(sockfd, cmd.c_str(), cmd.length());
+    std::string result;
+    result.swap(it->second);
+    m_responses.erase(it);
 
-    char buf[65535];
-    int rval;
+    return (result);
+}
 
-    do
+
+/*
+ * Send a command to our IMAP proxy without waiting.
+ */
+void CIMAPProxy::send_async(std::string cmd, std::function<void(std::string)> done)
+{
+    IMAP_REQUEST req;
+    req.cmd  = cmd;
+    req.done = done;
+
+    /*
+     * If the proxy isn't running we start it, but don't wait for it -
+     * the command is sent from `run_completions()` once it's listening.
+     */
+    if ((m_ready < 0) && !connect_proxy())
+        spawn();
+
+    if (m_ready >= 0)
     {
-        bzero(buf, sizeof(buf));
+        m_queue.push_back(req);
+        return;
+    }
+
+    if (! write_async(req))
+        fail(req);
+}
+
+
+/*
+ * The file-descriptor which signals progress.
+ */
+int CIMAPProxy::completion_fd()
+{
+    if ((m_ready >= 0) && !m_queue.empty())
+        return (m_ready);
+
+    if ((m_fd >= 0) && !m_async.empty())
+        return (m_fd);
+
+    return -1;
+}
+
 
-        if ((rval = read(sockfd, buf, sizeof(buf) - 1)) < 0)
+/*
+ * Collect the results of completed asynchronous commands, and invoke
+ * their handlers.
+ */
+void CIMAPProxy::run_completions()
+{
+    /*
+     * Has the proxy we launched started listening?
+     */
+    if ((m_ready >= 0) && (readable(m_ready) || (time(NULL) - m_launched >= LAUNCH_TIMEOUT)))
+    {
+        close(m_ready);
+        m_ready = -1;
+
+        if (! connect_proxy())
         {
-            // Failure
+            while (!m_queue.empty())
+            {
+                fail(m_queue.front());
+                m_queue.pop_front();
+            }
         }
-        else if (rval == 0)
+    }
+
+    if ((m_fd >= 0) && !m_async.empty() && readable(m_fd))
+        read_available();
+
+    if (m_completed.empty())
+        return;
+
+    std::deque<IMAP_REQUEST> completed;
+    completed.swap(m_completed);
+
+    CLua *lua = CLua::instance();
+
+    for (IMAP_REQUEST &req : completed)
+    {
+        if (req.done)
+            req.done(req.output);
+
+        /*
+         * Let Lua know which command completed.
+         */
+        if (lua->function_exists("on_imap_complete"))
         {
-            // End.
+            std::string name = req.cmd.substr(0, req.cmd.find_first_of(" \n"));
+            lua->function2string("on_imap_complete", name);
         }
-        else
+    }
+}
+
+
+/*
+ * Connect to the proxy, if we're not already connected.
+ */
+bool CIMAPProxy::connect_proxy()
+{
+    if (m_fd >= 0)
+        return true;
+
+    m_fd = connect_socket(m_sock_path);
+
+    if (m_fd < 0)
+        return false;
+
+    /*
+     * Send the commands which were waiting for the proxy to start,
+     * ahead of anything else.
+     */
+    std::deque<IMAP_REQUEST> queued;
+    queued.swap(m_queue);
+
+    for (IMAP_REQUEST &req : queued)
+    {
+        if (! write_async(req))
+            fail(req);
+    }
+
+    return (m_fd >= 0);
+}
+
+
+/*
+ * Drop our connection, failing any outstanding commands.
+ */
+void CIMAPProxy::disconnect()
+{
+    if (m_fd >= 0)
+        close(m_fd);
+
+    m_fd = -1;
+    m_input.clear();
+    m_responses.clear();
+
+    for (auto &it : m_async)
+        fail(it.second);
+
+    m_async.clear();
+}
+
+
+/*
+ * Write a request upon our connection.
+ */
+uint32_t CIMAPProxy::write_request(const std::string &cmd)
+{
+    if (m_fd < 0)
+        return 0;
+
+    uint32_t id = m_next_id++;
+
+    if (m_next_id == 0)
+        m_next_id = 1;
+
+    if (write_frame(m_fd, id, cmd))
+        return id;
+
+    disconnect();
+    return 0;
+}
+
+
+/*
+ * Send an asynchronous command upon our connection.
+ */
+bool CIMAPProxy::write_async(IMAP_REQUEST &req)
+{
+    /*
+     * As with `send()` we reconnect once, in case the proxy restarted.
+     */
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        if (! connect_proxy())
+            return false;
+
+        uint32_t id = write_request(req.cmd);
+
+        if (id != 0)
         {
-            result += buf;
+            m_async[id] = req;
+            return true;
         }
     }
-    while (rval > 0);
 
-    close(sockfd);
-    return (result);
+    return false;
+}
+
+
+/*
+ * Mark an asynchronous command as having failed.
+ */
+void CIMAPProxy::fail(IMAP_REQUEST &req)
+{
+    req.output = "Connection failed!";
+    m_completed.push_back(req);
+}
+
+
+/*
+ * Read a single response frame, waiting for it if necessary.
+ */
+bool CIMAPProxy::read_frame()
+{
+    if (m_fd < 0)
+        return false;
+
+    uint32_t id = 0;
+    std::string payload;
+
+    if (! read_frame_from(m_fd, m_input, id, payload))
+    {
+        disconnect();
+        return false;
+    }
+
+    store(id, payload);
+    return true;
+}
+
+
+/*
+ * Read whatever is available upon our connection, without waiting.
+ */
+void CIMAPProxy::read_available()
+{
+    char buf[65536];
+    ssize_t n = read(m_fd, buf, sizeof(buf));
+
+    if (n < 0 && errno == EINTR)
+        return;
+
+    if (n <= 0)
+    {
+        disconnect();
+        return;
+    }
+
+    m_input.append(buf, n);
+
+    uint32_t id = 0;
+    std::string payload;
+    int found;
+
+    while ((found = parse_frame(m_input, id, payload)) > 0)
+        store(id, payload);
+
+    if (found < 0)
+        disconnect();
+}
+
+
+/*
+ * Store a response, for `receive()` or `run_completions()`.
+ */
+void CIMAPProxy::store(uint32_t id, std::string &payload)
+{
+    auto it = m_async.find(id);
+
+    if (it == m_async.end())
+    {
+        m_responses[id].swap(payload);
+        return;
+    }
+
+    IMAP_REQUEST req = it->second;
+    m_async.erase(it);
+
+    req.output.swap(payload);
+    m_completed.push_back(req);
 }
@@ -19,14 +19,59 @@
 
 #pragma once
 
+#include <deque>
+#include <functional>
+#include <stdint.h>
 #include <string>
+#include <time.h>
+#include <unordered_map>
 
 #include "singleton.h"
 
+/**
+ * A command which is executed asynchronously.
+ */
+typedef struct _imap_request
+{
+    /**
+     * The command to send.
+     */
+    std::string cmd;
+
+    /**
+     * The output of the command, once completed.
+     */
+    std::string output;
+
+    /**
+     * Invoked, from the main loop, with the output.
+     */
+    std::function<void(std::string)> done;
+} IMAP_REQUEST;
+
+
 /**
  * The CImapProxy class is a singleton which is responsible for
- * launching our (perl) IMAP-proxy.
+ * launching our (perl) IMAP-proxy, and talking to it.
+ *
+ * We keep a single connection open to the proxy, and each request and
+ * response is sent as a frame:
  *
+ * <pre>
+ * ID LENGTH\n
+ * ..LENGTH bytes of payload..
+ * </pre>
+ *
+ * The ID of a response matches that of the request it answers, so
+ * several requests may be sent before any of the results are read,
+ * and payloads may contain arbitrary binary data.
+ *
+ * Commands may also be sent asynchronously, via `send_async()`, over
+ * the same connection.  The main loop polls `completion_fd()` alongside
+ * the keyboard, and calls `run_completions()` to collect their results
+ * and invoke the handlers.  As the proxy answers the requests upon a
+ * connection in order, commands are executed in the order they were
+ * issued, however they were sent.
  */
 class CIMAPProxy : public Singleton<CIMAPProxy>
 {
@@ -50,21 +95,155 @@ public:
     std::string read_imap_output(std::string cmd);
 
     /**
-     * Launch an IMAP-proxy.
+     * Send a command to our IMAP proxy, without waiting for the result.
+     *
+     * Returns an ID to pass to `receive()`, or zero on failure.
+     */
+    uint32_t send(std::string cmd);
+
+    /**
+     * Send a command to our IMAP proxy without waiting for the result,
+     * or for the proxy to start.
+     *
+     * When the command completes `done`, if set, will be invoked with
+     * the output from `run_completions()`, in the main thread.
+     */
+    void send_async(std::string cmd, std::function<void(std::string)> done = nullptr);
+
+    /**
+     * A file-descriptor which becomes readable when there is progress
+     * to be made upon asynchronous commands, or -1 if there are none.
+     */
+    int completion_fd();
+
+    /**
+     * Collect the results of any asynchronous commands which have
+     * completed, without waiting, and invoke their handlers along with
+     * the Lua `on_imap_complete` function.
+     */
+    void run_completions();
+
+    /**
+     * Wait for, and return, the result of the command with the given ID.
+     */
+    std::string receive(uint32_t id);
+
+    /**
+     * Launch an IMAP-proxy, waiting for it to start listening.
      */
     void launch();
 
     /**
      * Terminate the child we've launched.
+     *
+     * Any commands which are outstanding fail, with their handlers
+     * invoked by the next call to `run_completions()`.
      */
     void terminate();
 
+private:
+
+    /**
+     * Start the IMAP-proxy, if we've not already done so, without
+     * waiting for it.  Returns true if it is running.
+     */
+    bool spawn();
+
+    /**
+     * Connect to the proxy, if we're not already connected, sending
+     * any asynchronous commands which were waiting for it to start.
+     */
+    bool connect_proxy();
+
+    /**
+     * Drop our connection, failing any outstanding commands.
+     */
+    void disconnect();
+
+    /**
+     * Write a request upon our connection, returning its ID, or zero
+     * on failure.
+     */
+    uint32_t write_request(const std::string &cmd);
+
+    /**
+     * Send an asynchronous command upon our connection, if we can.
+     */
+    bool write_async(IMAP_REQUEST &req);
+
+    /**
+     * Mark an asynchronous command as having failed.
+     */
+    void fail(IMAP_REQUEST &req);
+
+    /**
+     * Read a single response frame, waiting for it if necessary.
+     */
+    bool read_frame();
+
+    /**
+     * Read whatever is available upon our connection, without waiting.
+     */
+    void read_available();
+
+    /**
+     * Store a response, for `receive()` or `run_completions()`.
+     */
+    void store(uint32_t id, std::string &payload);
+
 private:
     /**
      * The handle to our child-process.
      */
     pid_t m_child;
 
+    /**
+     * The connection to the proxy, or -1.
+     */
+    int m_fd;
+
+    /**
+     * A pipe which the proxy we've launched closes once it is
+     * listening, or -1 once it has done so.
+     */
+    int m_ready;
+
+    /**
+     * The time at which we launched the proxy.
+     */
+    time_t m_launched;
+
+    /**
+     * The ID of the next request we send.
+     */
+    uint32_t m_next_id;
+
+    /**
+     * Data we've read which doesn't yet make up a complete frame.
+     */
+    std::string m_input;
+
+    /**
+     * Results which have been read, but not yet collected.
+     */
+    std::unordered_map<uint32_t, std::string> m_responses;
+
+    /**
+     * Asynchronous commands which are waiting for the proxy to start.
+     */
+    std::deque<IMAP_REQUEST> m_queue;
+
+    /**
+     * Asynchronous commands which have been sent, by ID.
+     */
+    std::unordered_map<uint32_t, IMAP_REQUEST> m_async;
+
+    /**
+     * Asynchronous commands which have completed, but whose handlers
+     * have not yet been invoked.
+     */
+    std::deque<IMAP_REQUEST> m_completed;
+
     /**
      * Path to the IMAP proxy socket.
      */
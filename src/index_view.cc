@@ -17,6 +17,7 @@
  */
 
 
+#include "global_state.h"
 #include "index_view.h"
 
 
@@ -40,3 +41,16 @@ CIndexView::CIndexView()
 CIndexView::~CIndexView()
 {
 }
+
+
+/*
+ * Pick up any changes to the current maildir.
+ *
+ * When the maildir is being watched this only applies the changes
+ * which have been reported since we last looked.
+ */
+void CIndexView::on_idle()
+{
+    CGlobalState *global = CGlobalState::instance();
+    global->update_messages();
+}
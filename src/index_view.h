@@ -41,4 +41,9 @@ public:
      * Destructor.
      */
     ~CIndexView();
+
+    /**
+     * Pick up any changes to the current maildir.
+     */
+    void on_idle();
 };
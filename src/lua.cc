@@ -34,6 +34,7 @@ extern void InitConfig(lua_State * l);
 extern void InitDirectory(lua_State * l);
 extern void InitFile(lua_State * l);
 extern void InitGlobalState(lua_State * l);
+extern void InitIMAP(lua_State * l);
 extern void InitLogfile(lua_State * l);
 extern void InitMaildir(lua_State * l);
 extern void InitMessage(lua_State * l);
@@ -100,6 +101,7 @@ CLua::CLua() : Observer(CConfig::instance())
     InitDirectory(m_lua);
     InitFile(m_lua);
     InitGlobalState(m_lua);
+    InitIMAP(m_lua);
     InitLogfile(m_lua);
     InitMaildir(m_lua);
     InitMessage(m_lua);
@@ -528,6 +530,140 @@ std::vector<std::string> CLua::functiona2table(std::string function, std::string
 }
 
 
+/*
+ * Call a Lua function which will return a table of text, for the given
+ * range of lines.
+ */
+std::vector<std::string> CLua::function2table(std::string function, int first, int count)
+{
+    CLuaLog("function2table(" + function + "," + std::to_string(first) + "," + std::to_string(count) + ")");
+
+    std::vector<std::string> result;
+
+    /*
+     * Get the function - if it doesn't exist we're done.
+     */
+    lua_getglobal(m_lua, function.c_str());
+
+    if (lua_isnil(m_lua, -1))
+    {
+        lua_pop(m_lua, 1);
+        fprintf(stderr, "FAILED to find function %s\n", function.c_str());
+        return (result);
+    }
+
+    /*
+     * Call the function passing in the range.
+     */
+    lua_pushinteger(m_lua, first);
+    lua_pushinteger(m_lua, count);
+
+    if (lua_pcall(m_lua, 2, 1, 0) != 0)
+    {
+        fprintf(stderr, "FAILED  - Error in %s\n", function.c_str());
+
+        if (lua_isstring(m_lua, -1))
+        {
+            /*
+             * The error message will be on the stack..
+             */
+            char *err = strdup(lua_tostring(m_lua, -1));
+            lua_pop(m_lua, 1);
+
+            on_error(err);
+
+            /*
+             * Avoid a leak.
+             */
+            free(err);
+        }
+        else
+            lua_pop(m_lua, 1);
+
+        return (result);
+    }
+
+    /*
+     * Now get the table we expected, in order.
+     */
+    if (lua_istable(m_lua, -1))
+    {
+        for (int i = 1; ; i++)
+        {
+            lua_rawgeti(m_lua, -1, i);
+
+            if (lua_isnil(m_lua, -1))
+            {
+                lua_pop(m_lua, 1);
+                break;
+            }
+
+            const char *entry = lua_tostring(m_lua, -1);
+            result.push_back(entry ? entry : "");
+
+            lua_pop(m_lua, 1);
+        }
+    }
+
+    lua_pop(m_lua, 1);
+    return (result);
+}
+
+
+/*
+ * Call a Lua function which will return an integer.
+ */
+int CLua::function2integer(std::string function, int fallback)
+{
+    CLuaLog("function2integer(" + function + ")");
+
+    /*
+     * Get the function - if it doesn't exist we're done.
+     */
+    lua_getglobal(m_lua, function.c_str());
+
+    if (lua_isnil(m_lua, -1))
+    {
+        lua_pop(m_lua, 1);
+        return (fallback);
+    }
+
+    /*
+     * Call the function - and handle any error.
+     */
+    if (lua_pcall(m_lua, 0, 1, 0) != 0)
+    {
+        if (lua_isstring(m_lua, -1))
+        {
+            /*
+             * The error message will be on the stack..
+             */
+            char *err = strdup(lua_tostring(m_lua, -1));
+            lua_pop(m_lua, 1);
+
+            on_error(err);
+
+            /*
+             * Avoid a leak.
+             */
+            free(err);
+        }
+        else
+            lua_pop(m_lua, 1);
+
+        return (fallback);
+    }
+
+    int result = fallback;
+
+    if (lua_isnumber(m_lua, -1))
+        result = lua_tointeger(m_lua, -1);
+
+    lua_pop(m_lua, 1);
+    return (result);
+}
+
+
 /*
  * Return the (string) contents of a variable.
  * Used for our test suite only.
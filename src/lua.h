@@ -110,6 +110,23 @@ public:
      */
     std::vector<std::string> functiona2table(std::string function, std::string arugment);
 
+    /**
+     * Call a Lua function which will return a table of text, passing
+     * it the (zero-based) index of the first line it should return, and
+     * the number of lines wanted.
+     *
+     * This is used by views which only generate their visible lines.
+     */
+    std::vector<std::string> function2table(std::string function, int first, int count);
+
+    /**
+     * Call a Lua function which will return an integer.
+     *
+     * If the function is missing, fails, or returns a non-number,
+     * return the given default.
+     */
+    int function2integer(std::string function, int fallback);
+
     /**
      * Call the user "on_error" function with given error message.
      */
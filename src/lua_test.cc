@@ -249,6 +249,60 @@ void TestStringFunction(CuTest * tc)
 }
 
 
+/**
+ * Test calling a function with a range of lines.
+ */
+void TestFunctionToTableRange(CuTest * tc)
+{
+    /*
+     * Get the singleton
+     */
+    CLua *instance = CLua::instance();
+    CuAssertPtrNotNull(tc, instance);
+
+    /*
+     * Define a function that returns the requested line-numbers.
+     */
+    instance->execute("function get_range(first, count) t = {} for i = first, first + count - 1 do table.insert(t, \"line \" .. i) end return t end");
+
+    std::vector<std::string> results = instance->function2table("get_range", 10, 3);
+
+    CuAssertIntEquals(tc, 3, results.size());
+    CuAssertStrEquals(tc, "line 10", results.at(0).c_str());
+    CuAssertStrEquals(tc, "line 11", results.at(1).c_str());
+    CuAssertStrEquals(tc, "line 12", results.at(2).c_str());
+
+    /*
+     * A missing function returns nothing.
+     */
+    results = instance->function2table("missing_range", 0, 3);
+    CuAssertIntEquals(tc, 0, results.size());
+}
+
+
+/**
+ * Test calling a function we expect to return an integer.
+ */
+void TestIntegerFunction(CuTest * tc)
+{
+    /*
+     * Get the singleton
+     */
+    CLua *instance = CLua::instance();
+    CuAssertPtrNotNull(tc, instance);
+
+    instance->execute("function get_count() return 42 end");
+    CuAssertIntEquals(tc, 42, instance->function2integer("get_count", -1));
+
+    /*
+     * Non-numbers, and missing functions, give the default.
+     */
+    instance->execute("function get_count() return {} end");
+    CuAssertIntEquals(tc, -1, instance->function2integer("get_count", -1));
+    CuAssertIntEquals(tc, 7, instance->function2integer("missing_count", 7));
+}
+
+
 CuSuite *
 lua_getsuite()
 {
@@ -257,7 +311,9 @@ lua_getsuite()
     SUITE_ADD_TEST(suite, TestErrorHandler);
     SUITE_ADD_TEST(suite, TestFunctionToTable);
     SUITE_ADD_TEST(suite, TestFunctionToTableArgs);
+    SUITE_ADD_TEST(suite, TestFunctionToTableRange);
     SUITE_ADD_TEST(suite, TestFunctionExists);
     SUITE_ADD_TEST(suite, TestStringFunction);
+    SUITE_ADD_TEST(suite, TestIntegerFunction);
     return suite;
 }
@@ -56,7 +56,18 @@ void run_all_tests()
     CuSuiteAddSuite(suite, history_getsuite());
     CuSuiteAddSuite(suite, input_queue_getsuite());
     CuSuiteAddSuite(suite, lua_getsuite());
+    CuSuiteAddSuite(suite, maildir_getsuite());
+    CuSuiteAddSuite(suite, maildir_index_getsuite());
+    CuSuiteAddSuite(suite, maildir_watcher_getsuite());
+    CuSuiteAddSuite(suite, mapped_message_getsuite());
+    CuSuiteAddSuite(suite, message_cache_getsuite());
+    CuSuiteAddSuite(suite, message_filter_getsuite());
+    CuSuiteAddSuite(suite, message_format_getsuite());
+    CuSuiteAddSuite(suite, message_sort_getsuite());
     CuSuiteAddSuite(suite, statuspanel_getsuite());
+    CuSuiteAddSuite(suite, thread_index_getsuite());
+    CuSuiteAddSuite(suite, thread_pool_getsuite());
+    CuSuiteAddSuite(suite, threader_getsuite());
     CuSuiteAddSuite(suite, util_getsuite());
 
     CuSuiteRun(suite);
@@ -23,6 +23,7 @@
 #include <fcntl.h>
 #include <fstream>
 #include <iostream>
+#include <mutex>
 #include <sstream>
 #include <string.h>
 #include <string>
@@ -40,10 +41,104 @@
 #include "file.h"
 #include "imap_proxy.h"
 #include "maildir.h"
+#include "maildir_index.h"
 #include "message.h"
 #include "util.h"
 
 
+/**
+ * The message-counts of a local maildir, along with the modification
+ * times of `cur/` and `new/` at which they were calculated.
+ */
+typedef struct _maildir_counts
+{
+    struct timespec cur;
+    struct timespec new_;
+    int total;
+    int unread;
+} MAILDIR_COUNTS;
+
+
+/**
+ * The counts of each maildir we've seen, keyed by path.
+ *
+ * This is global, rather than per-object, because the list of
+ * maildirs is recreated each time we enter maildir-mode.
+ */
+static std::unordered_map<std::string, MAILDIR_COUNTS> g_counts;
+
+/**
+ * Protects `g_counts`, as maildirs may be counted in parallel.
+ */
+static std::mutex g_counts_lock;
+
+
+
+
+/*
+ * Return the modification-time of the given stat-result, with
+ * sub-second precision where available.
+ */
+static struct timespec mtime_of(const struct stat &sb)
+{
+#ifdef __linux__
+    return (sb.st_mtim);
+#else
+    struct timespec ts;
+    ts.tv_sec  = sb.st_mtime;
+    ts.tv_nsec = 0;
+    return (ts);
+#endif
+}
+
+
+/*
+ * Classify a single entry in `cur/` or `new/`, updating the counts.
+ *
+ * This mirrors `CMessage::is_new()` - a message is unread if it is
+ * beneath `new/`, has the `N` flag, or lacks the `S` flag.
+ */
+static void count_entry(CDirectoryIterator &it, bool is_new, int &total, int &unread)
+{
+    const char *name = it.name();
+
+    /*
+     * Skip dotfiles, and sub-directories.
+     */
+    if (name[0] == '.')
+        return;
+
+    if (it.is_directory())
+        return;
+
+    total += 1;
+
+    if (is_new)
+    {
+        unread += 1;
+        return;
+    }
+
+    const char *flags = strstr(name, ":2,");
+
+    if ((flags == NULL) || (strchr(flags + 3, 'N') != NULL) || (strchr(flags + 3, 'S') == NULL))
+        unread += 1;
+}
+
+
+/*
+ * Count the messages in the given directory, without creating
+ * any message-objects.
+ */
+static void count_messages(std::string path, bool is_new, int &total, int &unread)
+{
+    CDirectoryIterator it(path);
+
+    while (it.next())
+        count_entry(it, is_new, total, unread);
+}
+
+
 /*
  * Constructor.  Create an object to encapsulate the given path.
  */
@@ -60,6 +155,13 @@ CMaildir::CMaildir(const std::string name, bool is_local)
      * Default cache-time.
      */
     m_modified = -1;
+    m_unread   = 0;
+    m_total    = 0;
+
+    /*
+     * The index is created on-demand.
+     */
+    m_index = NULL;
 }
 
 
@@ -80,6 +182,11 @@ std::string CMaildir::path()
  */
 CMaildir::~CMaildir()
 {
+    /*
+     * Deleting the index will save it, if it has changed.
+     */
+    if (m_index != NULL)
+        delete(m_index);
 }
 
 
@@ -125,42 +232,68 @@ int CMaildir::total_messages()
 
 /*
  * Update the cached total/unread message counts.
+ *
+ * The counts are memoised by the modification-times of `cur/` and
+ * `new/`, and when they must be recalculated we merely read the
+ * directory-entries, rather than creating a message-object for each.
+ *
+ * This may be called from a worker-thread, see `update_maildirs()`.
  */
 void CMaildir::update_cache()
 {
     if (m_imap)
         return;
 
-    /*
-     * If the cached date isn't different then we need do nothing.
-     */
-    time_t last_mod = last_modified();
+    std::string cur = m_path + "/cur";
+    std::string new_ = m_path + "/new";
 
-    if (last_mod == m_modified)
-        return;
+    struct stat cur_sb, new_sb;
+
+    if (stat(cur.c_str(), &cur_sb) != 0)
+        memset(&cur_sb, 0, sizeof(cur_sb));
+
+    if (stat(new_.c_str(), &new_sb) != 0)
+        memset(&new_sb, 0, sizeof(new_sb));
+
+    struct timespec cur_time = mtime_of(cur_sb);
+    struct timespec new_time = mtime_of(new_sb);
 
     /*
-     * Otherwise update the last modified time.
+     * If neither directory has changed we need do nothing.
      */
-    m_modified = last_mod;
+    {
+        std::lock_guard<std::mutex> lock(g_counts_lock);
+        auto it = g_counts.find(m_path);
+
+        if ((it != g_counts.end()) &&
+                (it->second.cur.tv_sec == cur_time.tv_sec) &&
+                (it->second.cur.tv_nsec == cur_time.tv_nsec) &&
+                (it->second.new_.tv_sec == new_time.tv_sec) &&
+                (it->second.new_.tv_nsec == new_time.tv_nsec))
+        {
+            m_total  = it->second.total;
+            m_unread = it->second.unread;
+            return;
+        }
+    }
 
     /*
-     * Get all messages, and update the total
+     * Otherwise count the messages.
      */
-    CMessageList all = getMessages();
-    m_total = all.size();
+    m_total  = 0;
+    m_unread = 0;
 
+    count_messages(cur, false, m_total, m_unread);
+    count_messages(new_, true, m_total, m_unread);
 
-    /*
-      * Now update the unread count.
-      */
-    m_unread = 0;
+    MAILDIR_COUNTS counts;
+    counts.cur    = cur_time;
+    counts.new_   = new_time;
+    counts.total  = m_total;
+    counts.unread = m_unread;
 
-    for (std::shared_ptr < CMessage > message : all)
-    {
-        if (message->is_new())
-            m_unread++;
-    }
+    std::lock_guard<std::mutex> lock(g_counts_lock);
+    g_counts[m_path] = counts;
 }
 
 /*
@@ -213,49 +346,112 @@ time_t CMaildir::last_modified()
  * is paid.
  *
  */
-CMessageList CMaildir::getMessages()
+CMessageList CMaildir::getMessages(bool sorted)
 {
     CMessageList result;
 
-    /*
-     * Directories we search.
-     */
-    std::vector < std::string > dirs;
-    dirs.push_back(m_path + "/cur/");
-    dirs.push_back(m_path + "/new/");
+    if (m_imap)
+        return result;
+
+    if (m_index == NULL)
+        m_index = new CMaildirIndex(m_path);
 
     /*
-     * For each directory.
+     * Validate the index against the contents of cur/ + new/.
+     *
+     * This gives us an entry for each message, without needing
+     * to open any of them.
      */
-    for (std::string path : dirs)
-    {
+    std::vector<std::shared_ptr<CMessageMetadata>> entries = m_index->refresh(sorted);
 
+    for (std::shared_ptr<CMessageMetadata> entry : entries)
+    {
         /*
-         * Get the entries in the directory
+         * Build up the path - removing duplicate "/" characters.
          */
-        std::vector<std::string> entries = CDirectory::entries(path);
+        std::string file = m_path + "/" + entry->file.to_string();
+        file.erase(std::unique(file.begin(), file.end(), both_slashes()), file.end());
 
-        /*
-         * For each one - if it isn't a dirrectory create a message
-         * using the path.
-         *
-         * This test is required because `CDirectory::entries` will return
-         * both the prefix, and the children "." + "..".
-         */
-        for (std::string file : entries)
-        {
-            if (! CFile::is_directory(file))
-            {
-                std::shared_ptr < CMessage > t = std::shared_ptr < CMessage > (new CMessage(std::string(file)));
-                result.push_back(t);
-            }
-        }
+        std::shared_ptr < CMessage > t = std::shared_ptr < CMessage > (new CMessage(file));
+        t->set_metadata(entry);
+        result.push_back(t);
     }
 
     return result;
 }
 
 
+/*
+ * Return the path of a message relative to its maildir: "cur/xxx".
+ */
+static std::string relative_path(std::string path)
+{
+    size_t offset = path.rfind('/');
+
+    if ((offset != std::string::npos) && (offset > 0))
+        offset = path.rfind('/', offset - 1);
+
+    if (offset == std::string::npos)
+        return (path);
+
+    return (path.substr(offset + 1));
+}
+
+
+/*
+ * Create a message-object for a path which has been added to this maildir.
+ */
+std::shared_ptr<CMessage> CMaildir::message_added(std::string path)
+{
+    std::shared_ptr < CMessage > t = std::shared_ptr < CMessage > (new CMessage(path));
+
+    if (m_imap)
+        return (t);
+
+    if (m_index == NULL)
+        m_index = new CMaildirIndex(m_path);
+
+    t->set_metadata(m_index->add(relative_path(path)));
+    return (t);
+}
+
+
+/*
+ * Update our index to reflect the removal of a path from this maildir.
+ */
+void CMaildir::message_removed(std::string path)
+{
+    if (m_index != NULL)
+        m_index->remove(relative_path(path));
+}
+
+
+/*
+ * Update our index to reflect the renaming of a message in this maildir.
+ */
+void CMaildir::message_renamed(std::string from, std::string to)
+{
+    if (m_imap)
+        return;
+
+    if (m_index == NULL)
+        m_index = new CMaildirIndex(m_path);
+
+    m_index->add(relative_path(to));
+    m_index->remove(relative_path(from));
+}
+
+
+/*
+ * Write our metadata index to disk, if it has changed.
+ */
+void CMaildir::save_index()
+{
+    if (m_index != NULL)
+        m_index->save();
+}
+
+
 /*
  * Save the given message in this maildir.
  *
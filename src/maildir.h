@@ -26,6 +26,12 @@
 #include "message.h"
 
 
+/*
+ * Forward declaration of class.
+ */
+class CMaildirIndex;
+
+
 
 
 /**
@@ -131,8 +137,47 @@ public:
 
     /**
       * Get all of the messages in this maildir.
+      *
+      * For local maildirs each message is associated with its entry
+      * in our metadata index, which is refreshed against the contents
+      * of `cur/` and `new/`.
+      *
+      * Pass `sorted` as false if the caller will order the messages
+      * itself, to avoid sorting them by filename first.
       */
-    CMessageList getMessages();
+    CMessageList getMessages(bool sorted = true);
+
+
+    /**
+     * Create a message-object for the given path, which has been
+     * added to this maildir, updating our index to match.
+     *
+     * If the path is the result of renaming an indexed message then
+     * the existing index-entry is reused.
+     */
+    std::shared_ptr<CMessage> message_added(std::string path);
+
+
+    /**
+     * Update our index to reflect the removal of the given path
+     * from this maildir.
+     */
+    void message_removed(std::string path);
+
+
+    /**
+     * Update our index to reflect the renaming of a message within
+     * this maildir, without creating a message-object for it.
+     */
+    void message_renamed(std::string from, std::string to);
+
+
+    /**
+     * Write our metadata index to disk, if it has changed.
+     *
+     * **NOTE**: This is a NOP for IMAP folders.
+     */
+    void save_index();
 
 
     /**
@@ -174,10 +219,11 @@ private:
     bool m_imap;
 
     /**
-     * The date/time this maildir was last updated.  Used to maintain a
-     * cache that can be expired/tested easily.
+     * The faked modification-time of an IMAP folder, which is updated
+     * via `bump_mtime()`.
      *
-     * **NOTE**: This does not apply to IMAP folders.
+     * **NOTE**: Local maildirs use the real modification-times of
+     * `cur/` + `new/` instead.
      */
     time_t m_modified;
 
@@ -192,7 +238,16 @@ private:
     int m_total;
 
     /**
-     * Update the cached total/unread message counts.
+     * The persistent metadata index of our messages, created
+     * on-demand.
+     *
+     * **NOTE**: This does not apply to IMAP folders.
+     */
+    CMaildirIndex *m_index;
+
+    /**
+     * Update the cached total/unread message counts, which is done
+     * without creating any message-objects.
      *
      * **NOTE**: This is a NOP for IMAP folders.
      */
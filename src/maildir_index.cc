@@ -0,0 +1,727 @@
+/*
+ * maildir_index.cc - Persistent metadata index for a single maildir.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "approxidate.h"
+#include "config.h"
+#include "directory.h"
+#include "file.h"
+#include "maildir_index.h"
+#include "util.h"
+
+
+/**
+ * @file maildir_index.cc
+ *
+ * This file implements the CMaildirIndex class, which persists the
+ * metadata of the messages in a maildir so that they don't need to
+ * be re-parsed each time the folder is opened.
+ *
+ * The on-disk format is designed to be used in-place, via mmap(2):
+ *
+ *   INDEX_HEADER | INDEX_RECORD * count | string-pool
+ *
+ * Each record is fixed-width, and refers to its strings by offset and
+ * length within the pool.  Integers are stored in host byte-order; the
+ * index is a local cache, and is simply rebuilt if it can't be used.
+ *
+ */
+
+
+/**
+ * The magic-bytes which start our index.
+ */
+static const char INDEX_MAGIC[4] = { 'L', 'M', 'I', 'X' };
+
+/**
+ * The version of the format.  Bump this if the record layout, or the
+ * meaning of any field, changes.
+ */
+static const uint32_t INDEX_VERSION = 5;
+
+
+/**
+ * A reference to a string in the pool.
+ */
+typedef struct _index_string
+{
+    uint32_t offset;
+    uint32_t length;
+} INDEX_STRING;
+
+
+/**
+ * The header at the start of the index.
+ */
+typedef struct _index_header
+{
+    char     magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t record_size;
+    uint64_t pool_size;
+} INDEX_HEADER;
+
+
+/**
+ * A single (fixed-width) record.
+ */
+typedef struct _index_record
+{
+    uint64_t inode;
+    int64_t  mtime;
+    int64_t  size;
+    int64_t  date;
+    int32_t  attachments;
+    uint32_t parsed;
+    int64_t  attachment_size;
+    uint32_t mime_flags;
+    uint32_t reserved;
+
+    INDEX_STRING file;
+    INDEX_STRING flags;
+    INDEX_STRING from;
+    INDEX_STRING to;
+    INDEX_STRING subject;
+    INDEX_STRING message_id;
+    INDEX_STRING in_reply_to;
+    INDEX_STRING references;
+} INDEX_RECORD;
+
+
+
+/**
+ * A read-only mapping of an index-file.
+ *
+ * This is shared by all the entries loaded from it, and unmapped
+ * when the last of them is freed.
+ */
+class CMappedIndex
+{
+public:
+    CMappedIndex(void *addr, size_t len) : m_addr(addr), m_len(len) {}
+
+    ~CMappedIndex()
+    {
+        munmap(m_addr, m_len);
+    }
+
+    const char *data() const
+    {
+        return (const char *) m_addr;
+    }
+
+    size_t size() const
+    {
+        return m_len;
+    }
+
+private:
+    void  *m_addr;
+    size_t m_len;
+};
+
+
+
+/*
+ * Constructor.
+ */
+CMessageMetadata::CMessageMetadata()
+{
+    inode       = 0;
+    mtime       = 0;
+    size        = 0;
+    date        = 0;
+    attachments = -1;
+    attachment_size = 0;
+    mime_flags  = 0;
+    parsed      = false;
+    modified    = false;
+}
+
+
+/*
+ * If the named header is one we cache then return its value.
+ */
+bool CMessageMetadata::header(const std::string &name, CStringView &value)
+{
+    if (name == "from")
+        value = from;
+    else if (name == "to")
+        value = to;
+    else if (name == "subject")
+        value = subject;
+    else if (name == "message-id")
+        value = message_id;
+    else if (name == "in-reply-to")
+        value = in_reply_to;
+    else if (name == "references")
+        value = references;
+    else
+        return false;
+
+    return true;
+}
+
+
+/*
+ * Update the given field to hold a copy of the given value.
+ */
+void CMessageMetadata::set(CStringView &field, const std::string &value)
+{
+    /*
+     * Reuse the slot this field was given last time, if any.
+     */
+    for (auto &slot : m_storage)
+    {
+        if (slot.first == &field)
+        {
+            slot.second = value;
+            field = CStringView(slot.second);
+            return;
+        }
+    }
+
+    m_storage.push_back(std::make_pair(&field, value));
+    field = CStringView(m_storage.back().second);
+}
+
+
+/*
+ * Update the cached header-fields from the given header-map.
+ */
+void CMessageMetadata::update(std::unordered_map<std::string, std::string> &headers)
+{
+    set(from, headers["from"]);
+    set(to, headers["to"]);
+    set(subject, headers["subject"]);
+    set(message_id, headers["message-id"]);
+    set(in_reply_to, headers["in-reply-to"]);
+    set(references, headers["references"]);
+
+    date = 0;
+
+    std::string d = headers["delivery-date"];
+
+    if (d.empty())
+        d = headers["date"];
+
+    /*
+     * We parse the date just as CMessage::get_ctime() does for messages
+     * which aren't indexed, so that both agree.
+     */
+    struct timeval t;
+
+    if (!d.empty() && (approxidate(d.c_str(), &t) == 0))
+        date = t.tv_sec;
+
+    parsed   = true;
+    modified = true;
+}
+
+
+
+/*
+ * Append a string to the pool, returning a reference to it.
+ */
+static INDEX_STRING pool_add(std::string &pool, const CStringView &value)
+{
+    INDEX_STRING ref;
+    ref.offset = pool.size();
+    ref.length = value.size();
+
+    pool.append(value.data(), value.size());
+    return ref;
+}
+
+
+/*
+ * Return the flags of a maildir filename, given its unique-name.
+ */
+static std::string flags_of(const std::string &name, const std::string &key)
+{
+    if (name.size() > key.size() + 3)
+        return (name.substr(key.size() + 3));
+
+    return "";
+}
+
+
+/*
+ * Is the given entry still valid for the file with the given status?
+ *
+ * A message which has been rewritten in place keeps its name and inode,
+ * so once we've cached its headers we also compare its size and time.
+ */
+static bool unchanged(const std::shared_ptr<CMessageMetadata> &e, const struct stat &sb)
+{
+    if (e->inode != (uint64_t) sb.st_ino)
+        return false;
+
+    if (! e->parsed)
+        return true;
+
+    return ((e->mtime == (int64_t) sb.st_mtime) && (e->size == (int64_t) sb.st_size));
+}
+
+
+/*
+ * Resolve a reference into the pool, returning false if it is out of bounds.
+ */
+static bool pool_get(const char *pool, uint64_t pool_size, const INDEX_STRING &ref, CStringView &value)
+{
+    if (((uint64_t) ref.offset + ref.length) > pool_size)
+        return false;
+
+    value = CStringView(pool + ref.offset, ref.length);
+    return true;
+}
+
+
+
+/*
+ * Constructor.
+ */
+CMaildirIndex::CMaildirIndex(std::string maildir)
+{
+    m_maildir = maildir;
+    m_file    = index_path(maildir);
+    m_loaded  = false;
+    m_dirty   = false;
+}
+
+
+/*
+ * Destructor.
+ */
+CMaildirIndex::~CMaildirIndex()
+{
+    save();
+}
+
+
+/*
+ * Return the path to the on-disk index for the given maildir.
+ */
+std::string CMaildirIndex::index_path(std::string maildir)
+{
+    CConfig *config    = CConfig::instance();
+    std::string prefix = config->get_string("cache.prefix");
+
+    if (prefix.empty())
+        return "";
+
+    return (prefix + "/index/" + escape_filename(maildir));
+}
+
+
+/*
+ * Return the unique part of a maildir filename: "123.host:2,S" -> "123.host".
+ */
+std::string CMaildirIndex::unique_name(std::string file)
+{
+    size_t offset = file.find(":2,");
+
+    if (offset != std::string::npos)
+        file = file.substr(0, offset);
+
+    return (file);
+}
+
+
+/*
+ * Map the index from disk.
+ *
+ * Any error results in an empty index, which will be rebuilt.
+ */
+void CMaildirIndex::load()
+{
+    m_loaded = true;
+
+    if (m_file.empty())
+        return;
+
+    int fd = open(m_file.c_str(), O_RDONLY);
+
+    if (fd < 0)
+        return;
+
+    struct stat sb;
+
+    if ((fstat(fd, &sb) != 0) || ((size_t) sb.st_size < sizeof(INDEX_HEADER)))
+    {
+        close(fd);
+        return;
+    }
+
+    void *addr = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (addr == MAP_FAILED)
+        return;
+
+    std::shared_ptr<CMappedIndex> mapping = std::make_shared<CMappedIndex>(addr, sb.st_size);
+
+    /*
+     * Validate the header, and that the records + pool fit in the file.
+     */
+    const INDEX_HEADER *hdr = (const INDEX_HEADER *) mapping->data();
+
+    if ((memcmp(hdr->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0) ||
+            (hdr->version != INDEX_VERSION) ||
+            (hdr->record_size != sizeof(INDEX_RECORD)) ||
+            ((sizeof(INDEX_HEADER) + (uint64_t) hdr->count * sizeof(INDEX_RECORD) + hdr->pool_size) != mapping->size()))
+        return;
+
+    const INDEX_RECORD *records = (const INDEX_RECORD *)(mapping->data() + sizeof(INDEX_HEADER));
+    const char *pool = mapping->data() + sizeof(INDEX_HEADER) + hdr->count * sizeof(INDEX_RECORD);
+
+    m_entries.reserve(hdr->count);
+
+    for (uint32_t i = 0; i < hdr->count; i++)
+    {
+        const INDEX_RECORD *r = &records[i];
+        std::shared_ptr<CMessageMetadata> e = std::make_shared<CMessageMetadata>();
+
+        if (!pool_get(pool, hdr->pool_size, r->file, e->file) ||
+                !pool_get(pool, hdr->pool_size, r->flags, e->flags) ||
+                !pool_get(pool, hdr->pool_size, r->from, e->from) ||
+                !pool_get(pool, hdr->pool_size, r->to, e->to) ||
+                !pool_get(pool, hdr->pool_size, r->subject, e->subject) ||
+                !pool_get(pool, hdr->pool_size, r->message_id, e->message_id) ||
+                !pool_get(pool, hdr->pool_size, r->in_reply_to, e->in_reply_to) ||
+                !pool_get(pool, hdr->pool_size, r->references, e->references))
+        {
+            /*
+             * A corrupt index is discarded entirely.
+             */
+            m_entries.clear();
+            return;
+        }
+
+        e->inode       = r->inode;
+        e->mtime       = r->mtime;
+        e->size        = r->size;
+        e->date        = r->date;
+        e->attachments = r->attachments;
+        e->attachment_size = r->attachment_size;
+        e->mime_flags  = r->mime_flags;
+        e->parsed      = (r->parsed != 0);
+        e->mapping     = mapping;
+
+        m_entries[unique_name(CFile::basename(e->file.to_string()))] = e;
+    }
+}
+
+
+/*
+ * Write the index to disk, if it has been changed.
+ */
+bool CMaildirIndex::save()
+{
+    if (m_file.empty() || !m_loaded)
+        return true;
+
+    /*
+     * Has any entry been populated since we loaded?
+     */
+    bool changed = m_dirty;
+
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+    {
+        if (it->second->modified)
+            changed = true;
+    }
+
+    if (! changed)
+        return true;
+
+    /*
+     * Build up the records, and the pool of strings they refer to.
+     */
+    std::vector<INDEX_RECORD> records;
+    std::string pool;
+
+    records.reserve(m_entries.size());
+
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+    {
+        std::shared_ptr<CMessageMetadata> e = it->second;
+        INDEX_RECORD r;
+
+        memset(&r, 0, sizeof(r));
+        r.inode       = e->inode;
+        r.mtime       = e->mtime;
+        r.size        = e->size;
+        r.date        = e->date;
+        r.attachments = e->attachments;
+        r.attachment_size = e->attachment_size;
+        r.mime_flags  = e->mime_flags;
+        r.parsed      = e->parsed ? 1 : 0;
+        r.file        = pool_add(pool, e->file);
+        r.flags       = pool_add(pool, e->flags);
+        r.from        = pool_add(pool, e->from);
+        r.to          = pool_add(pool, e->to);
+        r.subject     = pool_add(pool, e->subject);
+        r.message_id  = pool_add(pool, e->message_id);
+        r.in_reply_to = pool_add(pool, e->in_reply_to);
+        r.references  = pool_add(pool, e->references);
+
+        records.push_back(r);
+    }
+
+    INDEX_HEADER hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    hdr.version     = INDEX_VERSION;
+    hdr.count       = records.size();
+    hdr.record_size = sizeof(INDEX_RECORD);
+    hdr.pool_size   = pool.size();
+
+    std::string dir = m_file.substr(0, m_file.rfind('/'));
+
+    if (! CDirectory::exists(dir))
+        CDirectory::mkdir_p(dir);
+
+    /*
+     * Write to a temporary file, and rename into place, so a crash
+     * can't leave a half-written index behind.
+     *
+     * NOTE: Any existing mapping of the old file remains valid.
+     */
+    std::string tmp = m_file + ".tmp";
+    std::ofstream out(tmp, std::ios::out | std::ios::binary | std::ios::trunc);
+
+    if (! out.is_open())
+        return false;
+
+    out.write((const char *)&hdr, sizeof(hdr));
+
+    if (! records.empty())
+        out.write((const char *)&records[0], records.size() * sizeof(INDEX_RECORD));
+
+    out.write(pool.data(), pool.size());
+    out.close();
+
+    if (out.fail() || (rename(tmp.c_str(), m_file.c_str()) != 0))
+    {
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+        it->second->modified = false;
+
+    m_dirty = false;
+    return true;
+}
+
+
+/*
+ * Scan the given sub-directory of the maildir.
+ */
+void CMaildirIndex::scan(std::string subdir,
+                         std::unordered_map<std::string, std::shared_ptr<CMessageMetadata>> &found,
+                         std::vector<std::shared_ptr<CMessageMetadata>> &result, bool sorted)
+{
+    CDirectoryIterator it(m_maildir + "/" + subdir);
+
+    size_t start = result.size();
+
+    while (it.next())
+    {
+        /*
+         * Skip dotfiles, and sub-directories.
+         */
+        if (it.name()[0] == '.')
+            continue;
+
+        if (it.is_directory())
+            continue;
+
+        std::string name = it.name();
+        std::string file = subdir + "/" + name;
+        std::string key  = unique_name(name);
+
+        std::shared_ptr<CMessageMetadata> e;
+
+        auto existing = m_entries.find(key);
+
+        /*
+         * NOTE: We only stat the file if the entry is otherwise valid,
+         * and holds cached headers.
+         */
+        bool valid = ((existing != m_entries.end()) && (existing->second->inode == (uint64_t) it.inode()));
+
+        if (valid && existing->second->parsed)
+        {
+            struct stat sb;
+
+            valid = ((stat(std::string(m_maildir + "/" + file).c_str(), &sb) == 0) &&
+                     unchanged(existing->second, sb));
+        }
+
+        if (valid)
+        {
+            /*
+             * A known message - but it might have been renamed to
+             * change its flags, or moved from new/ to cur/.
+             */
+            e = existing->second;
+
+            if (e->file != CStringView(file))
+            {
+                e->set(e->file, file);
+                e->set(e->flags, flags_of(name, key));
+                m_dirty = true;
+            }
+        }
+        else
+        {
+            /*
+             * A new message, or one which has been replaced.
+             */
+            e = std::make_shared<CMessageMetadata>();
+            e->set(e->file, file);
+            e->set(e->flags, flags_of(name, key));
+            e->inode = it.inode();
+            m_dirty  = true;
+        }
+
+        found[key] = e;
+        result.push_back(e);
+    }
+
+    if (! sorted)
+        return;
+
+    std::sort(result.begin() + start, result.end(),
+              [](const std::shared_ptr<CMessageMetadata> &a, const std::shared_ptr<CMessageMetadata> &b)
+    {
+        return (a->file < b->file);
+    });
+}
+
+
+/*
+ * Update the index to include the given file.
+ */
+std::shared_ptr<CMessageMetadata> CMaildirIndex::add(std::string file)
+{
+    if (! m_loaded)
+        load();
+
+    std::string name = CFile::basename(file);
+    std::string key  = unique_name(name);
+
+    struct stat sb;
+    uint64_t inode = 0;
+    bool exists = (stat(std::string(m_maildir + "/" + file).c_str(), &sb) == 0);
+
+    if (exists)
+        inode = sb.st_ino;
+
+    /*
+     * A renamed message keeps its unique-name, and its inode.
+     */
+    auto it = m_entries.find(key);
+
+    if ((it != m_entries.end()) && exists && unchanged(it->second, sb))
+    {
+        std::shared_ptr<CMessageMetadata> e = it->second;
+
+        if (e->file != CStringView(file))
+        {
+            e->set(e->file, file);
+            e->set(e->flags, flags_of(name, key));
+            m_dirty = true;
+        }
+
+        return (e);
+    }
+
+    std::shared_ptr<CMessageMetadata> e = std::make_shared<CMessageMetadata>();
+    e->set(e->file, file);
+    e->set(e->flags, flags_of(name, key));
+    e->inode = inode;
+
+    m_entries[key] = e;
+    m_dirty = true;
+
+    return (e);
+}
+
+
+/*
+ * Remove the given file from the index.
+ */
+void CMaildirIndex::remove(std::string file)
+{
+    if (! m_loaded)
+        load();
+
+    auto it = m_entries.find(unique_name(CFile::basename(file)));
+
+    /*
+     * If the entry has since been renamed then it no longer refers
+     * to the file which was removed.
+     */
+    if ((it != m_entries.end()) && (it->second->file == CStringView(file)))
+    {
+        m_entries.erase(it);
+        m_dirty = true;
+    }
+}
+
+
+/*
+ * Validate the index against the maildir, returning the metadata
+ * of each message which is currently present.
+ */
+std::vector<std::shared_ptr<CMessageMetadata>> CMaildirIndex::refresh(bool sorted)
+{
+    if (! m_loaded)
+        load();
+
+    std::unordered_map<std::string, std::shared_ptr<CMessageMetadata>> found;
+    std::vector<std::shared_ptr<CMessageMetadata>> result;
+
+    scan("cur", found, result, sorted);
+    scan("new", found, result, sorted);
+
+    /*
+     * If anything was removed then we need to rewrite the index.
+     */
+    if (found.size() != m_entries.size())
+        m_dirty = true;
+
+    m_entries.swap(found);
+
+    return (result);
+}
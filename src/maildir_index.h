@@ -0,0 +1,289 @@
+/*
+ * maildir_index.h - Persistent metadata index for a single maildir.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "string_view.h"
+
+
+/*
+ * Forward declaration of the (private) memory-mapping type.
+ */
+class CMappedIndex;
+
+
+/**
+ * The metadata we cache for a single message in a maildir.
+ *
+ * The header-fields are only valid once `parsed` is true, until then
+ * the entry merely records that the file exists.
+ *
+ * The string-fields are views which refer either into the memory-mapped
+ * index-file, or into storage owned by this object if they've been
+ * updated since the index was loaded - so entries loaded from disk
+ * require no per-field allocations.
+ */
+struct CMessageMetadata
+{
+    /**
+     * The path of the message, relative to the maildir: "cur/xxx:2,S".
+     */
+    CStringView file;
+
+    /**
+     * The inode, modification-time, and size of the message-file.
+     */
+    uint64_t inode;
+    int64_t  mtime;
+    int64_t  size;
+
+    /**
+     * The maildir-flags, as encoded in the filename.
+     */
+    CStringView flags;
+
+    /**
+     * The `Delivery-Date:` header, or failing that the `Date:` header,
+     * as seconds past the epoch - or zero if neither is present.
+     */
+    int64_t date;
+
+    /**
+     * The (decoded) values of the headers we cache.
+     */
+    CStringView from;
+    CStringView to;
+    CStringView subject;
+    CStringView message_id;
+    CStringView in_reply_to;
+    CStringView references;
+
+    /**
+     * The number of attachments, or -1 if the MIME-parts have not
+     * yet been parsed.
+     *
+     * The size and MIME-flags are only valid once this is known.
+     */
+    int attachments;
+
+    /**
+     * The total (decoded) size of the attachments, in bytes, which is
+     * estimated from their encoded size.
+     */
+    int64_t attachment_size;
+
+    /**
+     * The interesting MIME-types the message contains, as a mask.
+     */
+    enum
+    {
+        MIME_SIGNED     = 1,
+        MIME_ENCRYPTED  = 2,
+        MIME_GPG_OUTPUT = 4
+    };
+
+    uint32_t mime_flags;
+
+    /**
+     * Have the header-fields been populated?
+     */
+    bool parsed;
+
+    /**
+     * Has this entry been updated since the index was last written?
+     */
+    bool modified;
+
+    /**
+     * Constructor.
+     */
+    CMessageMetadata();
+
+    /**
+     * If the named (lower-case) header is one we cache then store
+     * its value in `value` and return true.
+     */
+    bool header(const std::string &name, CStringView &value);
+
+    /**
+     * Update the cached header-fields from the given header-map.
+     */
+    void update(std::unordered_map<std::string, std::string> &headers);
+
+    /**
+     * Update the given field to hold a copy of the given value.
+     *
+     * Each field owns at most one slot of our storage, which is reused
+     * when the field is set again, so repeated renames don't grow it.
+     */
+    void set(CStringView &field, const std::string &value);
+
+    /**
+     * The mapping our views refer to, if any, which is kept alive for
+     * as long as we are.
+     */
+    std::shared_ptr<CMappedIndex> mapping;
+
+private:
+
+    /**
+     * Storage for fields updated since the index was loaded, along
+     * with the field which refers to each.
+     *
+     * A deque never moves its existing members, so views into them
+     * remain valid.
+     */
+    std::deque<std::pair<const CStringView *, std::string> > m_storage;
+
+    /**
+     * Views refer into our storage, so we mustn't be copied.
+     */
+    CMessageMetadata(const CMessageMetadata &);
+    CMessageMetadata &operator=(const CMessageMetadata &);
+};
+
+
+
+/**
+ * The CMaildirIndex class holds the cached metadata of every message
+ * in a single (local) maildir.
+ *
+ * The index is written, in a versioned binary format, beneath the
+ * directory named by `cache.prefix`.  The format is a table of
+ * fixed-width records followed by a pool of strings, so the file is
+ * simply memory-mapped when the maildir is opened, and then validated
+ * against the directory-listings of `cur/` and `new/`:
+ *
+ *  - Files whose unique-name and inode are unchanged reuse their entry.
+ *
+ *  - New files get an empty entry, which is populated lazily the first
+ *    time one of its headers is requested.
+ *
+ *  - Entries whose files have gone away are discarded.
+ *
+ * This means that opening a large maildir costs mapping one file, and
+ * a readdir, rather than an open and a parse of each message.
+ *
+ */
+class CMaildirIndex
+{
+public:
+
+    /**
+     * Constructor.  The argument is the path to the maildir.
+     */
+    CMaildirIndex(std::string maildir);
+
+    /**
+     * Destructor.  Saves the index if it has been changed.
+     */
+    ~CMaildirIndex();
+
+    /**
+     * Validate the index against the maildir, returning the metadata
+     * of each message which is currently present.
+     *
+     * The result is ordered as `cur/` then `new/`, each sorted by name
+     * unless `sorted` is false.
+     */
+    std::vector<std::shared_ptr<CMessageMetadata>> refresh(bool sorted = true);
+
+    /**
+     * Update the index to include the given file, which is relative
+     * to the maildir, returning its entry.
+     *
+     * If the file is a renamed version of an existing entry then that
+     * entry is updated, and returned.
+     */
+    std::shared_ptr<CMessageMetadata> add(std::string file);
+
+    /**
+     * Remove the given file, which is relative to the maildir, from
+     * the index.
+     */
+    void remove(std::string file);
+
+    /**
+     * Write the index to disk, if it has been changed.
+     *
+     * Returns false if the index could not be written.
+     */
+    bool save();
+
+    /**
+     * Return the path to the on-disk index for the given maildir, or
+     * an empty string if `cache.prefix` is unset.
+     */
+    static std::string index_path(std::string maildir);
+
+    /**
+     * Return the unique part of a maildir filename, ignoring the flags.
+     */
+    static std::string unique_name(std::string file);
+
+private:
+
+    /**
+     * Map the index from disk.
+     */
+    void load();
+
+    /**
+     * Scan the given sub-directory of the maildir, moving the entries
+     * found from `m_entries` to `found`.
+     */
+    void scan(std::string subdir,
+              std::unordered_map<std::string, std::shared_ptr<CMessageMetadata>> &found,
+              std::vector<std::shared_ptr<CMessageMetadata>> &result, bool sorted);
+
+private:
+
+    /**
+     * The maildir we index.
+     */
+    std::string m_maildir;
+
+    /**
+     * The file we persist the index to.
+     */
+    std::string m_file;
+
+    /**
+     * Have we loaded the on-disk index yet?
+     */
+    bool m_loaded;
+
+    /**
+     * Has the set of entries changed since we last saved?
+     */
+    bool m_dirty;
+
+    /**
+     * The entries, keyed by their unique-name.
+     */
+    std::unordered_map<std::string, std::shared_ptr<CMessageMetadata>> m_entries;
+};
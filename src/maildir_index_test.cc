@@ -0,0 +1,192 @@
+/*
+ * maildir_index_test.cc - Test-cases for our CMaildirIndex class.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fstream>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "directory.h"
+#include "file.h"
+#include "maildir_index.h"
+#include "CuTest.h"
+
+
+/**
+ * Test CMaildirIndex::unique_name()
+ */
+void TestMaildirIndexUniqueName(CuTest * tc)
+{
+    CuAssertStrEquals(tc, "123.host", CMaildirIndex::unique_name("123.host:2,S").c_str());
+    CuAssertStrEquals(tc, "123.host", CMaildirIndex::unique_name("123.host:2,").c_str());
+    CuAssertStrEquals(tc, "123.host", CMaildirIndex::unique_name("123.host").c_str());
+}
+
+
+/**
+ * Test that setting a field again reuses its storage.
+ */
+void TestMaildirIndexSet(CuTest * tc)
+{
+    CMessageMetadata entry;
+
+    entry.set(entry.file, "cur/1.host:2,RS");
+    const char *storage = entry.file.data();
+
+    /*
+     * Renaming back and forth mustn't allocate fresh storage each time.
+     */
+    for (int i = 0; i < 100; i++)
+    {
+        entry.set(entry.file, (i % 2) ? "cur/1.host:2,RS" : "cur/1.host:2,S");
+        CuAssertTrue(tc, entry.file.data() == storage);
+    }
+
+    CuAssertStrEquals(tc, "cur/1.host:2,RS", entry.file.to_string().c_str());
+
+    /*
+     * Other fields keep their own values.
+     */
+    entry.set(entry.flags, "RS");
+    entry.set(entry.file, "cur/1.host:2,S");
+
+    CuAssertStrEquals(tc, "RS", entry.flags.to_string().c_str());
+    CuAssertStrEquals(tc, "cur/1.host:2,S", entry.file.to_string().c_str());
+}
+
+
+/**
+ * Test that the index is validated against the maildir, and that
+ * populated entries, and their MIME-summary, survive a save/load cycle.
+ */
+void TestMaildirIndexRefresh(CuTest * tc)
+{
+    char tmpl[] = "/tmp/lumail.XXXXXX";
+    std::string prefix = mkdtemp(tmpl);
+    std::string maildir = prefix + "/Maildir";
+
+    CDirectory::mkdir_p(maildir + "/cur");
+    CDirectory::mkdir_p(maildir + "/new");
+    CDirectory::mkdir_p(maildir + "/tmp");
+
+    std::ofstream(maildir + "/cur/1.host:2,S") << "Subject: one\n\nbody\n";
+    std::ofstream(maildir + "/new/2.host") << "Subject: two\n\nbody\n";
+
+    CConfig *config = CConfig::instance();
+    config->set("cache.prefix", prefix + "/cache");
+
+    {
+        CMaildirIndex index(maildir);
+        std::vector<std::shared_ptr<CMessageMetadata>> entries = index.refresh();
+
+        CuAssertIntEquals(tc, 2, entries.size());
+        CuAssertStrEquals(tc, "cur/1.host:2,S", entries[0]->file.to_string().c_str());
+        CuAssertStrEquals(tc, "S", entries[0]->flags.to_string().c_str());
+        CuAssertStrEquals(tc, "new/2.host", entries[1]->file.to_string().c_str());
+        CuAssertTrue(tc, !entries[0]->parsed);
+
+        std::unordered_map<std::string, std::string> headers;
+        headers["subject"] = "one";
+        headers["date"] = "Thu, 01 Jan 1970 00:01:40 +0000";
+        headers["delivery-date"] = "Thu, 01 Jan 1970 00:03:20 +0000";
+        entries[0]->update(headers);
+
+        CuAssertTrue(tc, entries[0]->date == 200);
+
+        struct stat sb;
+        CuAssertIntEquals(tc, 0, stat((maildir + "/cur/1.host:2,S").c_str(), &sb));
+        entries[0]->mtime = sb.st_mtime;
+        entries[0]->size  = sb.st_size;
+
+        entries[0]->attachments     = 2;
+        entries[0]->attachment_size = 5000000000LL;
+        entries[0]->mime_flags      = CMessageMetadata::MIME_SIGNED;
+
+        CuAssertIntEquals(tc, -1, entries[1]->attachments);
+
+        CuAssertTrue(tc, index.save());
+    }
+
+    CuAssertTrue(tc, CFile::exists(CMaildirIndex::index_path(maildir)));
+
+    /*
+     * Change the flags of the first message, and remove the second.
+     */
+    rename((maildir + "/cur/1.host:2,S").c_str(), (maildir + "/cur/1.host:2,RS").c_str());
+    CFile::delete_file(maildir + "/new/2.host");
+
+    {
+        CMaildirIndex index(maildir);
+        std::vector<std::shared_ptr<CMessageMetadata>> entries = index.refresh();
+
+        CuAssertIntEquals(tc, 1, entries.size());
+        CuAssertStrEquals(tc, "cur/1.host:2,RS", entries[0]->file.to_string().c_str());
+        CuAssertStrEquals(tc, "RS", entries[0]->flags.to_string().c_str());
+        CuAssertTrue(tc, entries[0]->parsed);
+
+        CStringView value;
+        CuAssertTrue(tc, entries[0]->header("subject", value));
+        CuAssertStrEquals(tc, "one", value.to_string().c_str());
+        CuAssertTrue(tc, !entries[0]->header("x-mailer", value));
+        CuAssertTrue(tc, entries[0]->date == 200);
+
+        CuAssertIntEquals(tc, 2, entries[0]->attachments);
+        CuAssertTrue(tc, entries[0]->attachment_size == 5000000000LL);
+        CuAssertIntEquals(tc, CMessageMetadata::MIME_SIGNED, entries[0]->mime_flags);
+
+        CuAssertTrue(tc, index.save());
+    }
+
+    /*
+     * Rewrite the first message in place, keeping its name and inode.
+     */
+    {
+        std::ofstream out(maildir + "/cur/1.host:2,RS", std::ios::out | std::ios::trunc);
+        out << "Subject: edited\n\nA longer body\n";
+    }
+
+    {
+        CMaildirIndex index(maildir);
+        std::vector<std::shared_ptr<CMessageMetadata>> entries = index.refresh();
+
+        CuAssertIntEquals(tc, 1, entries.size());
+        CuAssertStrEquals(tc, "cur/1.host:2,RS", entries[0]->file.to_string().c_str());
+        CuAssertTrue(tc, !entries[0]->parsed);
+        CuAssertIntEquals(tc, -1, entries[0]->attachments);
+    }
+
+    config->set("cache.prefix", "");
+
+    std::string cmd = "rm -rf " + prefix;
+    CuAssertIntEquals(tc, 0, system(cmd.c_str()));
+}
+
+
+CuSuite *
+maildir_index_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMaildirIndexUniqueName);
+    SUITE_ADD_TEST(suite, TestMaildirIndexSet);
+    SUITE_ADD_TEST(suite, TestMaildirIndexRefresh);
+    return suite;
+}
@@ -0,0 +1,86 @@
+/*
+ * maildir_test.cc - Test-cases for our CMaildir class.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fstream>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "directory.h"
+#include "maildir.h"
+#include "CuTest.h"
+
+
+/**
+ * Test that CMaildir::total_messages() and CMaildir::unread_messages()
+ * classify messages by their flags.
+ */
+void TestMaildirCounts(CuTest * tc)
+{
+    char tmpl[] = "/tmp/lumail.XXXXXX";
+    std::string prefix = mkdtemp(tmpl);
+
+    CDirectory::mkdir_p(prefix + "/cur/subdir");
+    CDirectory::mkdir_p(prefix + "/new");
+    CDirectory::mkdir_p(prefix + "/tmp");
+
+    /*
+     * Read messages.
+     */
+    std::ofstream(prefix + "/cur/1.host:2,S");
+    std::ofstream(prefix + "/cur/2.host:2,RS");
+
+    /*
+     * Unread messages.
+     */
+    std::ofstream(prefix + "/cur/3.host:2,");
+    std::ofstream(prefix + "/cur/4.host");
+    std::ofstream(prefix + "/cur/5.host:2,NS");
+    std::ofstream(prefix + "/new/6.host");
+
+    /*
+     * Ignored.
+     */
+    std::ofstream(prefix + "/cur/.hidden");
+    std::ofstream(prefix + "/tmp/7.host");
+
+    CMaildir maildir(prefix);
+    CuAssertIntEquals(tc, 6, maildir.total_messages());
+    CuAssertIntEquals(tc, 4, maildir.unread_messages());
+
+    /*
+     * A second object for the same path gets the same result.
+     */
+    CMaildir again(prefix);
+    CuAssertIntEquals(tc, 6, again.total_messages());
+    CuAssertIntEquals(tc, 4, again.unread_messages());
+
+    std::string cmd = "rm -rf " + prefix;
+    CuAssertIntEquals(tc, 0, system(cmd.c_str()));
+}
+
+
+CuSuite *
+maildir_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMaildirCounts);
+    return suite;
+}
@@ -0,0 +1,213 @@
+/*
+ * maildir_watcher.cc - Watch a maildir for changes, via inotify.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <unordered_map>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "maildir_watcher.h"
+#include "util.h"
+
+
+/*
+ * Constructor.
+ */
+CMaildirWatcher::CMaildirWatcher()
+{
+    m_fd  = -1;
+    m_cur = -1;
+    m_new = -1;
+}
+
+
+/*
+ * Destructor.
+ */
+CMaildirWatcher::~CMaildirWatcher()
+{
+    unwatch();
+}
+
+
+/*
+ * Start watching the given maildir.
+ */
+bool CMaildirWatcher::watch(std::string maildir)
+{
+    unwatch();
+
+#ifdef __linux__
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (m_fd < 0)
+        return false;
+
+    uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+
+    m_cur = inotify_add_watch(m_fd, std::string(maildir + "/cur").c_str(), mask);
+    m_new = inotify_add_watch(m_fd, std::string(maildir + "/new").c_str(), mask);
+
+    if ((m_cur < 0) || (m_new < 0))
+    {
+        unwatch();
+        return false;
+    }
+
+    m_path = maildir;
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+/*
+ * Stop watching.
+ */
+void CMaildirWatcher::unwatch()
+{
+    if (m_fd >= 0)
+        close(m_fd);
+
+    m_fd  = -1;
+    m_cur = -1;
+    m_new = -1;
+    m_path = "";
+}
+
+
+/*
+ * The maildir currently being watched, if any.
+ */
+std::string CMaildirWatcher::path()
+{
+    return (m_path);
+}
+
+
+/*
+ * Read the pending changes, without blocking.
+ */
+bool CMaildirWatcher::changes(std::vector<MAILDIR_CHANGE> &result)
+{
+    if (m_fd < 0)
+        return false;
+
+#ifdef __linux__
+    /*
+     * Renames are reported as a pair of events, which share a cookie,
+     * so we record the offset of each half-rename we've seen.
+     */
+    std::unordered_map<uint32_t, size_t> renames;
+
+    char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (true)
+    {
+        ssize_t len = read(m_fd, buf, sizeof(buf));
+
+        if (len < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EAGAIN)
+                break;
+
+            return false;
+        }
+
+        if (len == 0)
+            break;
+
+        for (char *ptr = buf; ptr < buf + len;)
+        {
+            struct inotify_event *event = (struct inotify_event *) ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            /*
+             * If the queue overflowed, or a directory went away, then
+             * we can't know what happened.
+             */
+            if (event->mask & (IN_Q_OVERFLOW | IN_IGNORED))
+            {
+                if (event->mask & IN_IGNORED)
+                    unwatch();
+
+                return false;
+            }
+
+            if ((event->mask & IN_ISDIR) || (event->len == 0) || (event->name[0] == '.'))
+                continue;
+
+            /*
+             * Build up the path - removing duplicate "/" characters.
+             */
+            std::string path = m_path + ((event->wd == m_cur) ? "/cur/" : "/new/") + event->name;
+            path.erase(std::unique(path.begin(), path.end(), both_slashes()), path.end());
+
+            MAILDIR_CHANGE change;
+
+            if (event->mask & IN_CREATE)
+            {
+                change.to = path;
+            }
+            else if (event->mask & IN_DELETE)
+            {
+                change.from = path;
+            }
+            else if (event->mask & IN_MOVED_FROM)
+            {
+                change.from = path;
+                renames[event->cookie] = result.size();
+            }
+            else if (event->mask & IN_MOVED_TO)
+            {
+                /*
+                 * Complete a rename, if we saw it start.
+                 */
+                auto it = renames.find(event->cookie);
+
+                if (it != renames.end())
+                {
+                    result[it->second].to = path;
+                    renames.erase(it);
+                    continue;
+                }
+
+                change.to = path;
+            }
+            else
+                continue;
+
+            result.push_back(change);
+        }
+    }
+
+    return true;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,105 @@
+/*
+ * maildir_watcher.h - Watch a maildir for changes, via inotify.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+
+/**
+ * A single change to the contents of a maildir.
+ *
+ * Paths are fully-qualified.  For renames `from` is the old path, and
+ * `to` the new one, for additions only `to` is set, and for removals
+ * only `from` is set.
+ */
+typedef struct _maildir_change
+{
+    std::string from;
+    std::string to;
+} MAILDIR_CHANGE;
+
+
+
+/**
+ * This class watches the `cur/` and `new/` directories of a single
+ * maildir, and reports the messages which have been added, removed,
+ * or renamed since it was last asked.
+ *
+ * This is implemented via inotify, so on other platforms `watch()`
+ * will always fail and callers should fall back to rescanning.
+ */
+class CMaildirWatcher
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CMaildirWatcher();
+
+    /**
+     * Destructor.
+     */
+    ~CMaildirWatcher();
+
+    /**
+     * Start watching the given maildir, replacing any previous one.
+     *
+     * Returns false if the maildir cannot be watched.
+     */
+    bool watch(std::string maildir);
+
+    /**
+     * Stop watching.
+     */
+    void unwatch();
+
+    /**
+     * The maildir currently being watched, if any.
+     */
+    std::string path();
+
+    /**
+     * Read the pending changes, without blocking.
+     *
+     * Returns false if changes were lost, in which case the caller
+     * must rescan the maildir in full.
+     */
+    bool changes(std::vector<MAILDIR_CHANGE> &result);
+
+private:
+
+    /**
+     * The inotify file-descriptor, or -1.
+     */
+    int m_fd;
+
+    /**
+     * The watch-descriptors for `cur/` and `new/`.
+     */
+    int m_cur;
+    int m_new;
+
+    /**
+     * The maildir we're watching.
+     */
+    std::string m_path;
+};
@@ -0,0 +1,92 @@
+/*
+ * maildir_watcher_test.cc - Test-cases for our CMaildirWatcher class.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "directory.h"
+#include "maildir_watcher.h"
+#include "CuTest.h"
+
+
+/**
+ * Test that additions, renames, and removals are reported.
+ */
+void TestMaildirWatcher(CuTest * tc)
+{
+#ifdef __linux__
+    char tmpl[] = "/tmp/lumail.XXXXXX";
+    std::string prefix = mkdtemp(tmpl);
+
+    CDirectory::mkdir_p(prefix + "/cur");
+    CDirectory::mkdir_p(prefix + "/new");
+
+    CMaildirWatcher watcher;
+    CuAssertTrue(tc, watcher.watch(prefix));
+    CuAssertStrEquals(tc, prefix.c_str(), watcher.path().c_str());
+
+    /*
+     * Nothing has happened yet.
+     */
+    std::vector<MAILDIR_CHANGE> changes;
+    CuAssertTrue(tc, watcher.changes(changes));
+    CuAssertIntEquals(tc, 0, changes.size());
+
+    /*
+     * Deliver a message, then move it to cur/ and delete it.
+     */
+    std::ofstream(prefix + "/new/1.host");
+    rename(std::string(prefix + "/new/1.host").c_str(),
+           std::string(prefix + "/cur/1.host:2,S").c_str());
+    unlink(std::string(prefix + "/cur/1.host:2,S").c_str());
+
+    CuAssertTrue(tc, watcher.changes(changes));
+    CuAssertIntEquals(tc, 3, changes.size());
+
+    CuAssertTrue(tc, changes[0].from.empty());
+    CuAssertStrEquals(tc, std::string(prefix + "/new/1.host").c_str(), changes[0].to.c_str());
+
+    CuAssertStrEquals(tc, std::string(prefix + "/new/1.host").c_str(), changes[1].from.c_str());
+    CuAssertStrEquals(tc, std::string(prefix + "/cur/1.host:2,S").c_str(), changes[1].to.c_str());
+
+    CuAssertStrEquals(tc, std::string(prefix + "/cur/1.host:2,S").c_str(), changes[2].from.c_str());
+    CuAssertTrue(tc, changes[2].to.empty());
+
+    /*
+     * Once the maildir is gone we must rescan.
+     */
+    std::string cmd = "rm -rf " + prefix;
+    CuAssertIntEquals(tc, 0, system(cmd.c_str()));
+
+    changes.clear();
+    CuAssertTrue(tc, !watcher.changes(changes));
+    CuAssertStrEquals(tc, "", watcher.path().c_str());
+#endif
+}
+
+
+CuSuite *
+maildir_watcher_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMaildirWatcher);
+    return suite;
+}
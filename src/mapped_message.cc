@@ -0,0 +1,226 @@
+/*
+ * mapped_message.cc - A memory-mapping of a message-file.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "mapped_message.h"
+
+
+/*
+ * The most recently opened mapping.
+ */
+std::shared_ptr<CMappedMessage> CMappedMessage::s_current;
+
+
+/*
+ * Return a mapping of the given file.
+ */
+std::shared_ptr<CMappedMessage> CMappedMessage::open(const std::string &path, bool sequential)
+{
+    int fd = ::open(path.c_str(), O_RDONLY, 0);
+
+    if (fd == -1)
+        return nullptr;
+
+    struct stat sb;
+
+    if (fstat(fd, &sb) != 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    /*
+     * If this is the file we mapped last time then reuse that mapping.
+     */
+    if (s_current &&
+            (s_current->m_dev == sb.st_dev) &&
+            (s_current->m_ino == sb.st_ino) &&
+            (s_current->m_size == (size_t) sb.st_size) &&
+            (s_current->m_mtime == sb.st_mtime))
+    {
+        close(fd);
+        s_current->advise(sequential);
+        return s_current;
+    }
+
+    /*
+     * An empty file can't be mapped, but that's not an error.
+     */
+    GMimeStream *stream = NULL;
+
+    if (sb.st_size > 0)
+    {
+        /*
+         * The stream owns `fd`, and the mapping, from here on.
+         */
+        stream = g_mime_stream_mmap_new(fd, PROT_READ, MAP_PRIVATE);
+
+        if (stream == NULL)
+        {
+            close(fd);
+            return nullptr;
+        }
+
+    }
+    else
+    {
+        close(fd);
+    }
+
+    s_current = std::shared_ptr<CMappedMessage>(new CMappedMessage(stream, sb));
+
+    /*
+     * Reading only the headers shouldn't trigger read-ahead of the body.
+     */
+    if (stream != NULL)
+    {
+        GMimeStreamMmap *mapped = (GMimeStreamMmap *) stream;
+        madvise(mapped->map, mapped->maplen, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+    }
+
+    s_current->m_sequential = sequential;
+    return s_current;
+}
+
+
+/*
+ * Constructor.
+ */
+CMappedMessage::CMappedMessage(GMimeStream *stream, const struct stat &sb)
+{
+    m_stream = stream;
+    m_dev    = sb.st_dev;
+    m_ino    = sb.st_ino;
+    m_size   = sb.st_size;
+    m_mtime  = sb.st_mtime;
+    m_sequential = false;
+}
+
+
+/*
+ * Advise the kernel how the mapping will be read.
+ */
+void CMappedMessage::advise(bool sequential)
+{
+    if ((m_stream == NULL) || !sequential || m_sequential)
+        return;
+
+    GMimeStreamMmap *mapped = (GMimeStreamMmap *) m_stream;
+    madvise(mapped->map, mapped->maplen, MADV_SEQUENTIAL);
+
+    m_sequential = true;
+}
+
+
+/*
+ * Destructor.
+ *
+ * NOTE: This unmaps the file, so it must not run while any stream
+ * over the mapping is in use - see `keep_alive()`.
+ */
+CMappedMessage::~CMappedMessage()
+{
+    if (m_stream != NULL)
+        g_object_unref(m_stream);
+}
+
+
+/*
+ * The contents of the file.
+ */
+const char *CMappedMessage::data()
+{
+    if (m_stream == NULL)
+        return "";
+
+    return (((GMimeStreamMmap *) m_stream)->map);
+}
+
+
+/*
+ * The inode of the file.
+ */
+ino_t CMappedMessage::ino()
+{
+    return (m_ino);
+}
+
+
+/*
+ * The size of the file.
+ */
+size_t CMappedMessage::size()
+{
+    return (m_size);
+}
+
+
+/*
+ * The modification-time of the file.
+ */
+time_t CMappedMessage::mtime()
+{
+    return (m_mtime);
+}
+
+
+/*
+ * Return a new stream over the given range of the file.
+ */
+GMimeStream *CMappedMessage::stream(int64_t start, int64_t end)
+{
+    if (m_stream == NULL)
+        return (g_mime_stream_mem_new());
+
+    if ((end < 0) || (end > (int64_t) m_size))
+        end = m_size;
+
+    if (start > end)
+        start = end;
+
+    GMimeStream *sub = g_mime_stream_substream(m_stream, start, end);
+
+    if (sub != NULL)
+        keep_alive(sub);
+
+    return (sub);
+}
+
+
+/*
+ * Release a reference to a mapping, held by a GMime object.
+ */
+static void release_mapping(gpointer data)
+{
+    delete (std::shared_ptr<CMappedMessage> *) data;
+}
+
+
+/*
+ * Keep the mapping alive for as long as the given object is.
+ */
+void CMappedMessage::keep_alive(gpointer object)
+{
+    std::shared_ptr<CMappedMessage> *ref = new std::shared_ptr<CMappedMessage>(shared_from_this());
+
+    g_object_set_data_full(G_OBJECT(object), "lumail-mapping", ref, release_mapping);
+}
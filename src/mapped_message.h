@@ -0,0 +1,136 @@
+/*
+ * mapped_message.h - A memory-mapping of a message-file.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <gmime/gmime.h>
+
+
+/**
+ * A read-only mapping of a single message-file.
+ *
+ * Reading the headers of a message, walking its MIME-structure, and
+ * later decoding one of its parts all work from the same mapping, via
+ * GMime streams which refer to ranges of it.
+ *
+ * When only the headers are wanted the mapping is advised for random
+ * access, so that no more than the pages holding them are read.  When
+ * the whole message is to be parsed it is advised for sequential access
+ * instead, as that is a single forward pass.
+ *
+ * The most recently opened mapping is retained, so that repeated use
+ * of the current message doesn't map it again.  It is reused for as
+ * long as the file is unchanged - even if it is renamed, as happens
+ * when the flags of a message are updated.
+ *
+ * GMime streams, and the objects parsed from them, refer into the
+ * mapping without owning it, so each is made to hold a reference to
+ * the mapping it came from.
+ *
+ * This class is not thread-safe, and must only be used by the main
+ * thread.
+ */
+class CMappedMessage : public std::enable_shared_from_this<CMappedMessage>
+{
+public:
+
+    /**
+     * Return a mapping of the given file, or NULL on error.
+     *
+     * `sequential` should be set if the whole file is going to be read.
+     */
+    static std::shared_ptr<CMappedMessage> open(const std::string &path, bool sequential = false);
+
+    /**
+     * Destructor.
+     */
+    ~CMappedMessage();
+
+    /**
+     * The contents of the file, which are not NUL-terminated.
+     */
+    const char *data();
+
+    /**
+     * The inode, size, and modification-time, of the file.
+     */
+    ino_t  ino();
+    size_t size();
+    time_t mtime();
+
+    /**
+     * Return a new stream over the given range of the file, which the
+     * caller must unref.  The stream keeps the mapping alive.
+     *
+     * If `end` is -1 the stream extends to the end of the file.
+     */
+    GMimeStream *stream(int64_t start = 0, int64_t end = -1);
+
+    /**
+     * Keep the mapping alive for as long as the given object is.
+     *
+     * This must be used for anything parsed from one of our streams,
+     * such as a GMimeMessage, as the streams within it refer to the
+     * mapping directly rather than to the stream it was parsed from.
+     */
+    void keep_alive(gpointer object);
+
+private:
+
+    /**
+     * Constructor - this object is created via `open()`.
+     */
+    CMappedMessage(GMimeStream *stream, const struct stat &sb);
+
+    /**
+     * Advise the kernel how the mapping will be read.  Once advised for
+     * sequential access it stays so.
+     */
+    void advise(bool sequential);
+
+private:
+
+    /**
+     * The stream which owns the mapping, or NULL if the file is empty.
+     */
+    GMimeStream *m_stream;
+
+    /**
+     * The identity of the file, which is used to detect changes.
+     */
+    dev_t   m_dev;
+    ino_t   m_ino;
+    size_t  m_size;
+    time_t  m_mtime;
+
+    /**
+     * Has the mapping been advised for sequential access?
+     */
+    bool m_sequential;
+
+    /**
+     * The most recently opened mapping.
+     */
+    static std::shared_ptr<CMappedMessage> s_current;
+};
@@ -0,0 +1,126 @@
+/*
+ * mapped_message_test.cc - Test-cases for our CMappedMessage class.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+#include "mapped_message.h"
+#include "CuTest.h"
+
+
+/**
+ * Test that a message is mapped, and that the mapping is reused for
+ * as long as the file is unchanged - even if it is renamed.
+ */
+void TestMappedMessageReuse(CuTest * tc)
+{
+    char tmpl[] = "/tmp/lumail.XXXXXX";
+    std::string prefix = mkdtemp(tmpl);
+    std::string file   = prefix + "/1.host:2,";
+
+    std::ofstream(file) << "Subject: one\n\nbody\n";
+
+    std::shared_ptr<CMappedMessage> map = CMappedMessage::open(file);
+    CuAssertPtrNotNull(tc, map.get());
+    CuAssertIntEquals(tc, 19, map->size());
+    CuAssertStrEquals(tc, "Subject: one\n\nbody\n", std::string(map->data(), map->size()).c_str());
+
+    /*
+     * Renaming the file doesn't change it.
+     */
+    std::string renamed = prefix + "/1.host:2,S";
+    CuAssertIntEquals(tc, 0, rename(file.c_str(), renamed.c_str()));
+    CuAssertTrue(tc, map == CMappedMessage::open(renamed));
+
+    /*
+     * Nor does asking to read all of it.
+     */
+    CuAssertTrue(tc, map == CMappedMessage::open(renamed, true));
+
+    /*
+     * Changing it does.
+     */
+    std::ofstream(renamed, std::ios::app) << "more\n";
+
+    std::shared_ptr<CMappedMessage> updated = CMappedMessage::open(renamed);
+    CuAssertPtrNotNull(tc, updated.get());
+    CuAssertTrue(tc, map != updated);
+    CuAssertIntEquals(tc, 24, updated->size());
+
+    /*
+     * An empty file is mapped, and a missing one is not.
+     */
+    std::ofstream(prefix + "/empty");
+
+    std::shared_ptr<CMappedMessage> empty = CMappedMessage::open(prefix + "/empty");
+    CuAssertPtrNotNull(tc, empty.get());
+    CuAssertIntEquals(tc, 0, empty->size());
+
+    CuAssertTrue(tc, CMappedMessage::open(prefix + "/missing") == nullptr);
+
+    std::string cmd = "rm -rf " + prefix;
+    CuAssertIntEquals(tc, 0, system(cmd.c_str()));
+}
+
+
+/**
+ * Test that the streams we hand out keep their mapping alive, even once
+ * another file has been opened.
+ */
+void TestMappedMessageStream(CuTest * tc)
+{
+    char tmpl[] = "/tmp/lumail.XXXXXX";
+    std::string prefix = mkdtemp(tmpl);
+
+    std::ofstream(prefix + "/one") << "Subject: one\n\nbody\n";
+    std::ofstream(prefix + "/two") << "Subject: two\n\nbody\n";
+
+    std::shared_ptr<CMappedMessage> map = CMappedMessage::open(prefix + "/one");
+    CuAssertPtrNotNull(tc, map.get());
+
+    GMimeStream *stream = map->stream(9, 12);
+    std::weak_ptr<CMappedMessage> weak = map;
+
+    map = nullptr;
+    CuAssertPtrNotNull(tc, CMappedMessage::open(prefix + "/two").get());
+    CuAssertTrue(tc, !weak.expired());
+
+    char buf[4] = { 0 };
+    CuAssertIntEquals(tc, 3, g_mime_stream_read(stream, buf, 3));
+    CuAssertStrEquals(tc, "one", buf);
+
+    g_object_unref(stream);
+    CuAssertTrue(tc, weak.expired());
+
+    std::string cmd = "rm -rf " + prefix;
+    CuAssertIntEquals(tc, 0, system(cmd.c_str()));
+}
+
+
+CuSuite *
+mapped_message_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMappedMessageReuse);
+    SUITE_ADD_TEST(suite, TestMappedMessageStream);
+    return suite;
+}
@@ -28,6 +28,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <unordered_set>
 
 
 
@@ -41,6 +42,7 @@
 
 
 
+#include "approxidate.h"
 #include "config.h"
 #include "file.h"
 #include "global_state.h"
@@ -48,9 +50,15 @@
 #include "json/json.h"
 #include "lua.h"
 #include "maildir.h"
+#include "maildir_index.h"
+#include "mapped_message.h"
 #include "message.h"
+#include "message_cache.h"
+#include "message_format.h"
 #include "message_part.h"
+#include "message_sort.h"
 #include "mime.h"
+#include "threader.h"
 #include "util.h"
 
 
@@ -62,6 +70,15 @@ CMessage::CMessage(const std::string name, bool is_local)
     m_path = name;
     m_time = 0;
     m_imap = !is_local;
+    m_headers_parsed = false;
+
+    m_attachments     = -1;
+    m_attachment_size = 0;
+    m_mime_flags      = 0;
+
+    m_sort_date        = -1;
+    m_sort_from_set    = false;
+    m_sort_subject_set = false;
 }
 
 
@@ -82,7 +99,13 @@ std::string CMessage::path()
  */
 void CMessage::path(std::string new_path)
 {
+    CMessageCache *cache = CMessageCache::instance();
+    cache->rename(m_path, new_path);
+
     m_path = new_path;
+
+    if (m_source)
+        *m_source = new_path;
 }
 
 
@@ -91,25 +114,70 @@ void CMessage::path(std::string new_path)
  */
 std::string CMessage::header(std::string name)
 {
-    std::unordered_map < std::string, std::string > h = headers();
+    return (header_view(name).to_string());
+}
+
 
+/*
+ * Return a view of the value of a given header.
+ */
+CStringView CMessage::header_view(std::string name)
+{
     /*
      * Lower-case the header we were given.
      */
     std::transform(name.begin(), name.end(), name.begin(), tolower);
 
     /*
-     * Lookup the value.
+     * If we have indexed metadata then the common headers are
+     * available without reading the message at all.
      */
-    return (h[name]);
+    if (m_metadata && !m_headers_parsed)
+    {
+        if (! m_metadata->parsed)
+            parse_headers();
+
+        CStringView value;
+
+        if (m_metadata->header(name, value))
+            return (value);
+    }
+
+    /*
+     * Ensure we've read the header-block.
+     */
+    if (! m_headers_parsed)
+        parse_headers();
+
+    /*
+     * Lookup the value, without copying the whole map.
+     */
+    std::unordered_map < std::string, std::string >::iterator it = m_headers.find(name);
+
+    if (it != m_headers.end())
+        return (CStringView(it->second));
+
+    return CStringView();
+}
+
+
+/*
+ * Set the cached metadata for this message.
+ */
+void CMessage::set_metadata(std::shared_ptr<CMessageMetadata> metadata)
+{
+    m_metadata = metadata;
 }
 
 
 /*
  * Parse a MIME message and return an object suitable for operating
  * upon.
+ *
+ * The parser works from a mapping of the file, and the content of each
+ * part refers to its range of that mapping, rather than being copied.
  */
-GMimeMessage * CMessage::parse_message()
+GMimeMessage * CMessage::parse_message(std::shared_ptr<CMappedMessage> *mapping)
 {
 
     /*
@@ -119,12 +187,9 @@ GMimeMessage * CMessage::parse_message()
     if (m_imap)
         lazy_load();
 
-    int result __attribute__((unused));
-
     GMimeMessage * message;
     GMimeParser *parser;
     GMimeStream *stream;
-    int fd;
 
     /*
      * The filename we'll operate upon.
@@ -150,7 +215,9 @@ GMimeMessage * CMessage::parse_message()
     }
 
 
-    if ((fd = open(file.c_str(), O_RDONLY, 0)) == -1)
+    std::shared_ptr<CMappedMessage> map = CMappedMessage::open(file, true);
+
+    if (! map)
     {
 
         std::string error = strerror(errno);
@@ -167,11 +234,10 @@ GMimeMessage * CMessage::parse_message()
         return (NULL);
     }
 
-    stream = g_mime_stream_fs_new(fd);
-    g_mime_stream_fs_set_owner((GMimeStreamFs*)stream, FALSE);
+    stream = map->stream();
 
     parser = g_mime_parser_new_with_stream(stream);
-    g_mime_parser_set_persist_stream(parser, FALSE);
+    g_mime_parser_set_persist_stream(parser, TRUE);
 
     message = g_mime_parser_construct_message(parser);
     g_object_unref(stream);
@@ -185,45 +251,30 @@ GMimeMessage * CMessage::parse_message()
     {
 
         /*
-         * Close the file and retry parsing it, by opening it and
-         * skipping two lines.
-         */
-        close(fd);
-        fd = open(file.c_str(), O_RDONLY, 0);
-
-        int newline = 2;
-        int count   = 1024;
-        char buf[2] = { '\0', '\0' };
-
-        /*
+         * Retry parsing it, skipping two lines.
+         *
          * We're skipping two lines, but if the message
          * is really malformed and contains a long
-         * line, etc, we'll have an infinite loop
-         * if we don't cap our attempts.
-         *
-         * `count` is the number of characters read,
-         * and we limit that to 1024 bytes.
-         *
+         * line, etc, we'd skip the whole thing, so
+         * we limit that to 1024 bytes.
          */
-        while ((newline > 0) && (count > 0))
-        {
-            result = read(fd, buf, 1);
+        const char *data = map->data();
+        size_t limit     = std::min(map->size(), (size_t) 1024);
+        size_t offset    = 0;
+        int newline      = 2;
 
-            if (buf[0] == '\n')
+        while ((newline > 0) && (offset < limit))
+        {
+            if (data[offset] == '\n')
                 newline -= 1;
 
-            count -= 1;
+            offset += 1;
         }
 
-        /*
-         * Rebuild - the key here is that `fd` is the file-descriptor
-         * to the open file, and we've consumed content from it already.
-         */
-        stream    = g_mime_stream_fs_new(fd);
+        stream = map->stream(offset);
 
-        parser    = g_mime_parser_new_with_stream(stream);
-        g_mime_stream_fs_set_owner((GMimeStreamFs*)stream, FALSE);
-        g_mime_parser_set_persist_stream(parser, FALSE);
+        parser = g_mime_parser_new_with_stream(stream);
+        g_mime_parser_set_persist_stream(parser, TRUE);
 
         message = g_mime_parser_construct_message(parser);
         g_object_unref(stream);
@@ -231,100 +282,489 @@ GMimeMessage * CMessage::parse_message()
 
     }
 
+    /*
+     * The parts of the message refer into the mapping, without holding
+     * it, so the message must.
+     */
+    if (message != NULL)
+        map->keep_alive(message);
+
+    if (mapping != nullptr)
+        *mapping = map;
+
     if (replaced == true)
         CFile::delete_file(file);
 
+    return (message);
+}
+
+/*
+ * Store a single (unfolded) header from the header-block into the
+ * given map - lower-casing the name, and RFC2047-decoding the value.
+ */
+static void store_header(std::unordered_map < std::string, std::string > &headers,
+                         std::string name, std::string value)
+{
     /*
-     * We close this here explicitly to avoid a leak.
+     * Trim trailing whitespace from the name, and leading whitespace
+     * from the value - "Subject : foo" is malformed, but seen.
      */
-    close(fd);
-    return (message);
+    name.erase(name.find_last_not_of(" \t") + 1);
+
+    if (name.empty())
+        return;
+
+    size_t start = value.find_first_not_of(" \t");
+
+    if (start == std::string::npos)
+        value = "";
+    else
+        value = value.substr(start);
+
+    /*
+     * Downcase the name.
+     */
+    std::transform(name.begin(), name.end(), name.begin(), tolower);
+
+    /*
+     * Decode the value.
+     */
+    char *decoded = g_mime_utils_header_decode_text(value.c_str());
+
+    if (decoded == NULL)
+    {
+        headers[name] = value;
+        return;
+    }
+
+    /*
+     * We want to make sure there are no newlines in the header
+     * value - do that in a hacky way.
+     */
+    std::string v;
+    int l = strlen(decoded);
+
+    for (int i = 0; i < l; i++)
+    {
+        if (decoded[i] != '\n')
+            v += decoded[i];
+    }
+
+    /*
+     * Store the updated value and free the original pointer.
+     */
+    headers[name] = v;
+    free(decoded);
 }
 
-/**
- * Populate the headers and MIME-Parts caches.
+
+/*
+ * Populate the header-cache.
+ *
+ * We scan the mapped message line by line, stopping at the blank line
+ * which terminates the header-block, so that the body - and any
+ * attachments it might contain - is never read just to show the index.
+ *
+ * NOTE: We deliberately don't invoke the `message_replace` hook here,
+ * that exists to rewrite the body (e.g. GPG decryption), and would
+ * require the whole message to be read.
  */
-void CMessage::populate_message() {
+void CMessage::parse_headers()
+{
+    m_headers_parsed = true;
 
-    GMimeMessage *msg = parse_message();
+    /*
+     * The filename we'll operate upon - for IMAP messages this will
+     * fetch the body, lazily.
+     */
+    std::string file = path();
 
-    if (msg == NULL)
+    std::shared_ptr<CMappedMessage> map = CMappedMessage::open(file);
+
+    if (! map)
     {
         CLua *lua = CLua::instance();
-        lua->on_error("Failed to populate message :" + path());
+        lua->on_error("Failed to open the message file:" + file + " " + strerror(errno));
         return;
     }
 
-    const char *name;
-    const char *value;
+    const char *data = map->data();
+    const char *end  = data + map->size();
+    bool first = true;
 
     /*
-     * Prepare to iterate.
+     * The header we're currently building up, which might span
+     * multiple (folded) lines.
      */
-    GMimeHeaderList *ls   = GMIME_OBJECT(msg)->headers;
-    GMimeHeaderIter *iter = g_mime_header_iter_new();
+    std::string name;
+    std::string value;
 
-    if (g_mime_header_list_get_iter(ls, iter)
-            && g_mime_header_iter_first(iter))
+    while (data < end)
     {
-        while (g_mime_header_iter_is_valid(iter))
+        const char *eol = (const char *) memchr(data, '\n', end - data);
+
+        if (eol == NULL)
+            eol = end;
+
+        std::string line(data, eol - data);
+        data = eol + 1;
+
+        /*
+         * Remove the trailing newline, handling DOS line-endings too.
+         */
+        while ((! line.empty()) && (line[line.size() - 1] == '\r'))
+            line.erase(line.size() - 1);
+
+        /*
+         * A blank line terminates the header-block.
+         */
+        if (line.empty())
+            break;
+
+        /*
+         * Skip any mbox-style "From " separator on the first line.
+         */
+        if (first)
         {
-            /*
-             * Get the name + value.
-             */
-            name = g_mime_header_iter_get_name(iter);
-            value = g_mime_header_iter_get_value(iter);
+            first = false;
 
-            /*
-             * Downcase the name.
-             */
-            std::string nm(name);
-            std::transform(nm.begin(), nm.end(), nm.begin(), tolower);
+            if (line.compare(0, 5, "From ") == 0)
+                continue;
+        }
 
+        /*
+         * A continuation line is appended to the current value.
+         */
+        if ((line[0] == ' ') || (line[0] == '\t'))
+        {
+            if (! name.empty())
+                value += line;
 
-            /*
-             * Decode the value.
-             */
-            char * decoded = g_mime_utils_header_decode_text(value);
+            continue;
+        }
 
-            /*
-             * We want to make sure there are no newlines in the header
-             * value - do that in a hacky way.
-             */
-            std::string v;
-            int l = strlen(decoded);
-            for( int i =0; i < l;i++ ) {
-                if ( decoded[i] != '\n' )
-                    v += decoded[i];
-            }
+        /*
+         * Otherwise we're starting a new header, so store the previous one.
+         */
+        if (! name.empty())
+            store_header(m_headers, name, value);
 
-            /*
-             * Store the updated value and free the original pointer.
-             */
-            m_headers[nm] = v;
-            free(decoded);
+        size_t colon = line.find(':');
 
-            /*
-             * We want to ensure that no header-values contain a newline.
-             */
-            if (!g_mime_header_iter_next(iter))
-                break;
+        if (colon == std::string::npos)
+        {
+            name  = "";
+            value = "";
+            continue;
         }
+
+        name  = line.substr(0, colon);
+        value = line.substr(colon + 1);
     }
 
-    g_mime_header_list_clear(ls);
-    g_mime_header_iter_free(iter);
+    if (! name.empty())
+        store_header(m_headers, name, value);
+
+    /*
+     * If we're indexed then update the index with what we found.
+     */
+    if (m_metadata)
+    {
+        m_metadata->mtime = map->mtime();
+        m_metadata->size  = map->size();
+
+        m_metadata->update(m_headers);
+    }
+}
+
+
+/*
+ * Accumulate the attachment-count, attachment-size, and MIME-flags of
+ * the given part, and its children.
+ */
+static void summarise_part(std::shared_ptr<CMessagePart> part, int &count, int64_t &size, uint32_t &flags)
+{
+    if (part->is_attachment())
+    {
+        count += 1;
+        size  += part->size_estimate();
+    }
+
+    std::string type = part->type();
+
+    if (type == "multipart/signed")
+        flags |= CMessageMetadata::MIME_SIGNED;
+    else if (type == "multipart/encrypted")
+        flags |= CMessageMetadata::MIME_ENCRYPTED;
+    else if (type == "text/x-gpg-output")
+        flags |= CMessageMetadata::MIME_GPG_OUTPUT;
+
+    for (std::shared_ptr<CMessagePart> child : part->children())
+        summarise_part(child, count, size, flags);
+}
+
+
+/**
+ * Parse the message into MIME-Parts, and add them to the cache.
+ */
+std::vector<std::shared_ptr<CMessagePart>> CMessage::populate_message()
+{
+    std::vector<std::shared_ptr<CMessagePart>> parts;
+
+    /*
+     * We only walk the structure of the message, and record where the
+     * content of each part may be found, unless the message is being
+     * replaced via a temporary file - which won't exist later.
+     */
+    CLua *lua = CLua::instance();
+    bool lazy = ! lua->function_exists("message_replace");
+
+    if (lazy && !m_source)
+        m_source = std::make_shared<std::string>(path());
+
+    std::shared_ptr<CMappedMessage> map;
+    GMimeMessage *msg = parse_message(&map);
+
+    if (msg == NULL)
+    {
+        lua->on_error("Failed to populate message :" + path());
+        return parts;
+    }
 
     /* Parse into MIME-Parts */
 
     GMimeObject *mime_part = g_mime_message_get_mime_part(msg);
 
-    if (!mime_part)
+    if (mime_part)
+        parts.push_back(part2obj(mime_part, lazy ? m_source : nullptr, map));
+
+    g_object_unref(msg);
+
+    /*
+     * Now we've parsed the parts record their summary.
+     */
+    record_summary(parts);
+
+    CMessageCache *cache = CMessageCache::instance();
+    cache->add(path(), get_mtime(), parts);
+
+    return parts;
+}
+
+
+/*
+ * Record the summary of the given MIME-parts, in the index too if we
+ * have an entry there.
+ */
+void CMessage::record_summary(const std::vector<std::shared_ptr<CMessagePart>> &parts)
+{
+    m_attachments     = 0;
+    m_attachment_size = 0;
+    m_mime_flags      = 0;
+
+    for (std::shared_ptr<CMessagePart> part : parts)
+        summarise_part(part, m_attachments, m_attachment_size, m_mime_flags);
+
+    if (m_metadata)
+    {
+        if ((m_metadata->attachments != m_attachments) ||
+                (m_metadata->attachment_size != m_attachment_size) ||
+                (m_metadata->mime_flags != m_mime_flags))
+        {
+            m_metadata->attachments     = m_attachments;
+            m_metadata->attachment_size = m_attachment_size;
+            m_metadata->mime_flags      = m_mime_flags;
+            m_metadata->modified        = true;
+        }
+    }
+}
+
+
+/*
+ * Ensure the summary of our MIME-parts is available, preferring the
+ * copy held in the maildir-index to parsing the message.
+ */
+void CMessage::summarise()
+{
+    if (m_attachments >= 0)
         return;
 
-    m_parts.push_back(part2obj(mime_part));
+    if (m_metadata && (m_metadata->attachments >= 0))
+    {
+        m_attachments     = m_metadata->attachments;
+        m_attachment_size = m_metadata->attachment_size;
+        m_mime_flags      = m_metadata->mime_flags;
+        return;
+    }
 
-    g_object_unref(msg);
+    std::vector<std::shared_ptr<CMessagePart>> parts = get_parts();
+
+    /*
+     * If the message couldn't be parsed don't try again.
+     */
+    if (parts.empty())
+        m_attachments = 0;
+    else
+        record_summary(parts);
+}
+
+
+/*
+ * The number of attachments this message contains.
+ */
+int CMessage::attachment_count()
+{
+    summarise();
+    return (m_attachments);
+}
+
+
+/*
+ * The total size of the attachments this message contains.
+ */
+int64_t CMessage::attachment_size()
+{
+    summarise();
+    return (m_attachment_size);
+}
+
+
+/*
+ * Does this message contain a `multipart/signed` part?
+ */
+bool CMessage::is_signed()
+{
+    summarise();
+    return ((m_mime_flags & CMessageMetadata::MIME_SIGNED) != 0);
+}
+
+
+/*
+ * Does this message contain a `multipart/encrypted` part?
+ */
+bool CMessage::is_encrypted()
+{
+    summarise();
+    return ((m_mime_flags & CMessageMetadata::MIME_ENCRYPTED) != 0);
+}
+
+
+/*
+ * Does this message contain a `text/x-gpg-output` part?
+ */
+bool CMessage::has_gpg_output()
+{
+    summarise();
+    return ((m_mime_flags & CMessageMetadata::MIME_GPG_OUTPUT) != 0);
+}
+
+
+/*
+ * Format this message for display.
+ */
+std::string CMessage::format(const CMessageFormat &format, const std::string &indent, int number)
+{
+    /*
+     * Only look up the fields the format uses.
+     */
+    std::vector<std::string> values(CMessageFormat::FIELD_COUNT);
+
+    if (format.uses(CMessageFormat::FLAGS))
+        values[CMessageFormat::FLAGS] = get_flags();
+
+    /*
+     * These flags are informational, and unrelated to the flags a
+     * message might have:
+     *
+     *   A => Message has attachments.
+     *   S => Message has a `text/x-gpg-output` part.
+     */
+    if (format.uses(CMessageFormat::MESSAGE_FLAGS))
+    {
+        std::string flags;
+
+        if (attachment_count() > 0)
+            flags += "A";
+
+        if (has_gpg_output())
+            flags += "S";
+
+        values[CMessageFormat::MESSAGE_FLAGS] = flags;
+    }
+
+    /*
+     * The sender, and recipient, and their parts.
+     */
+    if (format.uses(CMessageFormat::SENDER) ||
+            format.uses(CMessageFormat::SENDER_NAME) ||
+            format.uses(CMessageFormat::SENDER_EMAIL) ||
+            format.uses(CMessageFormat::EMAIL) ||
+            format.uses(CMessageFormat::NAME))
+    {
+        std::string sender = header("From");
+        std::string name;
+        std::string email;
+
+        CMessageFormat::split_address(sender, name, email);
+
+        values[CMessageFormat::SENDER]       = sender;
+        values[CMessageFormat::SENDER_NAME]  = name;
+        values[CMessageFormat::SENDER_EMAIL] = email;
+        values[CMessageFormat::EMAIL]        = email;
+
+        /*
+         * The user might have a filter-function to cleanup
+         * the name of the sender.
+         */
+        if (format.uses(CMessageFormat::NAME))
+        {
+            CLua *lua = CLua::instance();
+
+            if (lua->function_exists("on_clean_name"))
+                name = lua->function2string("on_clean_name", name);
+        }
+
+        values[CMessageFormat::NAME] = name;
+    }
+
+    if (format.uses(CMessageFormat::RECIPIENT) ||
+            format.uses(CMessageFormat::RECIPIENT_NAME) ||
+            format.uses(CMessageFormat::RECIPIENT_EMAIL))
+    {
+        std::string recipient = header("To");
+
+        values[CMessageFormat::RECIPIENT] = recipient;
+
+        CMessageFormat::split_address(recipient,
+                                      values[CMessageFormat::RECIPIENT_NAME],
+                                      values[CMessageFormat::RECIPIENT_EMAIL]);
+    }
+
+    values[CMessageFormat::INDENT] = indent;
+
+    if (format.uses(CMessageFormat::SUBJECT))
+        values[CMessageFormat::SUBJECT] = header("Subject");
+
+    if (format.uses(CMessageFormat::DATE))
+        values[CMessageFormat::DATE] = header("Date");
+
+    if (format.uses(CMessageFormat::ID))
+        values[CMessageFormat::ID] = header("Message-ID");
+
+    if (number > 0)
+        values[CMessageFormat::NUMBER] = std::to_string(number);
+    else
+        values[CMessageFormat::NUMBER] = "${number}";
+
+    std::string output = format.expand(values);
+
+    /*
+     * If the message is unread then show it in the "unread" colour.
+     */
+    if (is_new())
+        output = "$[UNREAD]" + output;
+
+    return (output);
 }
 
 
@@ -336,19 +776,114 @@ std::unordered_map < std::string, std::string > CMessage::headers()
     /*
      * If we've cached these then return that copy.
      */
-    if (m_headers.size() == 0)
-        populate_message();
+    if (! m_headers_parsed)
+        parse_headers();
 
     return (m_headers);
 }
 
 
 /*
- * Destructor: If we've parsed any MIME-parts then free them here.
+ * Return the date of this message, in seconds past the epoch.
+ */
+time_t CMessage::get_ctime()
+{
+    /*
+     * If we're indexed then the date is cached there, and we only need
+     * to read the message if that hasn't yet been populated.
+     */
+    if (m_metadata)
+    {
+        if (! m_metadata->parsed && ! m_headers_parsed)
+            parse_headers();
+
+        if (m_metadata->parsed)
+            return ((time_t) m_metadata->date);
+    }
+
+    /*
+     * Look for `Delivery-Date`, then `Date`.  If neither
+     * is present we're screwed.
+     */
+    std::string rd = header("Delivery-Date");
+
+    if (rd.empty())
+        rd = header("Date");
+
+    if (rd.empty())
+        return 0;
+
+    /*
+     * Convert the result to a date.
+     */
+    struct timeval t;
+
+    if (0 == approxidate(rd.c_str(), &t))
+        return (t.tv_sec);
+
+    return 0;
+}
+
+
+/*
+ * The date by which we're sorted.
+ */
+int64_t CMessage::sort_date()
+{
+    if (m_sort_date == -1)
+    {
+        /*
+         * A maildir filename records the delivery-time.  IMAP messages
+         * have theirs set from the folder-listing instead, so only those
+         * listed by an older proxy reach `get_ctime`, which fetches them.
+         */
+        m_sort_date = CMessageSort::filename_date(m_path);
+
+        if (m_sort_date == -1)
+            m_sort_date = get_ctime();
+    }
+
+    return (m_sort_date);
+}
+
+
+/*
+ * The sender by which we're sorted.
+ */
+std::string CMessage::sort_from()
+{
+    if (!m_sort_from_set)
+    {
+        m_sort_from = CMessageSort::normalise_from(header("From"));
+        m_sort_from_set = true;
+    }
+
+    return (m_sort_from);
+}
+
+
+/*
+ * The subject by which we're sorted.
+ */
+std::string CMessage::sort_subject()
+{
+    if (!m_sort_subject_set)
+    {
+        m_sort_subject = CThreader::normalise_subject(header("Subject"));
+        m_sort_subject_set = true;
+    }
+
+    return (m_sort_subject);
+}
+
+
+/*
+ * Destructor.
+ *
+ * NOTE: Our MIME-parts remain cached, in case the message is used again.
  */
 CMessage::~CMessage()
 {
-    m_parts.clear();
 }
 
 
@@ -573,10 +1108,10 @@ void CMessage::mark_unread()
         std::string cmd = "mark_unread " + id + " " + folder + "\n";
 
         /*
-         * Get the output.
+         * We don't need the output, so don't wait for it.
          */
         CIMAPProxy *proxy = CIMAPProxy::instance();
-        std::string out  = proxy->read_imap_output(cmd);
+        proxy->send_async(cmd);
 
         /*
          * Remove `S` flag from m_imap_flags since these are
@@ -646,10 +1181,10 @@ void CMessage::mark_read()
         std::string cmd = "mark_read " + id + " " + folder + "\n";
 
         /*
-         * Get the output.
+         * We don't need the output, so don't wait for it.
          */
         CIMAPProxy *proxy = CIMAPProxy::instance();
-        std::string out  = proxy->read_imap_output(cmd);
+        proxy->send_async(cmd);
 
         /*
          * Remove `N` flag from m_imap_flags since these are
@@ -734,15 +1269,9 @@ void CMessage::mark_read()
 /*
  * Convert a message-part from the MIME message to a CMessagePart object.
  */
-std::shared_ptr<CMessagePart> CMessage::part2obj(GMimeObject *part)
+std::shared_ptr<CMessagePart> CMessage::part2obj(GMimeObject *part, std::shared_ptr<std::string> source,
+                                                 std::shared_ptr<CMappedMessage> map)
 {
-    /*
-     * This is used to enable/disable conversion of character
-     * sets.
-     */
-    CConfig *config = CConfig::instance();
-    int iconv       = config->get_integer("global.iconv", 0);
-
     /*
      * Get the content-type of this part.
      */
@@ -765,115 +1294,64 @@ std::shared_ptr<CMessagePart> CMessage::part2obj(GMimeObject *part)
         aname = (char *) g_mime_object_get_content_type_parameter(part, "name");
 
     /*
-     * Holder for the content
+     * The content of a leaf-part refers to its range of the mapped
+     * message, and we record that rather than decoding it now.
      */
-    GMimeStream *mem = g_mime_stream_mem_new();
+    GMimeDataWrapper *content = NULL;
 
-    if (GMIME_IS_MULTIPART(part) || GMIME_IS_MESSAGE_PARTIAL(part))
-    {
-        /* NOP */
-    }
-    else if (GMIME_IS_MESSAGE_PART(part))
-    {
+    if (GMIME_IS_PART(part) && !GMIME_IS_MESSAGE_PARTIAL(part))
+        content = g_mime_part_get_content_object(GMIME_PART(part));
 
-        /*
-         * Populate `mem` with the data.
-         */
-        GMimeMessage *msg = g_mime_message_part_get_message(GMIME_MESSAGE_PART(part));
-        g_mime_object_write_to_stream(GMIME_OBJECT(msg), mem);
+    GMimeStream *stream = content ? g_mime_data_wrapper_get_stream(content) : NULL;
 
-        /*
-         * We explicitly don't free this message here, because this
-         * will be done by the caller.
-         *
-         * g_object_unref(msg);
-         *
-         *  https://github.com/lumail/lumail2/issues/292
-         *
-         */
+    void *data = NULL;
+    size_t len = 0;
+    bool lazy  = false;
+    PART_SOURCE loc;
 
-    }
-    else
+    if (source && map && stream && GMIME_IS_STREAM_MMAP(stream) && (stream->bound_end >= stream->bound_start))
     {
-        /*
-         * Populate `mem` with the data.
-         */
-        GMimeDataWrapper *content = g_mime_part_get_content_object(GMIME_PART(part));
-        g_mime_data_wrapper_write_to_stream(content, mem);
+        loc.file     = source;
+        loc.ino      = map->ino();
+        loc.size     = map->size();
+        loc.mtime    = map->mtime();
+        loc.offset   = stream->bound_start;
+        loc.length   = stream->bound_end - stream->bound_start;
+        loc.encoding = g_mime_data_wrapper_get_encoding(content);
+        loc.charset  = charset ? charset : "";
+        lazy         = true;
     }
-
-    /*
-     * NOTE: by setting the owner to FALSE, it means unreffing the
-     * memory stream won't free the GByteArray data.
-     */
-    g_mime_stream_mem_set_owner(GMIME_STREAM_MEM(mem), FALSE);
-
-
-    /*
-     * Now we have `res` which is a byte-array of the part's content.
-     *
-     * We also have the content-type.
-     */
-    GByteArray *res = g_mime_stream_mem_get_byte_array(GMIME_STREAM_MEM(mem));
-
-    /*
-     * The actual data from the array, and the size of that data.
-     */
-    char *adata = (char *) res->data;
-    size_t len = (res->len);
-
-    if (iconv == 1)
+    else if (content || GMIME_IS_MESSAGE_PART(part))
     {
         /*
-         * Now we'll try to conver the text to UTF-8, but we
-         * only do that if the content is:
-         *
-         *   text/plain
-         *   not UTF-8 already.
+         * Otherwise decode the content now.
          */
+        GMimeStream *mem = g_mime_stream_mem_new();
 
-        if ((g_mime_content_type_is_type(ct, "text", "plain")) &&
-                (charset != NULL) &&
-                (strcmp(charset, "utf-8") != 0) &&
-                (strcmp(charset, "UTF-8") != 0))
+        if (content)
         {
-            iconv_t cv = g_mime_iconv_open("UTF-8", charset);
-            char *converted = g_mime_iconv_strndup(cv, (const char *) adata, len);
-
-            if (converted != NULL)
-            {
-                /*
-                 * If that succeeded then update our byte-array.
-                 *
-                 * This might causes problems in free.  We should check.
-                 */
-                size_t conv_len = strlen(converted);
-                adata = (char*)malloc(conv_len + 1);
-
-                memcpy(adata, converted, conv_len + 1);
-                len = (size_t)conv_len;
-                g_free(converted);
-            }
-
+            g_mime_data_wrapper_write_to_stream(content, mem);
+        }
+        else
+        {
+            /*
+             * We explicitly don't free this message here, because this
+             * will be done by the caller.
+             *
+             *  https://github.com/lumail/lumail2/issues/292
+             */
+            GMimeMessage *msg = g_mime_message_part_get_message(GMIME_MESSAGE_PART(part));
+            g_mime_object_write_to_stream(GMIME_OBJECT(msg), mem);
         }
+
+        CMessagePart::take_stream(mem, type, charset ? charset : "", &data, &len);
+        g_object_unref(mem);
     }
 
-    std::shared_ptr<CMessagePart> ret;
+    std::shared_ptr<CMessagePart> ret = std::shared_ptr<CMessagePart> (new CMessagePart(type, aname ? aname : "", data, len));
 
-    /*
-     * If it is an attachment we'll add it.
-     */
-    if (aname)
-    {
-        ret = std::shared_ptr<CMessagePart> (new CMessagePart(type, aname, adata, len));
-    }
-    else
-    {
-        /*
-         * Here we store it, but not as an attachment.
-         */
-        ret = std::shared_ptr<CMessagePart> (new CMessagePart(type, "", adata, len));
-    }
+    if (lazy)
+        ret->set_source(loc);
 
     /* If this is a multipart part, then add its children. */
     if (GMIME_IS_MULTIPART(part))
@@ -893,7 +1371,7 @@ std::shared_ptr<CMessagePart> CMessage::part2obj(GMimeObject *part)
             /*
              * Create the child - set the parent.
              */
-            std::shared_ptr<CMessagePart> child = part2obj(subpart);
+            std::shared_ptr<CMessagePart> child = part2obj(subpart, source, map);
             child->set_parent(ret);
 
             /*
@@ -903,29 +1381,29 @@ std::shared_ptr<CMessagePart> CMessage::part2obj(GMimeObject *part)
         }
     }
 
-    /*
-     * Unref the memory & type.
-     */
     free(type);
-    g_object_unref(mem);
-
     return ret;
 }
 
 /*
- * Parse the message into MIME-parts, if we've not already done so.
+ * Parse the message into MIME-parts, if they're not already cached.
  */
 std::vector<std::shared_ptr<CMessagePart> >CMessage::get_parts()
 {
+    std::vector<std::shared_ptr<CMessagePart>> parts;
+
     /*
-     * If we've already parsed then return the cached results.
+     * If we've parsed recently then return the cached results.
      *
-     * A message can't/won't change under our feet.
+     * The cache checks the modification-time of the message, so
+     * we'll never see stale parts.
      */
-    if (m_parts.size() == 0)
-        populate_message();
+    CMessageCache *cache = CMessageCache::instance();
+
+    if (cache->get(path(), get_mtime(), parts))
+        return (parts);
 
-    return (m_parts);
+    return (populate_message());
 }
 
 
@@ -977,6 +1455,9 @@ bool CMessage::unlink()
 
     bool ret = CFile::delete_file(path());
 
+    CMessageCache *cache = CMessageCache::instance();
+    cache->remove(m_path);
+
     CGlobalState *global = CGlobalState::instance();
     global->update_messages(true);
     return ret;
@@ -1166,8 +1647,28 @@ void CMessage::add_attachments(std::vector<std::string> attachments)
     CFile::copy(tmp_file, m_path);
     CFile::delete_file(tmp_file);
 
-    if (m_parts.size() > 0)
-        m_parts.clear();
+    CMessageCache *cache = CMessageCache::instance();
+    cache->remove(m_path);
+
+    /*
+     * What we, and the index, know of the message is now out of date.
+     */
+    m_attachments = -1;
+
+    if (m_metadata)
+    {
+        struct stat sb;
+
+        if (stat(m_path.c_str(), &sb) == 0)
+        {
+            m_metadata->mtime = sb.st_mtime;
+            m_metadata->size  = sb.st_size;
+        }
+
+        m_metadata->parsed      = false;
+        m_metadata->attachments = -1;
+        m_metadata->modified    = true;
+    }
 
     close(fd);
     free(tmp_file);
@@ -1198,6 +1699,9 @@ int CMessage::get_mtime()
 {
     if (m_imap == false)
     {
+        if (m_metadata && m_metadata->parsed)
+            return (m_metadata->mtime);
+
         std::string our_path = path();
 
         struct stat sb;
@@ -1244,3 +1748,128 @@ void CMessage::lazy_load()
 
     }
 }
+
+
+/*
+ * The paths of the IMAP messages whose bodies are being fetched in the
+ * background.
+ */
+static std::unordered_set<std::string> g_fetching;
+
+
+/*
+ * Write the bodies returned by `get_messages_bodies` to the given paths,
+ * indexed by message-ID.
+ *
+ * The result is a series of records, each a line with the ID and length
+ * of a message, followed by the message itself.  A body which has been
+ * fetched already is left alone.
+ */
+static void store_bodies(const std::string &out, const std::unordered_map<int, std::string> &paths)
+{
+    size_t offset = 0;
+
+    while (offset < out.size())
+    {
+        size_t eol = out.find('\n', offset);
+
+        if (eol == std::string::npos)
+            break;
+
+        std::string header = out.substr(offset, eol - offset);
+        unsigned long id  = 0;
+        unsigned long len = 0;
+
+        if ((sscanf(header.c_str(), "%lu %lu", &id, &len) != 2) ||
+                (out.size() - (eol + 1) < len))
+            break;
+
+        auto path = paths.find((int) id);
+
+        if ((path != paths.end()) && !CFile::exists(path->second))
+        {
+            std::ofstream fs(path->second, std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+            fs.write(out.data() + eol + 1, len);
+        }
+
+        offset = eol + 1 + len;
+    }
+}
+
+
+/*
+ * Fetch the bodies of the given IMAP messages, in batches.
+ */
+void CMessage::prefetch(std::vector<std::shared_ptr<CMessage>> messages, bool background)
+{
+    /*
+     * Group the paths of the messages we need by folder.
+     */
+    std::unordered_map<std::string, std::unordered_map<int, std::string>> folders;
+
+    for (std::shared_ptr<CMessage> msg : messages)
+    {
+        if (!msg || !msg->m_imap || !msg->m_parent)
+            continue;
+
+        if (CFile::exists(msg->m_path))
+            continue;
+
+        /*
+         * Don't ask for a body more than once in the background.
+         */
+        if (background && !g_fetching.insert(msg->m_path).second)
+            continue;
+
+        folders[msg->m_parent->path()][msg->m_imap_id] = msg->m_path;
+    }
+
+    if (folders.empty())
+        return;
+
+    /*
+     * Send a request for each folder, before reading any of the
+     * results.
+     */
+    CIMAPProxy *proxy = CIMAPProxy::instance();
+    std::vector<uint32_t> requests;
+
+    for (auto it = folders.begin(); it != folders.end(); ++it)
+    {
+        std::string cmd = "get_messages_bodies ";
+        bool first = true;
+
+        for (auto msg = it->second.begin(); msg != it->second.end(); ++msg)
+        {
+            if (! first)
+                cmd += ",";
+
+            cmd += std::to_string(msg->first);
+            first = false;
+        }
+
+        cmd += " ";
+        cmd += it->first;
+        cmd += "\n";
+
+        if (background)
+        {
+            std::unordered_map<int, std::string> paths = it->second;
+
+            proxy->send_async(cmd, [paths](std::string out)
+            {
+                store_bodies(out, paths);
+
+                for (auto path = paths.begin(); path != paths.end(); ++path)
+                    g_fetching.erase(path->second);
+            });
+        }
+        else
+            requests.push_back(proxy->send(cmd));
+    }
+
+    size_t i = 0;
+
+    for (auto it = folders.begin(); (i < requests.size()) && (it != folders.end()); ++it, ++i)
+        store_bodies(proxy->receive(requests[i]), it->second);
+}
@@ -21,11 +21,15 @@
 
 
 #include <memory>
+#include <stdint.h>
 #include <string>
+#include <time.h>
 #include <unordered_map>
 #include <vector>
 #include <gmime/gmime.h>
 
+#include "string_view.h"
+
 class CMaildir;
 
 /*
@@ -33,6 +37,21 @@ class CMaildir;
  */
 class CMessagePart;
 
+/*
+ * Forward declaration of the compiled format-string type.
+ */
+class CMessageFormat;
+
+/*
+ * Forward declaration of the cached-metadata type.
+ */
+struct CMessageMetadata;
+
+/*
+ * Forward declaration of a mapped message-file.
+ */
+class CMappedMessage;
+
 
 
 /**
@@ -82,11 +101,50 @@ public:
      */
     std::string header(std::string name);
 
+    /**
+     * Get the value of the given header, without copying it.
+     *
+     * The result remains valid for as long as this message does.
+     */
+    CStringView header_view(std::string name);
+
+    /**
+     * Set the cached metadata for this message, from the index of
+     * the maildir which contains it.
+     *
+     * Headers which are held in the metadata will be returned from
+     * there, rather than by reading the message.  If the metadata
+     * hasn't been populated yet it will be the first time a header
+     * is requested.
+     */
+    void set_metadata(std::shared_ptr<CMessageMetadata> metadata);
+
     /**
      * Get all headers, and their values.
      */
     std::unordered_map < std::string, std::string > headers();
 
+    /**
+     * Return the date of this message, in seconds past the epoch, from
+     * its `Delivery-Date` or `Date` header.  Returns zero if neither
+     * can be parsed.
+     */
+    time_t get_ctime();
+
+    /**
+     * The keys by which messages are sorted natively, which are cached
+     * once found.
+     *
+     * The date is the delivery-time recorded at the start of the
+     * filename, or given by `set_imap_date`, or that of `get_ctime` if
+     * there is none.  The sender is the From: header as normalised by
+     * CMessageSort, and the subject has any "Re:" and "Fwd:" markers
+     * removed.
+     */
+    int64_t sort_date();
+    std::string sort_from();
+    std::string sort_subject();
+
     /**
      * Retrieve the current flags for this message.
      */
@@ -110,6 +168,15 @@ public:
         m_imap_id = n;
     };
 
+    /**
+     * Set the time the IMAP server received this message, which is used
+     * as our sort-date so that sorting doesn't fetch the message.
+     */
+    void set_imap_date(int64_t date)
+    {
+        m_sort_date = date;
+    };
+
 
     /**
      * Add a flag to a message.
@@ -156,7 +223,8 @@ public:
     bool unlink();
 
     /**
-     * Parse the message into MIME-parts, if we've not already done so.
+     * Parse the message into MIME-parts, unless they're still held in
+     * the CMessageCache.
      *
      * The parts are returned as a vector of CMessagePart objects, each
      * of which could contain nested children.
@@ -164,6 +232,45 @@ public:
     std::vector<std::shared_ptr<CMessagePart>> get_parts();
 
 
+    /**
+     * The number of attachments this message contains.
+     *
+     * This is held in the maildir-index, if possible, otherwise the
+     * message must be parsed.  The same is true of the methods below.
+     */
+    int attachment_count();
+
+    /**
+     * The total (decoded) size of the attachments, in bytes, which is
+     * estimated from their encoded size.
+     */
+    int64_t attachment_size();
+
+    /**
+     * Does this message contain a `multipart/signed` part?
+     */
+    bool is_signed();
+
+    /**
+     * Does this message contain a `multipart/encrypted` part?
+     */
+    bool is_encrypted();
+
+    /**
+     * Does this message contain a `text/x-gpg-output` part, as added
+     * when a message is verified or decrypted?
+     */
+    bool has_gpg_output();
+
+    /**
+     * Format this message for display, via a compiled format-string
+     * such as `index.format`.
+     *
+     * `indent` is the thread-indentation, and `number` the index of the
+     * message, which is ignored if it is less than one.
+     */
+    std::string format(const CMessageFormat &format, const std::string &indent, int number);
+
     /**
      * Add the named file as an attachment to this message.
      */
@@ -193,6 +300,16 @@ public:
      */
     int get_mtime();
 
+    /**
+     * Fetch the bodies of any of the given IMAP messages which haven't
+     * yet been retrieved, using a single request for each folder,
+     * rather than a request per message.
+     *
+     * If `background` is set we don't wait for the bodies, which are
+     * stored as they arrive.
+     */
+    static void prefetch(std::vector<std::shared_ptr<CMessage>> messages, bool background = false);
+
 private:
 
     /**
@@ -203,18 +320,43 @@ private:
     /**
      * Parse a MIME message and return an object suitable for operating
      * upon.
+     *
+     * The content of each part refers to its location within a mapping
+     * of the message-file, rather than being read into memory.  If `map`
+     * is set it receives that mapping.
+     */
+    GMimeMessage * parse_message(std::shared_ptr<CMappedMessage> *map = nullptr);
+
+    /**
+     * Populate the header-cache, reading only the header-block of the
+     * message rather than parsing the whole MIME-tree.
      */
-    GMimeMessage * parse_message();
+    void parse_headers();
 
     /**
-     * Populate the headers and MIME-Parts caches.
+     * Parse the message into MIME-Parts, and add them to the cache.
      */
-    void populate_message();
+    std::vector<std::shared_ptr<CMessagePart>> populate_message();
+
+    /**
+     * Record the attachment-count, size, and MIME-flags of the given parts.
+     */
+    void record_summary(const std::vector<std::shared_ptr<CMessagePart>> &parts);
+
+    /**
+     * Ensure the attachment-count, size, and MIME-flags are known.
+     */
+    void summarise();
 
     /**
      * Convert a message-part from the MIME message to a CMessagePart object.
+     *
+     * If `source` is set then the content of each part is only decoded
+     * when it is requested, from `map` - the mapping the message was
+     * parsed from - if the file has not been replaced by then.
      */
-    std::shared_ptr<CMessagePart> part2obj(GMimeObject *part);
+    std::shared_ptr<CMessagePart> part2obj(GMimeObject *part, std::shared_ptr<std::string> source,
+                                           std::shared_ptr<CMappedMessage> map);
 
 private:
 
@@ -228,15 +370,43 @@ private:
      */
     std::string m_path;
 
+    /**
+     * A copy of our path, shared with MIME-parts whose content has not
+     * yet been decoded.
+     */
+    std::shared_ptr<std::string> m_source;
+
     /**
      * Cached message-headers from this mail.
      */
     std::unordered_map < std::string, std::string > m_headers;
 
     /**
-     * Cached MIME-parts to this message.
+     * Have we populated `m_headers` yet?
+     */
+    bool m_headers_parsed;
+
+    /**
+     * The metadata held in the maildir-index, if any.
+     */
+    std::shared_ptr<CMessageMetadata> m_metadata;
+
+    /**
+     * The attachment-count, or -1 if not yet known, the size of the
+     * attachments, and the mask of CMessageMetadata::MIME_* flags.
+     */
+    int m_attachments;
+    int64_t m_attachment_size;
+    uint32_t m_mime_flags;
+
+    /**
+     * Our cached sort-keys, the date being -1 until it is known.
      */
-    std::vector<std::shared_ptr<CMessagePart>> m_parts;
+    int64_t m_sort_date;
+    std::string m_sort_from;
+    std::string m_sort_subject;
+    bool m_sort_from_set;
+    bool m_sort_subject_set;
 
     /**
      * Is this message stored in IMAP?
@@ -0,0 +1,208 @@
+/*
+ * message_cache.cc - A bounded cache of parsed MIME-parts.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <iterator>
+
+#include "config.h"
+#include "message_cache.h"
+#include "message_part.h"
+
+
+/**
+ * The default budget, in bytes.
+ */
+static const int DEFAULT_CACHE_SIZE = 64 * 1024 * 1024;
+
+
+/*
+ * Constructor.
+ */
+CMessageCache::CMessageCache()
+{
+    m_size = 0;
+}
+
+
+/*
+ * Retrieve the parts of the given message.
+ */
+bool CMessageCache::get(const std::string &path, int mtime, std::vector<std::shared_ptr<CMessagePart>> &parts)
+{
+    auto it = m_index.find(path);
+
+    if (it == m_index.end())
+        return false;
+
+    /*
+     * If the message has changed then the entry is useless.
+     */
+    if (it->second->mtime != mtime)
+    {
+        erase(it->second);
+        return false;
+    }
+
+    /*
+     * Move the entry to the front.
+     */
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+
+    parts = it->second->parts;
+    return true;
+}
+
+
+/*
+ * Add the parts of the given message.
+ */
+void CMessageCache::add(const std::string &path, int mtime, const std::vector<std::shared_ptr<CMessagePart>> &parts)
+{
+    remove(path);
+
+    MESSAGE_CACHE_ENTRY entry;
+    entry.path   = path;
+    entry.mtime  = mtime;
+    entry.parts  = parts;
+    entry.memory = std::make_shared<size_t>(0);
+
+    /*
+     * Record the memory the parts hold now, and keep count as they
+     * decode their content later - which is when most of it is used,
+     * so that is when we enforce our budget too.
+     */
+    std::shared_ptr<size_t> memory = entry.memory;
+
+    for (std::shared_ptr<CMessagePart> part : parts)
+    {
+        *memory += part->memory();
+
+        part->on_load([this, memory](size_t grown)
+        {
+            *memory += grown;
+            m_size  += grown;
+
+            expire();
+        });
+    }
+
+    m_size += *memory;
+
+    m_entries.push_front(entry);
+    m_index[path] = m_entries.begin();
+
+    expire();
+}
+
+
+/*
+ * Discard the parts of the given message.
+ */
+void CMessageCache::remove(const std::string &path)
+{
+    auto it = m_index.find(path);
+
+    if (it == m_index.end())
+        return;
+
+    erase(it->second);
+}
+
+
+/*
+ * Update the path of a renamed message.
+ */
+void CMessageCache::rename(const std::string &from, const std::string &to)
+{
+    auto it = m_index.find(from);
+
+    if ((from == to) || (it == m_index.end()))
+        return;
+
+    std::list<MESSAGE_CACHE_ENTRY>::iterator entry = it->second;
+    m_index.erase(it);
+
+    remove(to);
+
+    entry->path  = to;
+    m_index[to]  = entry;
+}
+
+
+/*
+ * Discard everything.
+ */
+void CMessageCache::clear()
+{
+    while (!m_entries.empty())
+        erase(m_entries.begin());
+}
+
+
+/*
+ * The number of messages cached.
+ */
+size_t CMessageCache::count()
+{
+    return (m_entries.size());
+}
+
+
+/*
+ * The number of bytes of content held.
+ */
+size_t CMessageCache::size()
+{
+    return (m_size);
+}
+
+
+/*
+ * Discard the least recently used entries until we fit our budget.
+ *
+ * NOTE: We always keep the most recent entry, so that the message
+ * being viewed isn't parsed repeatedly, no matter how large it is.
+ */
+void CMessageCache::expire()
+{
+    CConfig *config = CConfig::instance();
+    int budget = config->get_integer("message.cache_size", DEFAULT_CACHE_SIZE);
+
+    size_t limit = (budget > 0) ? budget : 0;
+
+    while ((m_size > limit) && (m_entries.size() > 1))
+        erase(std::prev(m_entries.end()));
+}
+
+
+/*
+ * Discard the given entry.
+ */
+void CMessageCache::erase(std::list<MESSAGE_CACHE_ENTRY>::iterator entry)
+{
+    /*
+     * The parts might outlive us, if they're still in use.
+     */
+    for (std::shared_ptr<CMessagePart> part : entry->parts)
+        part->on_load(nullptr);
+
+    m_size -= *entry->memory;
+
+    m_index.erase(entry->path);
+    m_entries.erase(entry);
+}
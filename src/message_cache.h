@@ -0,0 +1,149 @@
+/*
+ * message_cache.h - A bounded cache of parsed MIME-parts.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "singleton.h"
+
+
+class CMessagePart;
+
+
+/**
+ * A single entry in the cache: the MIME-parts of one message.
+ */
+typedef struct _message_cache_entry
+{
+    /**
+     * The path, and modification-time, of the message.
+     */
+    std::string path;
+    int mtime;
+
+    /**
+     * The top-level MIME-parts of the message.
+     */
+    std::vector<std::shared_ptr<CMessagePart>> parts;
+
+    /**
+     * The number of bytes of memory the parts hold.
+     */
+    std::shared_ptr<size_t> memory;
+} MESSAGE_CACHE_ENTRY;
+
+
+
+/**
+ * This singleton holds the parsed MIME-parts of recently used messages,
+ * so that CMessage objects don't need to keep them forever.
+ *
+ * The cache is bounded by the number of bytes of (decoded) content it
+ * holds, as set by `message.cache_size`, and when it grows beyond that
+ * the least recently used messages are discarded.  They'll be parsed
+ * again, transparently, if they're used again.
+ *
+ * Entries are keyed by the path of the message, and are only returned
+ * if its modification-time is unchanged.
+ */
+class CMessageCache : public Singleton<CMessageCache>
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CMessageCache();
+
+    /**
+     * Retrieve the parts of the given message, marking them as recently
+     * used.  Returns false if they're not cached.
+     */
+    bool get(const std::string &path, int mtime, std::vector<std::shared_ptr<CMessagePart>> &parts);
+
+    /**
+     * Add the parts of the given message, discarding older entries if
+     * that takes us over our budget.
+     */
+    void add(const std::string &path, int mtime, const std::vector<std::shared_ptr<CMessagePart>> &parts);
+
+    /**
+     * Discard the parts of the given message, if they're cached.
+     */
+    void remove(const std::string &path);
+
+    /**
+     * Update the path of a message which has been renamed.
+     */
+    void rename(const std::string &from, const std::string &to);
+
+    /**
+     * Discard everything.
+     */
+    void clear();
+
+    /**
+     * The number of messages cached.
+     */
+    size_t count();
+
+    /**
+     * The number of bytes of content held.
+     */
+    size_t size();
+
+private:
+
+    /**
+     * Discard the least recently used entries until we fit within
+     * `message.cache_size`.
+     */
+    void expire();
+
+    /**
+     * Discard the given entry.
+     */
+    void erase(std::list<MESSAGE_CACHE_ENTRY>::iterator entry);
+
+private:
+
+    /**
+     * The cached entries, the most recently used first.
+     */
+    std::list<MESSAGE_CACHE_ENTRY> m_entries;
+
+    /**
+     * The entries, indexed by path.
+     */
+    std::unordered_map<std::string, std::list<MESSAGE_CACHE_ENTRY>::iterator> m_index;
+
+    /**
+     * The number of bytes of memory held by all our entries.
+     *
+     * Parts decode their content when it is first requested, so this
+     * grows via the callbacks we set upon them, as well as when entries
+     * are added.
+     */
+    size_t m_size;
+};
@@ -0,0 +1,127 @@
+/*
+ * message_cache_test.cc - Test-cases for our CMessageCache class.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <string.h>
+
+#include "config.h"
+#include "message_cache.h"
+#include "message_part.h"
+#include "CuTest.h"
+
+
+/**
+ * Create a list holding a single part, with the given amount of content.
+ */
+static std::vector<std::shared_ptr<CMessagePart>> make_parts(size_t len)
+{
+    void *content = g_malloc(len);
+    memset(content, 'x', len);
+
+    std::vector<std::shared_ptr<CMessagePart>> parts;
+    parts.push_back(std::make_shared<CMessagePart>("text/plain", "", content, len));
+    return parts;
+}
+
+
+/**
+ * Test that entries are found by path, and discarded if the message
+ * has changed.
+ */
+void TestMessageCacheLookup(CuTest * tc)
+{
+    CMessageCache *cache = CMessageCache::instance();
+    cache->clear();
+
+    std::vector<std::shared_ptr<CMessagePart>> parts = make_parts(10);
+    std::vector<std::shared_ptr<CMessagePart>> found;
+
+    cache->add("/tmp/cur/1:2,", 100, parts);
+    CuAssertIntEquals(tc, 1, cache->count());
+
+    CuAssertTrue(tc, cache->get("/tmp/cur/1:2,", 100, found));
+    CuAssertTrue(tc, found[0] == parts[0]);
+    CuAssertTrue(tc, !cache->get("/tmp/cur/2:2,", 100, found));
+
+    /*
+     * A rename keeps the entry.
+     */
+    cache->rename("/tmp/cur/1:2,", "/tmp/cur/1:2,S");
+    CuAssertTrue(tc, !cache->get("/tmp/cur/1:2,", 100, found));
+    CuAssertTrue(tc, cache->get("/tmp/cur/1:2,S", 100, found));
+
+    /*
+     * A change to the modification-time discards it.
+     */
+    CuAssertTrue(tc, !cache->get("/tmp/cur/1:2,S", 101, found));
+    CuAssertIntEquals(tc, 0, cache->count());
+
+    cache->clear();
+}
+
+
+/**
+ * Test that the least recently used entries are discarded when we
+ * exceed our budget.
+ */
+void TestMessageCacheExpire(CuTest * tc)
+{
+    CMessageCache *cache = CMessageCache::instance();
+    cache->clear();
+
+    CConfig *config = CConfig::instance();
+    config->set("message.cache_size", 25000);
+
+    std::vector<std::shared_ptr<CMessagePart>> found;
+
+    cache->add("one", 1, make_parts(10000));
+    cache->add("two", 1, make_parts(10000));
+
+    /*
+     * Use the first, so the second is the oldest.
+     */
+    CuAssertTrue(tc, cache->get("one", 1, found));
+
+    cache->add("three", 1, make_parts(10000));
+
+    CuAssertIntEquals(tc, 2, cache->count());
+    CuAssertTrue(tc, cache->get("one", 1, found));
+    CuAssertTrue(tc, !cache->get("two", 1, found));
+    CuAssertTrue(tc, cache->get("three", 1, found));
+    CuAssertTrue(tc, cache->size() <= 25000);
+
+    /*
+     * The newest entry is kept, even if it is too large.
+     */
+    cache->add("four", 1, make_parts(50000));
+    CuAssertIntEquals(tc, 1, cache->count());
+    CuAssertTrue(tc, cache->get("four", 1, found));
+
+    config->set("message.cache_size", 64 * 1024 * 1024);
+    cache->clear();
+}
+
+
+CuSuite *
+message_cache_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMessageCacheLookup);
+    SUITE_ADD_TEST(suite, TestMessageCacheExpire);
+    return suite;
+}
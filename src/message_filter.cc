@@ -0,0 +1,387 @@
+/*
+ * message_filter.cc - Limit the messages which are displayed.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <ctype.h>
+#include <pcrecpp.h>
+
+#include "message.h"
+#include "message_filter.h"
+
+
+/*
+ * Is the given word an operator?
+ */
+static bool is_operator(const std::string &word)
+{
+    return ((word == "AND") || (word == "OR") || (word == "NOT"));
+}
+
+
+/*
+ * Compile the given expression.
+ */
+CMessageFilter::CMessageFilter(const std::string &expression, time_t now)
+    : m_source(expression), m_now(now), m_root(-1)
+{
+    /*
+     * Split the expression into operators and terms.
+     *
+     * Neighbouring words which aren't operators form a single term, so
+     * that a pattern may contain spaces.
+     */
+    size_t term_start = std::string::npos;
+    size_t term_end = 0;
+    size_t i = 0;
+
+    while (i < expression.size())
+    {
+        if (isspace(expression[i]))
+        {
+            i++;
+            continue;
+        }
+
+        size_t start = i;
+
+        while ((i < expression.size()) && !isspace(expression[i]))
+            i++;
+
+        std::string word = expression.substr(start, i - start);
+
+        if (is_operator(word))
+        {
+            if (term_start != std::string::npos)
+                m_tokens.push_back(expression.substr(term_start, term_end - term_start));
+
+            term_start = std::string::npos;
+            m_tokens.push_back(word);
+        }
+        else
+        {
+            if (term_start == std::string::npos)
+                term_start = start;
+
+            term_end = i;
+        }
+    }
+
+    if (term_start != std::string::npos)
+        m_tokens.push_back(expression.substr(term_start, term_end - term_start));
+
+    /*
+     * An empty expression matches everything.
+     */
+    if (m_tokens.empty())
+        m_tokens.push_back("all");
+
+    size_t pos = 0;
+    m_root = parse_or(pos);
+
+    if ((m_root != -1) && (pos < m_tokens.size()))
+        m_error = "Unexpected '" + m_tokens[pos] + "'";
+
+    if (!m_error.empty())
+        m_root = -1;
+
+    m_tokens.clear();
+}
+
+
+/*
+ * The expression we were compiled from.
+ */
+const std::string &CMessageFilter::source() const
+{
+    return (m_source);
+}
+
+
+/*
+ * The reason the expression could not be compiled.
+ */
+const std::string &CMessageFilter::error() const
+{
+    return (m_error);
+}
+
+
+/*
+ * Does the given message match?
+ */
+bool CMessageFilter::matches(const FILTER_MESSAGE &message) const
+{
+    if (m_root == -1)
+        return false;
+
+    return (matches(m_root, message));
+}
+
+
+/*
+ * Return those of the given messages which match.
+ */
+std::vector<std::shared_ptr<CMessage> > CMessageFilter::filter(const std::vector<std::shared_ptr<CMessage> > &messages) const
+{
+    std::vector<std::shared_ptr<CMessage> > result;
+
+    if (m_root == -1)
+        return (result);
+
+    /*
+     * Every message matches `all`.
+     */
+    if (m_nodes[m_root].type == FILTER_NODE::ALL)
+        return (messages);
+
+    for (std::shared_ptr<CMessage> msg : messages)
+    {
+        FILTER_MESSAGE message;
+
+        message.is_new = [&msg]()
+        {
+            return msg->is_new();
+        };
+        message.attachments = [&msg]()
+        {
+            return msg->attachment_count();
+        };
+        message.date = [&msg]()
+        {
+            return msg->sort_date();
+        };
+        message.header = [&msg](const std::string &name)
+        {
+            return msg->header(name);
+        };
+
+        if (matches(m_root, message))
+            result.push_back(msg);
+    }
+
+    return (result);
+}
+
+
+/*
+ * Parse terms joined by `OR`.
+ */
+int CMessageFilter::parse_or(size_t &pos)
+{
+    int left = parse_and(pos);
+
+    while ((left != -1) && (pos < m_tokens.size()) && (m_tokens[pos] == "OR"))
+    {
+        pos++;
+
+        int right = parse_and(pos);
+
+        if (right == -1)
+            return -1;
+
+        FILTER_NODE node;
+        node.type  = FILTER_NODE::OR;
+        node.left  = left;
+        node.right = right;
+        left = add(node);
+    }
+
+    return (left);
+}
+
+
+/*
+ * Parse terms joined by `AND`.
+ */
+int CMessageFilter::parse_and(size_t &pos)
+{
+    int left = parse_not(pos);
+
+    while ((left != -1) && (pos < m_tokens.size()) && (m_tokens[pos] == "AND"))
+    {
+        pos++;
+
+        int right = parse_not(pos);
+
+        if (right == -1)
+            return -1;
+
+        FILTER_NODE node;
+        node.type  = FILTER_NODE::AND;
+        node.left  = left;
+        node.right = right;
+        left = add(node);
+    }
+
+    return (left);
+}
+
+
+/*
+ * Parse a term, which might be negated.
+ */
+int CMessageFilter::parse_not(size_t &pos)
+{
+    if (pos >= m_tokens.size())
+    {
+        m_error = "Missing term after '" + m_tokens.back() + "'";
+        return -1;
+    }
+
+    std::string token = m_tokens[pos++];
+
+    if (token == "NOT")
+    {
+        int operand = parse_not(pos);
+
+        if (operand == -1)
+            return -1;
+
+        FILTER_NODE node;
+        node.type  = FILTER_NODE::NOT;
+        node.left  = operand;
+        node.right = -1;
+        return (add(node));
+    }
+
+    if (is_operator(token))
+    {
+        m_error = "Missing term before '" + token + "'";
+        return -1;
+    }
+
+    return (term(token));
+}
+
+
+/*
+ * Compile a single term.
+ */
+int CMessageFilter::term(const std::string &text)
+{
+    FILTER_NODE node;
+    node.left  = -1;
+    node.right = -1;
+
+    std::string lower = text;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+
+    if (lower == "all")
+        node.type = FILTER_NODE::ALL;
+    else if (lower == "new")
+        node.type = FILTER_NODE::NEW;
+    else if (lower == "attach")
+        node.type = FILTER_NODE::ATTACH;
+    else if (lower == "today")
+        node.type = FILTER_NODE::TODAY;
+    else
+    {
+        std::string pattern = text;
+        node.type = FILTER_NODE::PATTERN;
+
+        /*
+         * A header we cache in the maildir index?
+         */
+        size_t colon = lower.find(':');
+
+        if (colon != std::string::npos)
+        {
+            std::string name = lower.substr(0, colon);
+
+            if (name == "from")
+                node.header = "From";
+            else if (name == "to")
+                node.header = "To";
+            else if (name == "subject")
+                node.header = "Subject";
+
+            if (!node.header.empty())
+            {
+                node.type = FILTER_NODE::HEADER;
+                pattern = text.substr(colon + 1);
+            }
+        }
+
+        pcrecpp::RE_Options opt;
+        opt.set_caseless(true);
+
+        node.regexp = std::make_shared<pcrecpp::RE>(pattern, opt);
+
+        if (!node.regexp->error().empty())
+        {
+            m_error = "Invalid pattern '" + pattern + "': " + node.regexp->error();
+            return -1;
+        }
+    }
+
+    return (add(node));
+}
+
+
+/*
+ * Add a node.
+ */
+int CMessageFilter::add(FILTER_NODE node)
+{
+    m_nodes.push_back(node);
+    return (m_nodes.size() - 1);
+}
+
+
+/*
+ * Test the given node against a message.
+ */
+bool CMessageFilter::matches(int offset, const FILTER_MESSAGE &message) const
+{
+    const FILTER_NODE &node = m_nodes[offset];
+
+    switch (node.type)
+    {
+    case FILTER_NODE::ALL:
+        return true;
+
+    case FILTER_NODE::NEW:
+        return (message.is_new());
+
+    case FILTER_NODE::ATTACH:
+        return (message.attachments() > 0);
+
+    case FILTER_NODE::TODAY:
+        return (message.date() > (int64_t)m_now - (60 * 60 * 24));
+
+    case FILTER_NODE::HEADER:
+        return (node.regexp->PartialMatch(message.header(node.header)));
+
+    case FILTER_NODE::PATTERN:
+        return (node.regexp->PartialMatch(message.header("From")) ||
+                node.regexp->PartialMatch(message.header("To")) ||
+                node.regexp->PartialMatch(message.header("Subject")));
+
+    case FILTER_NODE::AND:
+        return (matches(node.left, message) && matches(node.right, message));
+
+    case FILTER_NODE::OR:
+        return (matches(node.left, message) || matches(node.right, message));
+
+    case FILTER_NODE::NOT:
+        return (!matches(node.left, message));
+    }
+
+    return false;
+}
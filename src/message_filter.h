@@ -0,0 +1,207 @@
+/*
+ * message_filter.h - Limit the messages which are displayed.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+
+class CMessage;
+
+namespace pcrecpp
+{
+class RE;
+}
+
+
+/**
+ * The parts of a message which a filter may test, each of which is only
+ * looked up if the filter needs it.
+ */
+typedef struct _filter_message
+{
+    /**
+     * Is the message unread?
+     */
+    std::function<bool()> is_new;
+
+    /**
+     * The number of attachments.
+     */
+    std::function<int()> attachments;
+
+    /**
+     * The date the message arrived, in seconds past the epoch.
+     */
+    std::function<int64_t()> date;
+
+    /**
+     * The value of the named header.
+     */
+    std::function<std::string(const std::string &)> header;
+} FILTER_MESSAGE;
+
+
+
+/**
+ * A limit-expression, such as `index.limit`, compiled once so that it
+ * can be tested against each message without any further parsing.
+ *
+ * An expression is made of terms:
+ *
+ * * `all` matches every message.
+ * * `new` matches unread messages.
+ * * `attach` matches messages with attachments.
+ * * `today` matches messages which arrived in the past day.
+ * * `from:XXX`, `to:XXX`, and `subject:XXX` match messages where that
+ *   header matches the regular expression `XXX`.
+ * * Anything else is a regular expression which is matched against
+ *   the `From:`, `To:`, and `Subject:` headers.
+ *
+ * Terms may be joined with `AND` and `OR`, and negated with `NOT`, for
+ * example "new AND from:steve OR NOT today".  `NOT` binds most tightly,
+ * then `AND`, then `OR`.  All regular expressions are case-insensitive.
+ */
+class CMessageFilter
+{
+public:
+
+    /**
+     * Compile the given expression.
+     *
+     * `now` is the time against which `today` is tested.
+     */
+    CMessageFilter(const std::string &expression, time_t now = time(NULL));
+
+    /**
+     * The expression we were compiled from.
+     */
+    const std::string &source() const;
+
+    /**
+     * The reason the expression could not be compiled, if it couldn't.
+     */
+    const std::string &error() const;
+
+    /**
+     * Does the given message match?
+     */
+    bool matches(const FILTER_MESSAGE &message) const;
+
+    /**
+     * Return those of the given messages which match, in order.
+     */
+    std::vector<std::shared_ptr<CMessage> > filter(const std::vector<std::shared_ptr<CMessage> > &messages) const;
+
+private:
+
+    /**
+     * A single node of the compiled expression.
+     */
+    typedef struct _filter_node
+    {
+        /**
+         * What this node tests.
+         */
+        enum
+        {
+            ALL,
+            NEW,
+            ATTACH,
+            TODAY,
+            HEADER,
+            PATTERN,
+            AND,
+            OR,
+            NOT
+        } type;
+
+        /**
+         * For HEADER nodes the name of the header to test.
+         */
+        std::string header;
+
+        /**
+         * For HEADER and PATTERN nodes the regular expression to match.
+         */
+        std::shared_ptr<pcrecpp::RE> regexp;
+
+        /**
+         * The operands of AND, OR, and NOT nodes, by offset.
+         */
+        int left;
+        int right;
+    } FILTER_NODE;
+
+    /**
+     * Parse the expression beginning at the given token, returning the
+     * offset of the resulting node, or -1 on error.
+     */
+    int parse_or(size_t &pos);
+    int parse_and(size_t &pos);
+    int parse_not(size_t &pos);
+
+    /**
+     * Compile a single term.
+     */
+    int term(const std::string &text);
+
+    /**
+     * Add a node, returning its offset.
+     */
+    int add(FILTER_NODE node);
+
+    /**
+     * Test the given node against a message.
+     */
+    bool matches(int node, const FILTER_MESSAGE &message) const;
+
+private:
+
+    /**
+     * The expression we were compiled from.
+     */
+    std::string m_source;
+
+    /**
+     * The reason the expression could not be compiled, if any.
+     */
+    std::string m_error;
+
+    /**
+     * The time against which `today` is tested.
+     */
+    time_t m_now;
+
+    /**
+     * The operators and terms of the expression, while it is compiled.
+     */
+    std::vector<std::string> m_tokens;
+
+    /**
+     * The compiled expression, and the offset of its root.
+     */
+    std::vector<FILTER_NODE> m_nodes;
+    int m_root;
+};
@@ -0,0 +1,186 @@
+/*
+ * message_filter_test.cc - Test-cases for our CMessageFilter class.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <string>
+
+#include "message_filter.h"
+#include "CuTest.h"
+
+
+/**
+ * The time at which our tests run.
+ */
+#define TEST_NOW 1000000
+
+
+/**
+ * Return a message with the given properties.
+ */
+static FILTER_MESSAGE test_message(bool is_new, int attachments, int64_t date,
+                                   const std::string &from, const std::string &subject)
+{
+    FILTER_MESSAGE message;
+
+    message.is_new = [is_new]()
+    {
+        return is_new;
+    };
+    message.attachments = [attachments]()
+    {
+        return attachments;
+    };
+    message.date = [date]()
+    {
+        return date;
+    };
+    message.header = [from, subject](const std::string &name)
+    {
+        if (name == "From")
+            return from;
+
+        if (name == "Subject")
+            return subject;
+
+        return std::string("");
+    };
+
+    return message;
+}
+
+
+/**
+ * Test the simple terms.
+ */
+void TestMessageFilterTerms(CuTest * tc)
+{
+    FILTER_MESSAGE unread = test_message(true, 0, TEST_NOW - 60, "Steve Kemp <steve@example.com>", "Hello");
+    FILTER_MESSAGE attached = test_message(false, 2, TEST_NOW - 7 * 24 * 60 * 60, "Bob <bob@example.org>", "Photos");
+
+    struct
+    {
+        const char *expression;
+        bool unread;
+        bool attached;
+    } tests[] =
+    {
+        {"all", true, true},
+        {"", true, true},
+        {"new", true, false},
+        {"NEW", true, false},
+        {"attach", false, true},
+        {"today", true, false},
+        {"from:steve", true, false},
+        {"from:EXAMPLE", true, true},
+        {"subject:^photo", false, true},
+        {"to:steve", false, false},
+        {"bob", false, true},
+        {"hello", true, false},
+        {"example\\.org", false, true},
+        {"steve kemp", true, false},
+        {"Steve  Kemp", false, false},
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+    {
+        CMessageFilter filter(tests[i].expression, TEST_NOW);
+
+        CuAssertStrEquals(tc, "", filter.error().c_str());
+        CuAssertTrue(tc, filter.matches(unread) == tests[i].unread);
+        CuAssertTrue(tc, filter.matches(attached) == tests[i].attached);
+    }
+}
+
+
+/**
+ * Test that terms may be combined.
+ */
+void TestMessageFilterOperators(CuTest * tc)
+{
+    FILTER_MESSAGE unread = test_message(true, 0, TEST_NOW - 60, "Steve Kemp <steve@example.com>", "Hello");
+    FILTER_MESSAGE attached = test_message(false, 2, TEST_NOW - 7 * 24 * 60 * 60, "Bob <bob@example.org>", "Photos");
+    FILTER_MESSAGE both = test_message(true, 1, TEST_NOW, "Bob <bob@example.org>", "Re: Hello");
+
+    struct
+    {
+        const char *expression;
+        bool unread;
+        bool attached;
+        bool both;
+    } tests[] =
+    {
+        {"new AND from:bob", false, false, true},
+        {"new AND attach", false, false, true},
+        {"new OR attach", true, true, true},
+        {"NOT new", false, true, false},
+        {"NOT NOT new", true, false, true},
+        {"attach AND NOT new", false, true, false},
+        {"new AND from:steve OR subject:photos", true, true, false},
+        {"subject:photos OR new AND from:steve", true, true, false},
+        {"NOT today AND NOT attach OR hello", true, false, true},
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+    {
+        CMessageFilter filter(tests[i].expression, TEST_NOW);
+
+        CuAssertStrEquals(tc, "", filter.error().c_str());
+        CuAssertTrue(tc, filter.matches(unread) == tests[i].unread);
+        CuAssertTrue(tc, filter.matches(attached) == tests[i].attached);
+        CuAssertTrue(tc, filter.matches(both) == tests[i].both);
+    }
+}
+
+
+/**
+ * Test that invalid expressions are reported, and match nothing.
+ */
+void TestMessageFilterErrors(CuTest * tc)
+{
+    FILTER_MESSAGE unread = test_message(true, 0, TEST_NOW, "Steve Kemp <steve@example.com>", "Hello");
+
+    const char *tests[] =
+    {
+        "new AND",
+        "OR new",
+        "NOT",
+        "new AND OR attach",
+        "new NOT attach",
+        "from:(steve",
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+    {
+        CMessageFilter filter(tests[i], TEST_NOW);
+
+        CuAssertTrue(tc, !filter.error().empty());
+        CuAssertTrue(tc, !filter.matches(unread));
+        CuAssertStrEquals(tc, tests[i], filter.source().c_str());
+    }
+}
+
+
+CuSuite *
+message_filter_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMessageFilterTerms);
+    SUITE_ADD_TEST(suite, TestMessageFilterOperators);
+    SUITE_ADD_TEST(suite, TestMessageFilterErrors);
+    return suite;
+}
@@ -0,0 +1,250 @@
+/*
+ * message_format.cc - Compiled templates for formatting messages.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <stdlib.h>
+
+#include "message_format.h"
+#include "util.h"
+
+
+/*
+ * The names of our fields, as used in format-strings, indexed by
+ * CMessageFormat::Field.
+ */
+static const char *g_field_names[CMessageFormat::FIELD_COUNT] =
+{
+    "flags",
+    "message_flags",
+    "sender",
+    "sender_name",
+    "sender_email",
+    "email",
+    "name",
+    "indent",
+    "subject",
+    "number",
+    "date",
+    "id",
+    "recipient",
+    "recipient_name",
+    "recipient_email",
+};
+
+
+/*
+ * Is the given string non-empty, and entirely made of digits?
+ */
+static bool is_number(const std::string &str)
+{
+    if (str.empty())
+        return false;
+
+    for (char c : str)
+    {
+        if ((c < '0') || (c > '9'))
+            return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Compile the given format-string.
+ */
+CMessageFormat::CMessageFormat(const std::string &format)
+{
+    m_source = format;
+    m_used.assign(FIELD_COUNT, false);
+
+    size_t start = 0;
+
+    while (start < format.size())
+    {
+        /*
+         * Find the next "${...}", and add any text before it.
+         */
+        size_t open  = format.find("${", start);
+        size_t close = (open == std::string::npos) ? open : format.find('}', open);
+
+        if (close == std::string::npos)
+            open = format.size();
+
+        if (open > start)
+        {
+            FORMAT_TOKEN literal;
+            literal.text     = format.substr(start, open - start);
+            literal.field    = -1;
+            literal.width    = 0;
+            literal.pad_left = true;
+            literal.pad      = ' ';
+            m_tokens.push_back(literal);
+        }
+
+        if (open == format.size())
+            break;
+
+        /*
+         * Now parse the field, which might be "name", "N|name",
+         * or "name|N".
+         */
+        std::string key = format.substr(open + 2, close - open - 2);
+
+        FORMAT_TOKEN token;
+        token.text     = format.substr(open, close - open + 1);
+        token.field    = -1;
+        token.width    = 0;
+        token.pad_left = true;
+        token.pad      = ' ';
+
+        std::string name = key;
+        std::string len  = "";
+        size_t first     = key.find('|');
+        size_t last      = key.rfind('|');
+
+        if ((last != std::string::npos) && is_number(key.substr(last + 1)))
+        {
+            name           = key.substr(0, last);
+            len            = key.substr(last + 1);
+            token.pad_left = false;
+        }
+        else if ((first != std::string::npos) && is_number(key.substr(0, first)))
+        {
+            name = key.substr(first + 1);
+            len  = key.substr(0, first);
+        }
+
+        if (! len.empty())
+        {
+            token.width = atoi(len.c_str());
+
+            if (len[0] == '0')
+                token.pad = '0';
+        }
+
+        for (int i = 0; i < FIELD_COUNT; i++)
+        {
+            if (name == g_field_names[i])
+            {
+                token.field = i;
+                m_used[i]   = true;
+            }
+        }
+
+        m_tokens.push_back(token);
+        start = close + 1;
+    }
+}
+
+
+/*
+ * The format-string we were compiled from.
+ */
+const std::string &CMessageFormat::source() const
+{
+    return (m_source);
+}
+
+
+/*
+ * Does the format refer to the given field?
+ */
+bool CMessageFormat::uses(Field field) const
+{
+    return (m_used[field]);
+}
+
+
+/*
+ * Expand the format, given the values of the fields.
+ */
+std::string CMessageFormat::expand(const std::vector<std::string> &values) const
+{
+    std::string result;
+
+    for (const FORMAT_TOKEN &token : m_tokens)
+    {
+        /*
+         * Literal text, or an unknown field without a width.
+         */
+        if ((token.field < 0) && (token.width == 0))
+        {
+            result += token.text;
+            continue;
+        }
+
+        const std::string &value = (token.field < 0) ? token.text : values[token.field];
+
+        if (token.width == 0)
+        {
+            result += value;
+            continue;
+        }
+
+        /*
+         * Count the characters in the value, stopping once we've got
+         * as many as will fit.
+         */
+        size_t glyphs = 0;
+        size_t bytes  = 0;
+
+        while ((bytes < value.size()) && (glyphs < token.width))
+        {
+            size_t size = dsutil_utf8_charlen(value[bytes]);
+
+            if ((size == 0) || (bytes + size > value.size()))
+                size = 1;
+
+            bytes  += size;
+            glyphs += 1;
+        }
+
+        std::string padding(token.width - glyphs, token.pad);
+
+        if (token.pad_left)
+            result += padding + value.substr(0, bytes);
+        else
+            result += value.substr(0, bytes) + padding;
+    }
+
+    return (result);
+}
+
+
+/*
+ * Split an address into the name and the email address.
+ */
+void CMessageFormat::split_address(const std::string &address, std::string &name, std::string &email)
+{
+    size_t open  = address.find('<');
+    size_t close = address.rfind('>');
+
+    if ((open == std::string::npos) || (close == std::string::npos) || (close < open))
+    {
+        name  = address;
+        email = address;
+        return;
+    }
+
+    email = address.substr(open + 1, close - open - 1);
+    name  = address.substr(0, open) + address.substr(close + 1);
+
+    if (name.empty())
+        name = address;
+}
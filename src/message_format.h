@@ -0,0 +1,149 @@
+/*
+ * message_format.h - Compiled templates for formatting messages.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+
+/**
+ * A single piece of a compiled format-string: either literal text, or
+ * a field which is expanded - possibly padded or truncated.
+ */
+typedef struct _format_token
+{
+    /**
+     * The literal text, or for fields the original "${...}" text,
+     * which is used if the field is unknown.
+     */
+    std::string text;
+
+    /**
+     * The field to expand, or -1 for literal text and unknown fields.
+     */
+    int field;
+
+    /**
+     * The width of the field in characters, or zero if unlimited.
+     */
+    size_t width;
+
+    /**
+     * Should short values be padded on the left, rather than the right?
+     */
+    bool pad_left;
+
+    /**
+     * The padding character, either " " or "0".
+     */
+    char pad;
+} FORMAT_TOKEN;
+
+
+
+/**
+ * A format-string, such as `index.format`, compiled once so that it can
+ * be expanded for each message without any further parsing.
+ *
+ * The syntax matches that of `string.interp` in Lua:
+ *
+ * * `${subject}` expands to the value of the field.
+ * * `${20|sender}` expands to exactly twenty characters, truncating long
+ *   values and padding short ones on the left.
+ * * `${sender|20}` is the same, but pads on the right.
+ * * `${05|number}` pads with zeros, rather than spaces.
+ *
+ * Unknown fields are left alone.
+ */
+class CMessageFormat
+{
+public:
+
+    /**
+     * The fields which may be used.
+     */
+    enum Field
+    {
+        FLAGS,
+        MESSAGE_FLAGS,
+        SENDER,
+        SENDER_NAME,
+        SENDER_EMAIL,
+        EMAIL,
+        NAME,
+        INDENT,
+        SUBJECT,
+        NUMBER,
+        DATE,
+        ID,
+        RECIPIENT,
+        RECIPIENT_NAME,
+        RECIPIENT_EMAIL,
+        FIELD_COUNT
+    };
+
+    /**
+     * Compile the given format-string.
+     */
+    CMessageFormat(const std::string &format);
+
+    /**
+     * The format-string we were compiled from.
+     */
+    const std::string &source() const;
+
+    /**
+     * Does the format refer to the given field?
+     *
+     * Fields which are not used needn't be looked up.
+     */
+    bool uses(Field field) const;
+
+    /**
+     * Expand the format, given the values of the fields, which are
+     * indexed by `Field`.
+     */
+    std::string expand(const std::vector<std::string> &values) const;
+
+    /**
+     * Split an address such as "Steve Kemp <steve@example.com>" into
+     * the name and the email address.
+     *
+     * If there is no name then the whole address is used for both.
+     */
+    static void split_address(const std::string &address, std::string &name, std::string &email);
+
+private:
+
+    /**
+     * The format-string we were compiled from.
+     */
+    std::string m_source;
+
+    /**
+     * The compiled tokens.
+     */
+    std::vector<FORMAT_TOKEN> m_tokens;
+
+    /**
+     * The fields we use.
+     */
+    std::vector<bool> m_used;
+};
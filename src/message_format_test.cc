@@ -0,0 +1,92 @@
+/*
+ * message_format_test.cc - Test-cases for our CMessageFormat class.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <string>
+#include <vector>
+
+#include "message_format.h"
+#include "CuTest.h"
+
+
+/**
+ * Test that plain text, and fields, are expanded.
+ */
+void TestFormatFields(CuTest * tc)
+{
+    CMessageFormat format("From ${sender}: ${subject} ${unknown}");
+
+    CuAssertTrue(tc, format.uses(CMessageFormat::SENDER));
+    CuAssertTrue(tc, format.uses(CMessageFormat::SUBJECT));
+    CuAssertTrue(tc, ! format.uses(CMessageFormat::DATE));
+
+    std::vector<std::string> values(CMessageFormat::FIELD_COUNT);
+    values[CMessageFormat::SENDER]  = "Steve";
+    values[CMessageFormat::SUBJECT] = "Hello";
+
+    CuAssertStrEquals(tc, "From Steve: Hello ${unknown}", format.expand(values).c_str());
+}
+
+
+/**
+ * Test that fields are padded, and truncated.
+ */
+void TestFormatWidths(CuTest * tc)
+{
+    CMessageFormat format("[${4|flags}] [${flags|4}] [${03|number}] [${3|subject}]");
+
+    std::vector<std::string> values(CMessageFormat::FIELD_COUNT);
+    values[CMessageFormat::FLAGS]   = "NS";
+    values[CMessageFormat::NUMBER]  = "7";
+    values[CMessageFormat::SUBJECT] = "的展会 - Chinese";
+
+    CuAssertStrEquals(tc, "[  NS] [NS  ] [007] [的展会]", format.expand(values).c_str());
+}
+
+
+/**
+ * Test that addresses are split into names and emails.
+ */
+void TestFormatAddress(CuTest * tc)
+{
+    std::string name;
+    std::string email;
+
+    CMessageFormat::split_address("Steve Kemp <steve@example.com>", name, email);
+    CuAssertStrEquals(tc, "Steve Kemp ", name.c_str());
+    CuAssertStrEquals(tc, "steve@example.com", email.c_str());
+
+    CMessageFormat::split_address("<steve@example.com>", name, email);
+    CuAssertStrEquals(tc, "<steve@example.com>", name.c_str());
+    CuAssertStrEquals(tc, "steve@example.com", email.c_str());
+
+    CMessageFormat::split_address("steve@example.com", name, email);
+    CuAssertStrEquals(tc, "steve@example.com", name.c_str());
+    CuAssertStrEquals(tc, "steve@example.com", email.c_str());
+}
+
+
+CuSuite *
+message_format_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestFormatFields);
+    SUITE_ADD_TEST(suite, TestFormatWidths);
+    SUITE_ADD_TEST(suite, TestFormatAddress);
+    return suite;
+}
@@ -32,11 +32,12 @@
 #include <unordered_map>
 #include <vector>
 
-#include "approxidate.h"
+#include "config.h"
 #include "file.h"
 #include "global_state.h"
 #include "lua.h"
 #include "message.h"
+#include "message_format.h"
 #include "message_part.h"
 #include "message_part_lua.h"
 
@@ -192,10 +193,10 @@ int l_CMessage_header(lua_State * l)
     /* Get the header. */
     const char *str = luaL_checkstring(l, 2);
     CLuaLog("l_CMessage_header(" + std::string(str) + ")");
-    std::string result = foo->header(str);
+    CStringView result = foo->header_view(str);
 
     /* set the retulr */
-    lua_pushstring(l, result.c_str());
+    lua_pushlstring(l, result.data(), result.size());
     return 1;
 
 }
@@ -263,6 +264,109 @@ int l_CMessage_mark_unread(lua_State *l)
 }
 
 
+/**
+ * Implementation for Message:attachment_count()
+ */
+int l_CMessage_attachment_count(lua_State *l)
+{
+    CLuaLog("l_CMessage_attachment_count");
+
+    std::shared_ptr<CMessage> foo = l_CheckCMessage(l, 1);
+
+    lua_pushinteger(l, foo->attachment_count());
+    return 1;
+}
+
+
+/**
+ * Implementation for Message:attachment_size()
+ */
+int l_CMessage_attachment_size(lua_State *l)
+{
+    CLuaLog("l_CMessage_attachment_size");
+
+    std::shared_ptr<CMessage> foo = l_CheckCMessage(l, 1);
+
+    lua_pushnumber(l, foo->attachment_size());
+    return 1;
+}
+
+
+/**
+ * Implementation for Message:is_signed()
+ */
+int l_CMessage_is_signed(lua_State *l)
+{
+    CLuaLog("l_CMessage_is_signed");
+
+    std::shared_ptr<CMessage> foo = l_CheckCMessage(l, 1);
+
+    lua_pushboolean(l, foo->is_signed() ? 1 : 0);
+    return 1;
+}
+
+
+/**
+ * Implementation for Message:is_encrypted()
+ */
+int l_CMessage_is_encrypted(lua_State *l)
+{
+    CLuaLog("l_CMessage_is_encrypted");
+
+    std::shared_ptr<CMessage> foo = l_CheckCMessage(l, 1);
+
+    lua_pushboolean(l, foo->is_encrypted() ? 1 : 0);
+    return 1;
+}
+
+
+/**
+ * Implementation for Message:has_gpg_output()
+ */
+int l_CMessage_has_gpg_output(lua_State *l)
+{
+    CLuaLog("l_CMessage_has_gpg_output");
+
+    std::shared_ptr<CMessage> foo = l_CheckCMessage(l, 1);
+
+    lua_pushboolean(l, foo->has_gpg_output() ? 1 : 0);
+    return 1;
+}
+
+
+/**
+ * Implementation for Message:format_native()
+ *
+ * Format the message via `index.format`, which is compiled the first
+ * time it is used, and whenever it changes.
+ */
+int l_CMessage_format_native(lua_State *l)
+{
+    CLuaLog("l_CMessage_format_native");
+
+    std::shared_ptr<CMessage> foo = l_CheckCMessage(l, 1);
+
+    const char *indent = lua_tostring(l, 2);
+    int number         = lua_tointeger(l, 3);
+
+    /*
+     * The compiled format-string.
+     */
+    static std::shared_ptr<CMessageFormat> compiled;
+
+    CConfig *config    = CConfig::instance();
+    std::string format = config->get_string("index.format", "[${4|flags}] ${2|message_flags} - ${20|sender} - ${indent}${subject}");
+
+    if ((! compiled) || (compiled->source() != format))
+        compiled = std::make_shared<CMessageFormat>(format);
+
+    std::string output = foo->format(*compiled, indent ? indent : "", number);
+
+    lua_pushstring(l, output.c_str());
+    return 1;
+}
+
+
 /**
  * Implementation for Message:mtime()
  */
@@ -356,31 +460,7 @@ int l_CMessage_ctime(lua_State * l)
 {
     std::shared_ptr<CMessage> foo = l_CheckCMessage(l, 1);
 
-    /*
-     * Look for `Delivery-Date`, then `Date`.  If neither
-     * is present we're screwed.
-     */
-    std::string rd = foo->header("Delivery-Date");
-
-    if (rd.empty())
-        rd = foo->header("Date");
-
-    if (rd.empty())
-    {
-        lua_pushnumber(l, 0);
-        return 1;
-    }
-
-    /*
-     * Convert the result to a date.
-     */
-    struct timeval t;
-
-    if (0 ==  approxidate(rd.c_str(), &t))
-        lua_pushnumber(l, t.tv_sec);
-    else
-        lua_pushnumber(l, 0);
-
+    lua_pushnumber(l, foo->get_ctime());
     return 1;
 }
 
@@ -491,11 +571,17 @@ void InitMessage(lua_State * l)
         {"__eq", l_CMessage_equality},
         {"__gc", l_CMessage_destructor},
         {"add_attachments", l_CMessage_add_attachments},
+        {"attachment_count", l_CMessage_attachment_count},
+        {"attachment_size", l_CMessage_attachment_size},
         {"ctime", l_CMessage_ctime},
         {"flags", l_CMessage_flags},
+        {"format_native", l_CMessage_format_native},
         {"generate_message_id", l_CMessage_generate_message_id},
+        {"has_gpg_output", l_CMessage_has_gpg_output},
         {"header", l_CMessage_header},
         {"headers", l_CMessage_headers},
+        {"is_encrypted", l_CMessage_is_encrypted},
+        {"is_signed", l_CMessage_is_signed},
         {"mark_read", l_CMessage_mark_read},
         {"mark_unread", l_CMessage_mark_unread},
         {"mtime", l_CMessage_mtime},
@@ -18,14 +18,40 @@
 
 
 #include <algorithm>
+#include <fcntl.h>
 #include <string>
+#include <string.h>
 #include <vector>
 #include <stdlib.h>
 
+#include "config.h"
+#include "mapped_message.h"
 #include "message_part.h"
 
 
 
+/*
+ * Should content of the given type, and charset, be converted to UTF-8?
+ */
+static bool convert_charset(const std::string &type, const std::string &charset)
+{
+    CConfig *config = CConfig::instance();
+
+    if (config->get_integer("global.iconv", 0) != 1)
+        return false;
+
+    /*
+     * We only convert content which is:
+     *
+     *   text/plain
+     *   not UTF-8 already.
+     */
+    return ((strcasecmp(type.c_str(), "text/plain") == 0) &&
+            (! charset.empty()) &&
+            (strcasecmp(charset.c_str(), "utf-8") != 0));
+}
+
+
 /*
  * Constructor.
  */
@@ -37,6 +63,7 @@ CMessagePart::CMessagePart(std::string type, std::string filename,
     m_filename       = filename;
     m_content        = NULL;
     m_content_length = 0;
+    m_loaded         = true;
 
     if ((content_length > 0) && (content != NULL))
     {
@@ -59,7 +86,7 @@ CMessagePart::~CMessagePart()
 {
     if (m_content != NULL)
     {
-        free(m_content);
+        g_free(m_content);
         m_content = NULL;
         m_content_length = 0;
     }
@@ -100,6 +127,7 @@ bool CMessagePart::is_attachment()
  */
 void * CMessagePart::content()
 {
+    load();
     return (m_content);
 }
 
@@ -108,10 +136,241 @@ void * CMessagePart::content()
  */
 size_t CMessagePart::content_size()
 {
+    load();
     return (m_content_length);
 }
 
 
+/*
+ * Get the length of the content, without decoding it.
+ */
+size_t CMessagePart::size_estimate()
+{
+    if (m_loaded)
+        return (m_content_length);
+
+    /*
+     * Base64 encodes three bytes as four, and the other encodings
+     * are near enough to the decoded size.
+     */
+    if (m_source.encoding == GMIME_CONTENT_ENCODING_BASE64)
+        return (m_source.length * 3 / 4);
+
+    return (m_source.length);
+}
+
+
+/*
+ * The memory this part, and its children, hold.
+ */
+size_t CMessagePart::memory()
+{
+    size_t total = sizeof(*this) + m_type.size() + m_filename.size() + m_content_length;
+
+    for (std::shared_ptr<CMessagePart> child : m_children)
+        total += child->memory();
+
+    return (total);
+}
+
+
+/*
+ * Record where our content may be found.
+ */
+void CMessagePart::set_source(const PART_SOURCE &source)
+{
+    if (m_content != NULL)
+        g_free(m_content);
+
+    m_content        = NULL;
+    m_content_length = 0;
+    m_source         = source;
+    m_loaded         = false;
+}
+
+
+/*
+ * Set the function called when content is decoded.
+ */
+void CMessagePart::on_load(std::function<void(size_t)> callback)
+{
+    m_on_load = callback;
+
+    for (std::shared_ptr<CMessagePart> child : m_children)
+        child->on_load(callback);
+}
+
+
+/*
+ * Map the message-file our content is found within, returning NULL if
+ * it is missing, or has been replaced since we recorded our location.
+ */
+static std::shared_ptr<CMappedMessage> open_source(const PART_SOURCE &source)
+{
+    std::shared_ptr<CMappedMessage> map = CMappedMessage::open(*source.file, true);
+
+    if (map && ((map->ino() != source.ino) ||
+                (map->size() != source.size) ||
+                (map->mtime() != source.mtime)))
+        return nullptr;
+
+    return (map);
+}
+
+
+/*
+ * Decode our content from the message-file.
+ */
+void CMessagePart::load()
+{
+    if (m_loaded)
+        return;
+
+    m_loaded = true;
+
+    std::shared_ptr<CMappedMessage> map = open_source(m_source);
+
+    if (! map)
+        return;
+
+    GMimeStream *raw = map->stream(m_source.offset, m_source.offset + m_source.length);
+    GMimeDataWrapper *wrapper = g_mime_data_wrapper_new_with_stream(raw, m_source.encoding);
+    GMimeStream *mem = g_mime_stream_mem_new();
+
+    g_mime_data_wrapper_write_to_stream(wrapper, mem);
+    take_stream(mem, m_type, m_source.charset, &m_content, &m_content_length);
+
+    /*
+     * We call a copy of the callback, as it might discard the cache
+     * entry which set it, and clear it.
+     */
+    if (m_on_load && (m_content_length > 0))
+    {
+        std::function<void(size_t)> callback = m_on_load;
+        callback(m_content_length);
+    }
+
+    g_object_unref(mem);
+    g_object_unref(wrapper);
+    g_object_unref(raw);
+}
+
+
+/*
+ * Write our content to the named file.
+ */
+bool CMessagePart::save(const std::string &path)
+{
+    int out = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+    if (out == -1)
+        return false;
+
+    GMimeStream *dest = g_mime_stream_fs_new(out);
+    bool ret = true;
+
+    if (m_loaded)
+    {
+        /*
+         * We already hold the content, so write it out.
+         */
+        if ((m_content_length > 0) &&
+                (g_mime_stream_write(dest, (const char *) m_content, m_content_length) != (gssize) m_content_length))
+            ret = false;
+    }
+    else
+    {
+        std::shared_ptr<CMappedMessage> map = open_source(m_source);
+
+        if (! map)
+        {
+            g_object_unref(dest);
+            return false;
+        }
+
+        /*
+         * Decode the content through a chain of filters, a block at a
+         * time, so the whole part is never held in memory.
+         */
+        GMimeStream *raw = map->stream(m_source.offset, m_source.offset + m_source.length);
+        GMimeDataWrapper *wrapper = g_mime_data_wrapper_new_with_stream(raw, m_source.encoding);
+        GMimeStream *filtered = g_mime_stream_filter_new(dest);
+
+        if (convert_charset(m_type, m_source.charset))
+        {
+            GMimeFilter *charset = g_mime_filter_charset_new(m_source.charset.c_str(), "UTF-8");
+
+            if (charset != NULL)
+            {
+                g_mime_stream_filter_add(GMIME_STREAM_FILTER(filtered), charset);
+                g_object_unref(charset);
+            }
+        }
+
+        if ((g_mime_data_wrapper_write_to_stream(wrapper, filtered) == -1) ||
+                (g_mime_stream_flush(filtered) == -1))
+            ret = false;
+
+        g_object_unref(filtered);
+        g_object_unref(wrapper);
+        g_object_unref(raw);
+    }
+
+    if (g_mime_stream_flush(dest) == -1)
+        ret = false;
+
+    g_object_unref(dest);
+    return ret;
+}
+
+
+/*
+ * Take ownership of the data in the given memory-stream.
+ */
+void CMessagePart::take_stream(GMimeStream *mem, const std::string &type, const std::string &charset,
+                               void **content, size_t *length)
+{
+    /*
+     * NOTE: by setting the owner to FALSE, it means unreffing the
+     * memory stream won't free the GByteArray data.
+     */
+    g_mime_stream_mem_set_owner(GMIME_STREAM_MEM(mem), FALSE);
+
+    GByteArray *res = g_mime_stream_mem_get_byte_array(GMIME_STREAM_MEM(mem));
+
+    size_t len  = res->len;
+    char *adata = (char *) g_byte_array_free(res, FALSE);
+
+    if (convert_charset(type, charset))
+    {
+        iconv_t cv = g_mime_iconv_open("UTF-8", charset.c_str());
+
+        if (cv != (iconv_t) - 1)
+        {
+            char *converted = g_mime_iconv_strndup(cv, (const char *) adata, len);
+            g_mime_iconv_close(cv);
+
+            if (converted != NULL)
+            {
+                g_free(adata);
+
+                len   = strlen(converted);
+                adata = converted;
+            }
+        }
+    }
+
+    if (len == 0)
+    {
+        g_free(adata);
+        adata = NULL;
+    }
+
+    *content = adata;
+    *length  = len;
+}
+
+
 /*
  * Get the children of this part, if any.
  */
@@ -19,9 +19,49 @@
 
 #pragma once
 
+#include <functional>
 #include <memory>
+#include <stdint.h>
 #include <string>
+#include <sys/types.h>
+#include <time.h>
 #include <vector>
+#include <gmime/gmime.h>
+
+
+/**
+ * The location of a MIME-part's (still encoded) content within the
+ * message-file, which allows it to be decoded only when requested.
+ */
+typedef struct _part_source
+{
+    /**
+     * The path to the message, which is shared with the CMessage so
+     * that it is updated if the message is renamed.
+     */
+    std::shared_ptr<std::string> file;
+
+    /**
+     * The inode, size, and modification-time of the file when the
+     * location was recorded, so that we don't decode whatever has
+     * been written in its place since.
+     */
+    ino_t  ino;
+    size_t size;
+    time_t mtime;
+
+    /**
+     * The offset, and length, of the content within the file.
+     */
+    int64_t offset;
+    int64_t length;
+
+    /**
+     * The Content-Transfer-Encoding, and charset, of the content.
+     */
+    GMimeContentEncoding encoding;
+    std::string charset;
+} PART_SOURCE;
 
 
 /**
@@ -34,6 +74,9 @@ public:
 
     /**
      * Constructor.
+     *
+     * We take ownership of `content`, which must have been allocated by
+     * GLib, as it is released with `g_free()`.
      */
     CMessagePart(std::string type, std::string filename, void *content, size_t content_length);
 
@@ -58,15 +101,54 @@ public:
     bool is_attachment();
 
     /**
-     * Get the content.
+     * Get the content, decoding it if this is the first request.
      */
     void *content();
 
     /**
-     * Get the length of the content.
+     * Get the length of the content, decoding it if required.
      */
     size_t content_size();
 
+    /**
+     * Get the length of the content, estimating it from the encoded
+     * length if it has not yet been decoded.
+     */
+    size_t size_estimate();
+
+    /**
+     * The number of bytes of memory this part, and its children, hold.
+     */
+    size_t memory();
+
+    /**
+     * Write our (decoded) content to the named file, returning false
+     * on error.
+     *
+     * If the content has not yet been decoded it is streamed from the
+     * message-file, rather than being read into memory.
+     */
+    bool save(const std::string &path);
+
+    /**
+     * Record where our content may be found, instead of holding it.
+     */
+    void set_source(const PART_SOURCE &source);
+
+    /**
+     * Set a function to be called with the number of bytes of content
+     * decoded, whenever this part, or one of its children, decodes its
+     * content.  Pass nullptr to remove it.
+     */
+    void on_load(std::function<void(size_t)> callback);
+
+    /**
+     * Take ownership of the data in the given memory-stream, converting
+     * `text/plain` content to UTF-8 if `global.iconv` is set.
+     */
+    static void take_stream(GMimeStream *mem, const std::string &type, const std::string &charset,
+                            void **content, size_t *length);
+
     /**
      * Get the children of this part, if any.
      */
@@ -88,6 +170,13 @@ public:
     std::shared_ptr<CMessagePart> get_parent();
 
 
+private:
+
+    /**
+     * Decode our content from the message-file, if we've not already.
+     */
+    void load();
+
 private:
 
     /**
@@ -111,6 +200,18 @@ private:
      */
     size_t m_content_length;
 
+    /**
+     * Has our content been decoded?  If not `m_source` says where
+     * it may be found.
+     */
+    bool m_loaded;
+    PART_SOURCE m_source;
+
+    /**
+     * Called when our content is decoded, if set.
+     */
+    std::function<void(size_t)> m_on_load;
+
     /**
      * Children of this part.
      */
@@ -201,6 +201,28 @@ int l_CMessagePart_parent(lua_State * l)
 }
 
 
+/**
+ * Implementation of MessagePart:save_to()
+ *
+ * Write the content of the part to the named file, returning true on
+ * success.
+ */
+int l_CMessagePart_save_to(lua_State * l)
+{
+    CLuaLog("l_CMessagePart_save_to");
+
+    std::shared_ptr<CMessagePart> foo = l_CheckCMessagePart(l, 1);
+    const char *path = luaL_checkstring(l, 2);
+
+    if (foo->save(path))
+        lua_pushboolean(l, 1);
+    else
+        lua_pushboolean(l, 0);
+
+    return 1;
+}
+
+
 /**
  * Implementation of MessagePart:size()
  */
@@ -284,6 +306,7 @@ void InitMessagePart(lua_State * l)
         {"filename", l_CMessagePart_filename},
         {"is_attachment", l_CMessagePart_is_attachment},
         {"parent", l_CMessagePart_parent},
+        {"save_to", l_CMessagePart_save_to},
         {"size", l_CMessagePart_size},
         {"type", l_CMessagePart_type},
         {"__gc", l_CMessagePart_destructor},
@@ -0,0 +1,243 @@
+/*
+ * message_sort.cc - Sort messages natively.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <ctype.h>
+#include <stdlib.h>
+
+#include "message.h"
+#include "message_sort.h"
+#include "thread_pool.h"
+
+
+/*
+ * Create an object to sort by the named method.
+ */
+std::shared_ptr<CMessageSort> CMessageSort::create(const std::string &method,
+        const std::vector<std::shared_ptr<CMessage> > &messages)
+{
+    if ((method == "date") || (method == "file"))
+    {
+        std::vector<int64_t> keys;
+        keys.reserve(messages.size());
+
+        for (std::shared_ptr<CMessage> msg : messages)
+        {
+            if (method == "date")
+                keys.push_back(msg->sort_date());
+            else
+                keys.push_back(msg->get_mtime());
+        }
+
+        return std::make_shared<CMessageSort>(keys);
+    }
+
+    if ((method == "from") || (method == "subject"))
+    {
+        std::vector<std::string> keys;
+        keys.reserve(messages.size());
+
+        for (std::shared_ptr<CMessage> msg : messages)
+        {
+            if (method == "from")
+                keys.push_back(msg->sort_from());
+            else
+                keys.push_back(msg->sort_subject());
+        }
+
+        return std::make_shared<CMessageSort>(keys);
+    }
+
+    return nullptr;
+}
+
+
+/*
+ * Sort by the given numeric keys.
+ */
+CMessageSort::CMessageSort(const std::vector<int64_t> &numbers) : m_numbers(numbers)
+{
+}
+
+
+/*
+ * Sort by the given string keys.
+ */
+CMessageSort::CMessageSort(const std::vector<std::string> &strings) : m_strings(strings)
+{
+}
+
+
+/*
+ * Compare two messages, by offset.
+ */
+bool CMessageSort::operator()(size_t a, size_t b) const
+{
+    if (!m_numbers.empty())
+        return (m_numbers[a] < m_numbers[b]);
+
+    return (m_strings[a] < m_strings[b]);
+}
+
+
+/*
+ * Return the offsets of our messages, in sorted order.
+ */
+std::vector<size_t> CMessageSort::sorted(int threads) const
+{
+    size_t count = m_numbers.empty() ? m_strings.size() : m_numbers.size();
+
+    std::vector<size_t> offsets(count);
+
+    for (size_t i = 0; i < count; i++)
+        offsets[i] = i;
+
+    /*
+     * NOTE: We compare via `this`, so that our keys aren't copied
+     * along with the comparison function.
+     */
+    auto compare = [this](size_t a, size_t b)
+    {
+        return (*this)(a, b);
+    };
+
+    /*
+     * Not worth splitting?
+     */
+    if ((threads < 2) || (count < (size_t)threads * 2))
+    {
+        std::stable_sort(offsets.begin(), offsets.end(), compare);
+        return (offsets);
+    }
+
+    /*
+     * Sort each run concurrently.
+     */
+    std::vector<size_t> bounds;
+
+    for (int i = 0; i <= threads; i++)
+        bounds.push_back(count * i / threads);
+
+    CThreadPool pool(threads);
+
+    for (size_t i = 0; i + 1 < bounds.size(); i++)
+    {
+        auto start = offsets.begin() + bounds[i];
+        auto end   = offsets.begin() + bounds[i + 1];
+
+        pool.add([start, end, &compare]()
+        {
+            std::stable_sort(start, end, compare);
+        });
+    }
+
+    pool.wait();
+
+    /*
+     * Now merge neighbouring runs, until only one remains.
+     *
+     * std::merge takes equal elements from the first range before the
+     * second, so ties keep their original order.
+     */
+    std::vector<size_t> buffer(count);
+    std::vector<size_t> *src = &offsets;
+    std::vector<size_t> *dst = &buffer;
+
+    while (bounds.size() > 2)
+    {
+        std::vector<size_t> merged;
+
+        for (size_t i = 0; i + 1 < bounds.size(); i += 2)
+        {
+            merged.push_back(bounds[i]);
+
+            auto out   = dst->begin() + bounds[i];
+            auto start = src->begin() + bounds[i];
+            auto mid   = src->begin() + bounds[i + 1];
+
+            /*
+             * An odd run out is copied as-is.
+             */
+            if (i + 2 >= bounds.size())
+            {
+                std::copy(start, mid, out);
+                continue;
+            }
+
+            auto end = src->begin() + bounds[i + 2];
+
+            pool.add([start, mid, end, out, &compare]()
+            {
+                std::merge(start, mid, mid, end, out, compare);
+            });
+        }
+
+        merged.push_back(count);
+        pool.wait();
+
+        bounds = merged;
+        std::swap(src, dst);
+    }
+
+    return (*src);
+}
+
+
+/*
+ * Normalise a From: header.
+ */
+std::string CMessageSort::normalise_from(const std::string &from)
+{
+    std::string result;
+    result.reserve(from.size());
+
+    for (char c : from)
+    {
+        if (c != '"')
+            result += tolower(c);
+    }
+
+    size_t start = result.find_first_not_of(" \t\r\n");
+
+    if (start == std::string::npos)
+        return "";
+
+    size_t end = result.find_last_not_of(" \t\r\n");
+    return (result.substr(start, end - start + 1));
+}
+
+
+/*
+ * Return the delivery-time from the name of a maildir file.
+ */
+int64_t CMessageSort::filename_date(const std::string &path)
+{
+    size_t start = path.rfind('/');
+    start = (start == std::string::npos) ? 0 : start + 1;
+
+    size_t end = start;
+
+    while ((end < path.size()) && isdigit(path[end]))
+        end++;
+
+    if ((end == start) || (end >= path.size()) || (path[end] != '.'))
+        return -1;
+
+    return (strtoll(path.substr(start, end - start).c_str(), NULL, 10));
+}
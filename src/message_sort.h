@@ -0,0 +1,95 @@
+/*
+ * message_sort.h - Sort messages natively.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+class CMessage;
+
+
+
+/**
+ * This class sorts messages by one of the built-in methods - `date`,
+ * `file`, `from` or `subject` - without calling into Lua.
+ *
+ * The key of each message is found once, when the object is created,
+ * and the messages are then compared by offset using those keys.
+ */
+class CMessageSort
+{
+public:
+
+    /**
+     * Create an object to sort the given messages via the named method,
+     * returning nullptr if that isn't one we implement.
+     */
+    static std::shared_ptr<CMessageSort> create(const std::string &method,
+            const std::vector<std::shared_ptr<CMessage> > &messages);
+
+    /**
+     * Sort by the given numeric keys.
+     */
+    CMessageSort(const std::vector<int64_t> &numbers);
+
+    /**
+     * Sort by the given string keys.
+     */
+    CMessageSort(const std::vector<std::string> &strings);
+
+    /**
+     * Should the message at offset `a` be displayed before that at `b`?
+     */
+    bool operator()(size_t a, size_t b) const;
+
+    /**
+     * Return the offsets of our messages, in sorted order.
+     *
+     * Messages with equal keys remain in their original order.
+     *
+     * If `threads` is greater than one then the messages are split
+     * into that many runs, which are sorted concurrently and then merged
+     * in pairs; the result is identical to sorting in a single thread.
+     */
+    std::vector<size_t> sorted(int threads = 1) const;
+
+    /**
+     * Return the given From: header, lower-cased, without quotes, and
+     * without surrounding whitespace.
+     */
+    static std::string normalise_from(const std::string &from);
+
+    /**
+     * Return the delivery-time recorded at the start of the name of the
+     * given maildir file, or -1 if there is none.
+     */
+    static int64_t filename_date(const std::string &path);
+
+private:
+
+    /**
+     * The keys of our messages, only one of which is populated.
+     */
+    std::vector<int64_t> m_numbers;
+    std::vector<std::string> m_strings;
+};
@@ -0,0 +1,180 @@
+/*
+ * message_sort_test.cc - Test-cases for our CMessageSort class.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "message_sort.h"
+#include "CuTest.h"
+
+
+/**
+ * Test that From: headers are normalised.
+ */
+void TestMessageSortFrom(CuTest * tc)
+{
+    const char *input[][2] =
+    {
+        {"Steve Kemp <steve@example.com>", "steve kemp <steve@example.com>"},
+        {"\"Kemp, Steve\" <steve@example.com>", "kemp, steve <steve@example.com>"},
+        {"  <STEVE@example.com>\t", "<steve@example.com>"},
+        {"\"\"", ""},
+        {"", ""},
+    };
+
+    for (size_t i = 0; i < sizeof(input) / sizeof(input[0]); i++)
+    {
+        std::string result = CMessageSort::normalise_from(input[i][0]);
+        CuAssertStrEquals(tc, input[i][1], result.c_str());
+    }
+}
+
+
+/**
+ * Test that delivery-times are found from maildir filenames.
+ */
+void TestMessageSortFilename(CuTest * tc)
+{
+    CuAssertTrue(tc, CMessageSort::filename_date("/x/cur/1234.host:2,S") == 1234);
+    CuAssertTrue(tc, CMessageSort::filename_date("1449066736.M1P2.host") == 1449066736);
+    CuAssertTrue(tc, CMessageSort::filename_date("/x/new/abc.host") == -1);
+    CuAssertTrue(tc, CMessageSort::filename_date("/x/new/1234") == -1);
+    CuAssertTrue(tc, CMessageSort::filename_date("/x/1234.y/cur/name") == -1);
+    CuAssertTrue(tc, CMessageSort::filename_date("") == -1);
+}
+
+
+/**
+ * Test sorting by numeric keys, with ties kept in their original order.
+ */
+void TestMessageSortNumbers(CuTest * tc)
+{
+    std::vector<int64_t> keys;
+    keys.push_back(30);
+    keys.push_back(10);
+    keys.push_back(20);
+    keys.push_back(10);
+    keys.push_back(-1);
+
+    CMessageSort sort(keys);
+
+    size_t expected[] = { 4, 1, 3, 2, 0 };
+    std::vector<size_t> result = sort.sorted();
+
+    CuAssertIntEquals(tc, 5, result.size());
+
+    for (size_t i = 0; i < result.size(); i++)
+        CuAssertIntEquals(tc, expected[i], result[i]);
+
+    CuAssertTrue(tc, sort(1, 0));
+    CuAssertTrue(tc, !sort(1, 3));
+    CuAssertTrue(tc, !sort(3, 1));
+}
+
+
+/**
+ * Test sorting by string keys, with ties kept in their original order.
+ */
+void TestMessageSortStrings(CuTest * tc)
+{
+    std::vector<std::string> keys;
+    keys.push_back("hello");
+    keys.push_back("bob");
+    keys.push_back("hello");
+    keys.push_back("");
+    keys.push_back("alice");
+
+    CMessageSort sort(keys);
+
+    size_t expected[] = { 3, 4, 1, 0, 2 };
+    std::vector<size_t> result = sort.sorted();
+
+    CuAssertIntEquals(tc, 5, result.size());
+
+    for (size_t i = 0; i < result.size(); i++)
+        CuAssertIntEquals(tc, expected[i], result[i]);
+
+    /*
+     * Nothing to sort.
+     */
+    CMessageSort empty((std::vector<std::string>()));
+    CuAssertIntEquals(tc, 0, empty.sorted().size());
+}
+
+
+/**
+ * Test that sorting in parallel matches sorting in a single thread.
+ */
+void TestMessageSortParallel(CuTest * tc)
+{
+    srand(42);
+
+    /*
+     * Few distinct keys, so that there are many ties.
+     */
+    std::vector<int64_t> numbers;
+    std::vector<std::string> strings;
+
+    for (int i = 0; i < 10007; i++)
+    {
+        numbers.push_back(rand() % 50);
+        strings.push_back(std::string(1, 'a' + (rand() % 26)));
+    }
+
+    CMessageSort by_number(numbers);
+    CMessageSort by_string(strings);
+
+    std::vector<size_t> number_expected = by_number.sorted();
+    std::vector<size_t> string_expected = by_string.sorted();
+
+    for (int threads = 2; threads <= 7; threads++)
+    {
+        CuAssertTrue(tc, by_number.sorted(threads) == number_expected);
+        CuAssertTrue(tc, by_string.sorted(threads) == string_expected);
+    }
+
+    /*
+     * Too few messages to split.
+     */
+    std::vector<int64_t> few;
+    few.push_back(2);
+    few.push_back(1);
+    few.push_back(2);
+
+    std::vector<size_t> result = CMessageSort(few).sorted(4);
+
+    CuAssertIntEquals(tc, 3, result.size());
+    CuAssertIntEquals(tc, 1, result[0]);
+    CuAssertIntEquals(tc, 0, result[1]);
+    CuAssertIntEquals(tc, 2, result[2]);
+}
+
+
+CuSuite *
+message_sort_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMessageSortFrom);
+    SUITE_ADD_TEST(suite, TestMessageSortFilename);
+    SUITE_ADD_TEST(suite, TestMessageSortNumbers);
+    SUITE_ADD_TEST(suite, TestMessageSortStrings);
+    SUITE_ADD_TEST(suite, TestMessageSortParallel);
+    return suite;
+}
@@ -19,6 +19,7 @@
 #include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <poll.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
@@ -28,6 +29,7 @@
 #include "config.h"
 #include "colour_string.h"
 #include "history.h"
+#include "imap_proxy.h"
 #include "index_view.h"
 #include "input_queue.h"
 #include "keybinding_view.h"
@@ -40,6 +42,14 @@
 #include "statuspanel.h"
 
 
+/*
+ * The contents of a row which we've drawn, but cannot compare.
+ *
+ * Rows drawn by `draw_single_line` always contain some settings before
+ * the newline, so they will never match this.
+ */
+static const std::string UNKNOWN_ROW = "\n";
+
 
 /*
  * Constructor.
@@ -104,6 +114,16 @@ void CScreen::update(std::string key_name, CConfigEntry *old)
         timeout(value);
     }
 
+    /*
+     * If a colour has changed then rows which contain it must be
+     * redrawn.
+     */
+    if (key_name.substr(0, 7) == "colour.")
+    {
+        m_attrs.clear();
+        invalidate();
+    }
+
     if (key_name == "global.mode")
     {
         /*
@@ -155,21 +175,24 @@ void CScreen::run_main_loop()
     std::string total;
 
 
-    /*
-     * Input handler.
-     */
-    CInputQueue *input = CInputQueue::instance();
-
     /*
      * Get a single character.
      */
-    while ((m_running) && (ch = input->get_input()))
+    while ((m_running) && (ch = get_input()))
     {
+        /*
+         * Start a new frame.  Rows which are drawn just as they were in
+         * the previous frame are skipped, so the screen is only cleared
+         * if something else has drawn upon it.
+         */
+        bool redraw = begin_frame();
 
         /*
-         * Clear the screen.
+         * Handle the results of any IMAP commands which have completed
+         * in the background.
          */
-        clear(false);
+        CIMAPProxy::instance()->run_completions();
+
 
 
         /*
@@ -261,19 +284,25 @@ void CScreen::run_main_loop()
             view->draw();
 
         /*
-         * Update our panel
+         * Update our panel, if the screen was cleared.  Otherwise it
+         * redraws itself when its contents change.
          */
         CStatusPanel *instance = CStatusPanel::instance();
 
-        if (! instance->hidden())
+        if (redraw && ! instance->hidden())
             instance->draw();
 
         /*
-         * Update our panel.
+         * Update the terminal, unless nothing has changed.
          */
-        update_panels();
-        doupdate();
-        refresh();
+        bool changed = end_frame();
+
+        if (changed || instance->modified())
+        {
+            update_panels();
+            doupdate();
+            refresh();
+        }
     }
 }
 
@@ -375,6 +404,61 @@ bool CScreen::is_prefixed_key(const char *key)
     return false;
 }
 
+/*
+ * Get the next character of input, or ERR on timeout.
+ */
+int CScreen::get_input()
+{
+    CInputQueue *input = CInputQueue::instance();
+
+    /*
+     * If there are no asynchronous commands, or there is queued input,
+     * we just wait for the keyboard.
+     */
+    int fd = CIMAPProxy::instance()->completion_fd();
+
+    if ((fd < 0) || input->has_pending_input())
+        return (input->get_input());
+
+    /*
+     * Otherwise wait for the keyboard, or a completion, whichever
+     * comes first.
+     */
+    CConfig *config = CConfig::instance();
+    int tout = config->get_integer("global.timeout", 500);
+
+    /*
+     * Curses might already have read keys which we've not yet received,
+     * such as typeahead or the rest of an escape-sequence, and those
+     * won't make STDIN readable - so we look for them first.
+     */
+    timeout(0);
+    int ch = input->get_input();
+    timeout(tout);
+
+    if (ch != ERR)
+        return (ch);
+
+    struct pollfd fds[2];
+    fds[0].fd     = STDIN_FILENO;
+    fds[0].events = POLLIN;
+    fds[1].fd     = fd;
+    fds[1].events = POLLIN;
+
+    if ((poll(fds, 2, tout) > 0) && !(fds[0].revents & POLLIN) && (fds[1].revents & POLLIN))
+        return ERR;
+
+    /*
+     * We've already waited, so don't let curses wait again.
+     */
+    timeout(0);
+    ch = input->get_input();
+    timeout(tout);
+
+    return (ch);
+}
+
+
 /*
  * Exit our main event-loop
  */
@@ -406,6 +490,8 @@ void CScreen::execute(std::string prog)
      */
     reset_prog_mode();
     refresh();
+
+    invalidate();
 }
 
 /*
@@ -496,6 +582,8 @@ void CScreen::setup()
     init_pair(8, COLOR_BLACK, COLOR_WHITE);
     m_colours[ "black" ] = 8;
 
+    m_attrs.clear();
+
     CStatusPanel *panel = CStatusPanel::instance();
     panel->init(6);
 }
@@ -547,6 +635,15 @@ void CScreen::clear(bool refresh_screen)
         mvprintw(i, 0, "%s", blank.c_str());
     }
 
+    /*
+     * The screen is now blank.
+     */
+    m_rows.assign(CScreen::height(), "");
+    m_drawn.assign(m_rows.size(), false);
+    m_width   = width;
+    m_damaged = false;
+    m_changed = true;
+
     if (refresh_screen)
     {
         update_panels();
@@ -556,6 +653,78 @@ void CScreen::clear(bool refresh_screen)
 }
 
 
+/*
+ * Forget what we drew in the previous frame.
+ */
+void CScreen::invalidate()
+{
+    m_damaged = true;
+}
+
+
+/*
+ * Start drawing a new frame.
+ */
+bool CScreen::begin_frame()
+{
+    m_changed = false;
+
+    if (m_damaged || ((int)m_rows.size() != CScreen::height()) || (m_width != CScreen::width()))
+    {
+        clear(false);
+        return true;
+    }
+
+    m_drawn.assign(m_rows.size(), false);
+    return false;
+}
+
+
+/*
+ * Finish drawing a frame.
+ */
+bool CScreen::end_frame()
+{
+    /*
+     * If something else drew upon the screen during this frame we
+     * don't know what is left, so blank every row we didn't draw.
+     */
+    bool all = m_damaged;
+
+    wattrset(stdscr, get_colour("white|normal"));
+
+    for (size_t row = 0; row < m_rows.size() && row < m_drawn.size(); row++)
+    {
+        if (m_drawn[row] || (m_rows[row].empty() && ! all))
+            continue;
+
+        wmove(stdscr, row, 0);
+        wclrtoeol(stdscr);
+
+        m_rows[row] = "";
+        m_changed   = true;
+    }
+
+    m_damaged = false;
+    return (m_changed);
+}
+
+
+/*
+ * Record that the given rows have been drawn, in an unknown fashion.
+ */
+void CScreen::touch_rows(int first, int last)
+{
+    for (int row = std::max(first, 0); row <= last && row < (int)m_rows.size(); row++)
+    {
+        m_rows[row]  = UNKNOWN_ROW;
+        m_drawn[row] = true;
+    }
+
+    m_changed = true;
+}
+
+
 /*
  * Redraw the screen, via the currently active mode.
  */
@@ -756,6 +925,7 @@ std::string CScreen::choose_string(std::vector<std::string> choices)
         {
             delwin(childwin);
             ::clear();
+            invalidate();
             /*
              * Get our timeout period, and set it.
              */
@@ -831,6 +1001,7 @@ std::string CScreen::choose_string(std::vector<std::string> choices)
 
     delwin(childwin);
     ::clear();
+    invalidate();
 
     return (choices.at(matches.at(selected)));
 }
@@ -843,6 +1014,10 @@ std::string CScreen::get_line(std::string prompt, std::string input)
 {
     std::string buffer;
 
+    /*
+     * Our prompt is drawn over the screen.
+     */
+    invalidate();
 
     int old_curs = curs_set(1);
     int pos = 0;
@@ -1083,6 +1258,11 @@ std::string CScreen::prompt_chars(std::string prompt, std::string valid)
     int orig_x, x;
     int orig_y, y;
 
+    /*
+     * Our prompt is drawn over the screen.
+     */
+    invalidate();
+
     /*
      * Get the cursor position
      */
@@ -1182,6 +1362,11 @@ std::string CScreen::get_char(std::string prompt)
     int orig_x, x;
     int orig_y, y;
 
+    /*
+     * Our prompt is drawn over the screen.
+     */
+    invalidate();
+
     /*
      * Get the cursor position
      */
@@ -1314,7 +1499,34 @@ bool CScreen::on_keypress(std::string key)
 }
 
 
+/*
+ * Get the colour-pair, and attributes, for the given name.
+ */
 int CScreen::get_colour(std::string name)
+{
+    return (colour_attr(CColourString::intern(name)));
+}
+
+
+/*
+ * Get the colour-pair, and attributes, for the given handle.
+ */
+int CScreen::colour_attr(size_t handle)
+{
+    if (handle >= m_attrs.size())
+        m_attrs.resize(handle + 1, -1);
+
+    if (m_attrs[handle] == -1)
+        m_attrs[handle] = compile_colour(CColourString::name(handle));
+
+    return (m_attrs[handle]);
+}
+
+
+/*
+ * Compile a colour-name into a colour-pair, and attributes.
+ */
+int CScreen::compile_colour(std::string name)
 {
     std::transform(name.begin(), name.end(), name.begin(), ::tolower);
 
@@ -1390,6 +1602,94 @@ int CScreen::get_colour(std::string name)
 
 
 
+/*
+ * Find the range of lines which will be visible on the screen.
+ */
+void CScreen::viewport(int selected, int max, bool simple, int &first, int &rows)
+{
+    /*
+     * Get the height of the screen, taking off the panel, if visible.
+     */
+    int height = CScreen::height();
+
+    CStatusPanel *panel = CStatusPanel::instance();
+
+    if (panel->hidden() == false)
+        height -= panel->height();
+
+    /*
+     * Add an extra line.
+     */
+    height += 1;
+
+    /*
+     * We draw rows [0, height].
+     */
+    rows = height + 1;
+
+    /*
+     * In simple-mode the selected line is the first one drawn.
+     */
+    if (simple)
+    {
+        first = selected;
+        return;
+    }
+
+    /*
+     * This is complex/smooth-scrolling mode.
+     *
+     * We'll draw a highlighted bar, and that'll move "nicely".
+     */
+    int middle = (height) / 2;
+    vectorPosition topBottomOrMiddle = NONE;
+
+    /*
+     * default to TOP if our list is shorter then the screen height
+     */
+    if (selected < middle || max <= height)
+    {
+        topBottomOrMiddle = TOP;
+
+        /*
+         * if height is uneven we have to switch to the BOTTOM case on row earlier
+         */
+    }
+    else if ((max - selected <= middle) || (height % 2 == 1 && max - selected <= middle + 1))
+    {
+        topBottomOrMiddle = BOTTOM;
+    }
+    else
+    {
+        topBottomOrMiddle = MIDDLE;
+    }
+
+    if (topBottomOrMiddle == BOTTOM)
+    {
+        /*
+         * when we reached the end of the list the last row shows
+         * item max-1, since:
+         * row:=height-2 -> max-height+row+1 = max-height+height-2+1 = max-1
+         */
+        first = max - height + 1;
+    }
+    else if (topBottomOrMiddle == MIDDLE)
+    {
+        /*
+         * The selected item is in the middle row.
+         */
+        first = selected - middle;
+    }
+    else
+    {
+        /*
+         * we start at the top of the list.
+         */
+        first = 0;
+    }
+}
+
+
 /*
  * Draw an array of lines to the screen, highlighting the current line.
  *
@@ -1398,14 +1698,12 @@ int CScreen::get_colour(std::string name)
  * If `simple` is set to true then we display the lines in a  simplified
  * fashion - with no selection, and no smooth-scrolling.
  *
+ * `lines` holds the lines starting from `offset`, which will be zero
+ * unless the view only generated its visible lines.
  */
-void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int max, bool simple)
+void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int max, bool simple, int offset)
 {
-    /*
-     * Get the dimensions of the screen.
-     */
     CScreen *screen = CScreen::instance();
-    int height      = CScreen::height();
     int width       = CScreen::width();
 
     /*
@@ -1415,17 +1713,16 @@ void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int
     int wrap = config->get_integer("line.wrap", 0);
 
     /*
-     * Take off the panel, if visible.
+     * Find the first line to draw, and the number of rows to draw.
      */
-    CStatusPanel *panel = CStatusPanel::instance();
-
-    if (panel->hidden() == false)
-        height -= panel->height();
+    int first;
+    int rows;
+    viewport(selected, max, simple, first, rows);
 
     /*
-     * Add an extra line.
+     * The number of lines we have.
      */
-    height += 1;
+    int size = lines.size();
 
     /*
      * If we're in simple-mode we can just draw the lines directly
@@ -1434,11 +1731,6 @@ void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int
      */
     if (simple)
     {
-        /*
-         * The number of lines to draw.
-         */
-        int size = lines.size();
-
         /*
          * The width of each line drawn.
          */
@@ -1446,7 +1738,7 @@ void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int
 
         int off = 0;
 
-        for (int i = 0; i <= height; i++)
+        for (int i = 0; i < rows; i++)
         {
             std::string buf = "";
 
@@ -1454,8 +1746,10 @@ void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int
              * If we're still in the array of lines to draw
              * then pick the right one.
              */
-            if ((off + selected) < size)
-                buf = lines.at(off + selected);
+            int index = off + first - offset;
+
+            if ((index >= 0) && (index < size))
+                buf = lines.at(index);
 
             /*
              * Last two parameters are:
@@ -1486,73 +1780,22 @@ void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int
 
 
     /*
-     * This is complex/smooth-scrolling mode.
-     *
-     * We'll draw a highlighted bar, and that'll move "nicely".
-     */
-    int middle = (height) / 2;
-    int rowToHighlight = 0;
-    vectorPosition topBottomOrMiddle = NONE;
-
-    /*
-     * default to TOP if our list is shorter then the screen height
+     * The row containing the selected item.
      */
-    if (selected < middle || max <= height)
-    {
-        topBottomOrMiddle = TOP;
-        rowToHighlight = selected;
-
-        /*
-         * if height is uneven we have to switch to the BOTTOM case on row earlier
-         */
-    }
-    else if ((max - selected <= middle) || (height % 2 == 1 && max - selected <= middle + 1))
-    {
-        topBottomOrMiddle = BOTTOM;
-        rowToHighlight =  height - max + selected - 1 ;
-    }
-    else
-    {
-        topBottomOrMiddle = MIDDLE;
-        rowToHighlight = middle;
-    }
+    int rowToHighlight = selected - first;
 
-
-    for (int row = 0; row <= height; row++)
+    for (int row = 0; row < rows; row++)
     {
         /*
          * The current object.
          */
-        int mailIndex = max;
-        int size      = lines.size();
-
-
-        if (topBottomOrMiddle == TOP)
-        {
-            /*
-             * we start at the top of the list so just use row
-             */
-            mailIndex = row;
-        }
-        else if (topBottomOrMiddle == BOTTOM)
-        {
-            /*
-             * when we reached the end of the list mailIndex can maximally be
-             * count-1, that this is given can easily be shown
-             * row:=height-2 -> count-height+row+1 = count-height+height-2+1 = count-1
-             */
-            mailIndex = max - height + row + 1;
-        }
-        else if (topBottomOrMiddle == MIDDLE)
-        {
-            mailIndex = row + selected - middle;
-        }
-
+        int mailIndex = first + row;
+        int index     = mailIndex - offset;
 
         std::string buf;
 
-        if ((mailIndex < max) && (mailIndex < size))
-            buf = lines.at(mailIndex);
+        if ((mailIndex < max) && (index >= 0) && (index < size))
+            buf = lines.at(index);
 
         if (buf.empty())
             continue;
@@ -1562,12 +1805,6 @@ void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int
         else
             wattrset(stdscr, A_NORMAL);
 
-        /*
-         * Last two parameters are:
-         *
-         *  enable scroll: true
-         *  enable wrap: false
-         */
         int result __attribute__((unused));
 
         /*
@@ -1621,6 +1858,11 @@ int CScreen::draw_single_line(int row, int col_offset, std::string buf, WINDOW *
      */
     int def_col = getattrs(stdscr);
 
+    /*
+     * The colour we reset to, once we're done.
+     */
+    static const size_t normal = CColourString::intern("white|normal");
+
     /*
      * Get the horizontal scroll offset.
      */
@@ -1649,17 +1891,45 @@ int CScreen::draw_single_line(int row, int col_offset, std::string buf, WINDOW *
         horiz = 0;
 
     /*
-     * Split the string into segments in ONE CHARACTER pieces.
-     *
-     * These single characters may well consist of multiple bytes, but
-     * that is not important.
+     * Rows of the main screen which would be drawn exactly as they were
+     * in the previous frame needn't be drawn again.
+     */
+    bool tracked = (screen == stdscr) && (row >= 0) && (row < (int)m_rows.size());
+    std::string key;
+
+    if (tracked)
+    {
+        key = std::to_string(def_col) + " " + std::to_string(horiz) + " " +
+              std::to_string(tab_width) + " " + std::to_string(col_offset) +
+              "\n" + buf;
+
+        m_drawn[row] = true;
+
+        if ((! m_damaged) && (m_rows[row] == key))
+        {
+            wattrset(screen, colour_attr(normal));
+            return (getmaxx(screen) - col_offset);
+        }
+    }
+
+    m_changed = true;
+
+    /*
+     * Split the string into runs of text which share a colour.
+     */
+    CColourString parsed(buf, horiz, tab_width);
+    const std::string &text = parsed.text();
+
+    /*
+     * The width of the window, used to clip the text when we're not
+     * wrapping.
      */
-    std::vector<COLOUR_STRING *> parts = CColourString::parse_coloured_string(buf, horiz, tab_width);
+    int width = getmaxx(screen);
 
     /*
-     * Draw each piece of the string.
+     * Draw each span of the string.
      */
-    for (auto it = parts.begin(); it != parts.end() ; ++it)
+    for (auto it = parsed.spans().begin(); it != parsed.spans().end() ; ++it)
     {
         /*
          * If we've drawn more characters than the width
@@ -1669,23 +1939,29 @@ int CScreen::draw_single_line(int row, int col_offset, std::string buf, WINDOW *
         getyx(screen, y, x);
 
         if ((y != row) && ! enable_wrap)
-            continue;
+            break;
+
+        size_t length = it->length;
+        size_t glyphs = it->glyphs;
 
         /*
-         * Get the text/colour.
+         * Clip by the columns the text occupies, rather than the number
+         * of characters, as wide characters take two.
          */
-        COLOUR_STRING *i = (*it);
-        std::string *colour = i->colour;
-        std::string *text   = i->string;
+        if (! enable_wrap)
+        {
+            size_t room = (x < width) ? (width - x) : 0;
+            length = parsed.fit(*it, room, glyphs);
+        }
 
         /*
-         * Set the colour + draw the component.
+         * Set the colour + draw the span.
          */
         wattrset(screen, def_col);
-        wattron(screen, get_colour(*colour));
-        waddstr(screen, (char *)(*text).c_str());
+        wattron(screen, colour_attr(it->colour));
+        waddnstr(screen, text.data() + it->offset, length);
 
-        count += 1;
+        count += glyphs;
     }
 
 
@@ -1701,6 +1977,12 @@ int CScreen::draw_single_line(int row, int col_offset, std::string buf, WINDOW *
     getyx(screen, y, x);
     bool moved = true;
 
+    /*
+     * The last row our text occupies - if we've exactly filled the row
+     * then the cursor has already moved to the next one.
+     */
+    int last = ((x == 0) && (y > row)) ? (y - 1) : y;
+
     /*
      * Until the row has changed we draw " ", ensuring that
      * we fill the line.
@@ -1735,22 +2017,31 @@ int CScreen::draw_single_line(int row, int col_offset, std::string buf, WINDOW *
             moved = false;
     }
 
-
     /*
-     * Reset to our default colour.
+     * Remember what we drew.  If the text wrapped onto the following
+     * rows we clear the remainder of the last one, and don't attempt
+     * to skip any of them in the future.
      */
-    wattrset(screen, get_colour("white|normal"));
+    if (tracked)
+    {
+        if (last == row)
+        {
+            m_rows[row] = key;
+        }
+        else
+        {
+            if (x > 0)
+                wclrtoeol(screen);
+
+            touch_rows(row, last);
+        }
+    }
+
 
     /*
-     * Finally free the tokenized string-bits.
+     * Reset to our default colour.
      */
-    for (auto it = parts.begin(); it != parts.end() ; ++it)
-    {
-        COLOUR_STRING *i = (*it);
-        delete(i->string);
-        delete(i->colour);
-        free(i);
-    }
+    wattrset(screen, colour_attr(normal));
 
     return (count);
 }
@@ -1769,11 +2060,10 @@ void CScreen::draw_text(int x, int y, std::string str, bool update)
     int def_col = getattrs(stdscr);
 
     /*
-     * Parse the string.  We don't need it in chunks,
-     * but we do need it in coloured fashion.
+     * Parse the string into coloured spans.
      */
-    std::vector<COLOUR_STRING *> parts;
-    parts = CColourString::parse_coloured_string(str, 0, tab_width);
+    CColourString parsed(str, 0, tab_width);
+    const std::string &text = parsed.text();
 
     /*
      * Move to the starting offset.
@@ -1781,40 +2071,29 @@ void CScreen::draw_text(int x, int y, std::string str, bool update)
     wmove(stdscr, y, x);
 
     /*
-     * Draw the part(s).
+     * Draw the span(s).
      */
-    for (auto it = parts.begin(); it != parts.end() ; ++it)
+    for (auto it = parsed.spans().begin(); it != parsed.spans().end() ; ++it)
     {
-        /*
-         * Get the text/colour.
-         */
-        COLOUR_STRING *i = (*it);
-        std::string *colour = i->colour;
-        std::string *text   = i->string;
-
         /*
          * Set the colour + draw the component.
          */
         wattrset(stdscr, def_col);
-        wattron(stdscr, get_colour(*colour));
-        waddstr(stdscr, (char *)(*text).c_str());
+        wattron(stdscr, colour_attr(it->colour));
+        waddnstr(stdscr, text.data() + it->offset, it->length);
     }
 
     /*
-     * Reset to our default colour.
+     * Record the row(s) we've drawn over.
      */
-    wattrset(stdscr, get_colour("white|normal"));
+    int cur_x __attribute__((unused)), cur_y;
+    getyx(stdscr, cur_y, cur_x);
+    touch_rows(y, cur_y);
 
     /*
-     * Free the parts.
+     * Reset to our default colour.
      */
-    for (auto it = parts.begin(); it != parts.end() ; ++it)
-    {
-        COLOUR_STRING *i = (*it);
-        delete(i->string);
-        delete(i->colour);
-        free(i);
-    }
+    wattrset(stdscr, get_colour("white|normal"));
 
     if (update)
     {
@@ -159,6 +159,15 @@ public:
      */
     void clear(bool refresh_screen = true);
 
+    /**
+     * Forget what we drew in the previous frame, so that the next
+     * frame will be drawn in full.
+     *
+     * This must be called after drawing to the screen by any means
+     * other than `draw_single_line()` or `draw_text()`.
+     */
+    void invalidate();
+
     /**
      * Redraw the screen, via the currently active mode.
      */
@@ -220,13 +229,26 @@ public:
      *
      * If `simple` is set to true then we display the lines in a  simplified
      * fashion - with no selection, and no smooth-scrolling.
+     *
+     * Usually `lines` holds every line, but a view may generate only
+     * the visible lines, in which case `offset` is the index of the
+     * first one - see `viewport()`.
      */
-    void draw_text_lines(std::vector<std::string> lines, int selected, int max, bool simple = false);
+    void draw_text_lines(std::vector<std::string> lines, int selected, int max, bool simple = false, int offset = 0);
+
+    /**
+     * Find the lines which `draw_text_lines` will display, given the
+     * selected line and the total number of lines.
+     *
+     * On return `first` is the index of the line drawn on the top row,
+     * and `rows` is the number of rows which will be drawn.
+     */
+    void viewport(int selected, int max, bool simple, int &first, int &rows);
 
     /**
      * Draw a single text line, paying attention to our colour strings.
      *
-     * **NOTE**: This function is grossly inefficient, although functional.
+     * Each run of text which shares a colour is drawn in one call.
      *
      * The return value is the number of characters drawn.
      */
@@ -241,15 +263,59 @@ public:
 private:
 
     /**
-     * Get the colour-pair for the given name.
+     * Get the colour-pair, and attributes, for the given name.
      */
     int get_colour(std::string name);
 
+    /**
+     * Get the colour-pair, and attributes, for the colour with the
+     * given handle - as found by `CColourString::intern()`.
+     *
+     * Each colour is compiled the first time it is used, and cached.
+     */
+    int colour_attr(size_t handle);
+
+    /**
+     * Compile a colour-name, such as "white|bold", into a colour-pair
+     * and attributes.
+     */
+    int compile_colour(std::string name);
+
     /**
      * Convert ^I -> TAB, etc.
      */
     const char *lookup_key(int c);
 
+    /**
+     * Get the next character of input, or ERR on timeout.
+     *
+     * If asynchronous IMAP commands are outstanding we also return
+     * ERR as soon as one completes, so that it can be handled.
+     */
+    int get_input();
+
+    /**
+     * Start drawing a new frame.
+     *
+     * If the previous frame has been invalidated, or the screen resized,
+     * the screen is cleared, and true is returned.
+     */
+    bool begin_frame();
+
+    /**
+     * Finish drawing a frame, blanking any rows which were drawn in
+     * the previous frame but not in this one.
+     *
+     * Returns true if any row of the screen changed.
+     */
+    bool end_frame();
+
+    /**
+     * Record that the given rows have been drawn, by some means which
+     * we cannot compare against the next frame.
+     */
+    void touch_rows(int first, int last);
+
 private:
 
     /**
@@ -274,6 +340,45 @@ private:
      */
     std::unordered_map < std::string, int >m_colours;
 
+    /**
+     * The compiled attributes of each colour, indexed by handle, or -1
+     * if the colour has not yet been compiled.
+     *
+     * This is emptied when the colours change.
+     */
+    std::vector<int> m_attrs;
+
+    /**
+     * The rows of the screen as they were last drawn, by
+     * `draw_single_line()`.
+     *
+     * Each entry holds the text of the row along with the settings used
+     * to draw it, so that a row which would be drawn identically in the
+     * next frame can be skipped.  Blank rows are empty, and rows whose
+     * contents we don't know hold `UNKNOWN_ROW`.
+     */
+    std::vector<std::string> m_rows;
+
+    /**
+     * The rows which have been drawn in the current frame.
+     */
+    std::vector<bool> m_drawn;
+
+    /**
+     * The width of the screen when `m_rows` was last cleared.
+     */
+    int m_width = 0;
+
+    /**
+     * Set if the contents of `m_rows` cannot be trusted.
+     */
+    bool m_damaged = true;
+
+    /**
+     * Set if any row has been drawn in the current frame.
+     */
+    bool m_changed = false;
+
 private:
 
     /**
@@ -98,6 +98,11 @@ void CStatusPanel::init(int rows)
     show_panel(g_status_bar);
     m_hidden = false;
     draw();
+
+    /*
+     * Our size might have changed, so the main screen must be redrawn.
+     */
+    CScreen::instance()->invalidate();
 }
 
 
@@ -122,6 +127,11 @@ void CStatusPanel::hide()
 {
     cleanup();
     m_hidden = true;
+
+    /*
+     * The main screen must be redrawn where we used to be.
+     */
+    CScreen::instance()->invalidate();
 }
 
 /**
@@ -225,6 +235,17 @@ void CStatusPanel::draw()
 
 }
 
+/**
+ * Has the panel been drawn since the screen was last updated?
+ */
+bool CStatusPanel::modified()
+{
+    if ((m_hidden == true) || (g_status_bar_window == 0))
+        return false;
+
+    return (is_wintouched(g_status_bar_window));
+}
+
 void CStatusPanel::set_title(std::string new_title)
 {
     title = new_title ;
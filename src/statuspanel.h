@@ -95,6 +95,11 @@ public:
      */
     void draw();
 
+    /**
+     * Has the panel been drawn since the screen was last updated?
+     */
+    bool modified();
+
     /**
      * Set the panel-title.
      */
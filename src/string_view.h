@@ -0,0 +1,129 @@
+/*
+ * string_view.h - A non-owning reference to a range of characters.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <string.h>
+#include <string>
+
+
+/**
+ * A pointer + length pair referring to characters owned elsewhere.
+ *
+ * This is a minimal stand-in for C++17's `std::string_view`, since we
+ * compile with `-std=c++0x`.  It is used to refer to strings held in
+ * memory-mapped files without copying them.
+ *
+ * The caller is responsible for ensuring the storage outlives the view.
+ */
+class CStringView
+{
+public:
+
+    /**
+     * Constructor - an empty view.
+     */
+    CStringView() : m_data(""), m_size(0) {}
+
+    /**
+     * Constructor - a view of the given characters.
+     */
+    CStringView(const char *data, size_t size) : m_data(data), m_size(size) {}
+
+    /**
+     * Constructor - a view of the given string.
+     */
+    explicit CStringView(const std::string &str) : m_data(str.data()), m_size(str.size()) {}
+
+    /**
+     * The characters we refer to - these are *not* NULL-terminated.
+     */
+    const char *data() const
+    {
+        return m_data;
+    }
+
+    /**
+     * The number of characters we refer to.
+     */
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    /**
+     * Is this view empty?
+     */
+    bool empty() const
+    {
+        return (m_size == 0);
+    }
+
+    /**
+     * Copy the characters into a new string.
+     */
+    std::string to_string() const
+    {
+        return std::string(m_data, m_size);
+    }
+
+    /**
+     * Compare against another view, in the style of `strcmp`.
+     */
+    int compare(const CStringView &other) const
+    {
+        size_t len = (m_size < other.m_size) ? m_size : other.m_size;
+        int ret    = (len > 0) ? memcmp(m_data, other.m_data, len) : 0;
+
+        if (ret != 0)
+            return ret;
+
+        if (m_size == other.m_size)
+            return 0;
+
+        return (m_size < other.m_size) ? -1 : 1;
+    }
+
+    bool operator==(const CStringView &other) const
+    {
+        return (compare(other) == 0);
+    }
+
+    bool operator!=(const CStringView &other) const
+    {
+        return (compare(other) != 0);
+    }
+
+    bool operator<(const CStringView &other) const
+    {
+        return (compare(other) < 0);
+    }
+
+private:
+
+    /**
+     * The characters we refer to.
+     */
+    const char *m_data;
+
+    /**
+     * The number of characters.
+     */
+    size_t m_size;
+};
@@ -42,11 +42,44 @@ CuSuite *input_queue_getsuite();
 /* defined in lua_test.cc */
 CuSuite *lua_getsuite();
 
+/* defined in maildir_test.cc */
+CuSuite *maildir_getsuite();
+
+/* defined in maildir_index_test.cc */
+CuSuite *maildir_index_getsuite();
+
+/* defined in maildir_watcher_test.cc */
+CuSuite *maildir_watcher_getsuite();
+
+/* defined in mapped_message_test.cc */
+CuSuite *mapped_message_getsuite();
+
+/* defined in message_cache_test.cc */
+CuSuite *message_cache_getsuite();
+
+/* defined in message_filter_test.cc */
+CuSuite *message_filter_getsuite();
+
+/* defined in message_format_test.cc */
+CuSuite *message_format_getsuite();
+
+/* defined in message_sort_test.cc */
+CuSuite *message_sort_getsuite();
+
 /* defined in logfile_test.cc */
 CuSuite *logfile_getsuite();
 
 /* defined in statuspanel_test.cc */
 CuSuite *statuspanel_getsuite();
 
+/* defined in thread_index_test.cc */
+CuSuite *thread_index_getsuite();
+
+/* defined in thread_pool_test.cc */
+CuSuite *thread_pool_getsuite();
+
+/* defined in threader_test.cc */
+CuSuite *threader_getsuite();
+
 /* defined in util_test.cc */
 CuSuite *util_getsuite();
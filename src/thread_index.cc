@@ -0,0 +1,417 @@
+/*
+ * thread_index.cc - Maintain threads as messages come and go.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+
+#include "thread_index.h"
+
+
+/*
+ * Constructor.
+ */
+CThreadIndex::CThreadIndex(const std::string &output)
+    : m_threader(output), m_sequence(0), m_next_thread(0)
+{
+}
+
+
+/*
+ * Set the function used to sort messages.
+ */
+void CThreadIndex::set_compare(COMPARE compare)
+{
+    m_compare = compare;
+}
+
+
+/*
+ * Set the function used to find the date of a message.
+ */
+void CThreadIndex::set_date(DATE date)
+{
+    m_date = date;
+}
+
+
+/*
+ * Add the given messages.
+ */
+void CThreadIndex::insert(const std::vector<THREAD_KEY> &keys, const std::vector<THREAD_MESSAGE> &messages)
+{
+    std::vector<THREAD_KEY> seeds;
+
+    for (size_t i = 0; i < keys.size() && i < messages.size(); i++)
+    {
+        if (m_entries.find(keys[i]) != m_entries.end())
+            continue;
+
+        THREAD_ENTRY entry;
+        entry.message  = messages[i];
+        entry.sequence = m_sequence++;
+        entry.thread   = -1;
+
+        std::string id = CThreader::message_id(entry.message.message_id);
+
+        if (!id.empty())
+            entry.ids.push_back(id);
+
+        for (const std::string &ref : CThreader::references(entry.message))
+            entry.ids.push_back(ref);
+
+        for (const std::string &ref : entry.ids)
+            m_mentions[ref].insert(keys[i]);
+
+        m_entries[keys[i]] = entry;
+        seeds.push_back(keys[i]);
+    }
+
+    if (!seeds.empty())
+        rethread(seeds, std::unordered_set<int>());
+}
+
+
+/*
+ * Remove the given messages.
+ */
+void CThreadIndex::remove(const std::vector<THREAD_KEY> &keys)
+{
+    std::vector<THREAD_KEY> seeds;
+    std::unordered_set<int> threads;
+
+    for (THREAD_KEY key : keys)
+    {
+        auto it = m_entries.find(key);
+
+        if (it == m_entries.end())
+            continue;
+
+        /*
+         * The rest of its thread must be re-threaded, as must any message
+         * which referred to the same Message-IDs.
+         */
+        if (it->second.thread != -1)
+        {
+            threads.insert(it->second.thread);
+
+            for (THREAD_LINE &line : m_threads[it->second.thread].lines)
+                seeds.push_back(line.message);
+        }
+
+        for (const std::string &id : it->second.ids)
+        {
+            auto mentions = m_mentions.find(id);
+
+            if (mentions == m_mentions.end())
+                continue;
+
+            mentions->second.erase(key);
+
+            if (mentions->second.empty())
+                m_mentions.erase(mentions);
+            else
+                seeds.insert(seeds.end(), mentions->second.begin(), mentions->second.end());
+        }
+
+        m_entries.erase(it);
+    }
+
+    /*
+     * Some of the seeds might have been removed themselves.
+     */
+    seeds.erase(std::remove_if(seeds.begin(), seeds.end(), [this](THREAD_KEY key)
+    {
+        return (m_entries.find(key) == m_entries.end());
+    }), seeds.end());
+
+    if (!threads.empty())
+        rethread(seeds, threads);
+}
+
+
+/*
+ * Is the given message present?
+ */
+bool CThreadIndex::contains(THREAD_KEY key)
+{
+    return (m_entries.find(key) != m_entries.end());
+}
+
+
+/*
+ * The keys of all the messages present.
+ */
+std::vector<THREAD_KEY> CThreadIndex::keys()
+{
+    std::vector<THREAD_KEY> result;
+    result.reserve(m_entries.size());
+
+    for (auto &entry : m_entries)
+        result.push_back(entry.first);
+
+    return (result);
+}
+
+
+/*
+ * The number of messages present.
+ */
+size_t CThreadIndex::size()
+{
+    return (m_entries.size());
+}
+
+
+/*
+ * Remove everything.
+ */
+void CThreadIndex::clear()
+{
+    m_entries.clear();
+    m_mentions.clear();
+    m_threads.clear();
+    m_order.clear();
+    m_subjects.clear();
+}
+
+
+/*
+ * Return the threaded messages, in display order.
+ */
+std::vector<THREAD_LINE> CThreadIndex::lines()
+{
+    std::vector<THREAD_LINE> result;
+    result.reserve(m_entries.size());
+
+    for (int thread : m_order)
+    {
+        std::vector<THREAD_LINE> &lines = m_threads[thread].lines;
+        result.insert(result.end(), lines.begin(), lines.end());
+    }
+
+    return (result);
+}
+
+
+/*
+ * Re-thread the given messages, and those they affect.
+ */
+void CThreadIndex::rethread(std::vector<THREAD_KEY> seeds, std::unordered_set<int> threads)
+{
+    std::unordered_set<THREAD_KEY> found;
+    std::vector<THREAD_KEY> members;
+    std::vector<THREAD_LINE> lines;
+
+    /*
+     * Find every message which can be affected by the seeds, thread
+     * them, and repeat if the resulting threads share a subject with
+     * one we've not yet included.
+     */
+    while (true)
+    {
+        expand(seeds, found, threads);
+
+        members.assign(found.begin(), found.end());
+        std::sort(members.begin(), members.end(), [this](THREAD_KEY a, THREAD_KEY b)
+        {
+            return (m_entries[a].sequence < m_entries[b].sequence);
+        });
+
+        std::vector<THREAD_MESSAGE> messages;
+        messages.reserve(members.size());
+
+        for (THREAD_KEY key : members)
+            messages.push_back(m_entries[key].message);
+
+        CThreader::COMPARE compare = nullptr;
+        CThreader::DATE date = nullptr;
+
+        if (m_compare)
+            compare = [this, &members](size_t a, size_t b)
+        {
+            return m_compare(members[a], members[b]);
+        };
+
+        if (m_date)
+            date = [this, &members](size_t offset)
+        {
+            return m_date(members[offset]);
+        };
+
+        lines = m_threader.thread(messages, compare, date);
+
+        for (const std::string &subject : m_threader.subjects())
+        {
+            auto it = m_subjects.find(subject);
+
+            if (subject.empty() || (it == m_subjects.end()) ||
+                    (threads.find(it->second) != threads.end()))
+                continue;
+
+            for (THREAD_LINE &line : m_threads[it->second].lines)
+                seeds.push_back(line.message);
+        }
+
+        if (seeds.empty())
+            break;
+    }
+
+    /*
+     * Discard the threads we've replaced.
+     */
+    for (int thread : threads)
+    {
+        auto it = m_threads.find(thread);
+
+        if (it == m_threads.end())
+            continue;
+
+        auto subject = m_subjects.find(it->second.subject);
+
+        if ((subject != m_subjects.end()) && (subject->second == thread))
+            m_subjects.erase(subject);
+
+        m_threads.erase(it);
+    }
+
+    m_order.erase(std::remove_if(m_order.begin(), m_order.end(), [&threads](int thread)
+    {
+        return (threads.find(thread) != threads.end());
+    }), m_order.end());
+
+    /*
+     * Add the new ones in their place.
+     */
+    const std::vector<std::string> &subjects = m_threader.subjects();
+    int number = -1;
+    size_t count = 0;
+
+    for (THREAD_LINE &line : lines)
+    {
+        THREAD_KEY key = members[line.message];
+        line.message = key;
+
+        if (line.root)
+        {
+            if (number != -1)
+                place(number);
+
+            number = m_next_thread++;
+
+            THREAD &thread = m_threads[number];
+            thread.subject  = subjects[count++];
+            thread.first    = m_entries[key].sequence;
+            thread.greatest = key;
+
+            if (!thread.subject.empty())
+                m_subjects[thread.subject] = number;
+        }
+
+        THREAD &thread = m_threads[number];
+        THREAD_ENTRY &entry = m_entries[key];
+
+        entry.thread = number;
+
+        if (entry.sequence < thread.first)
+            thread.first = entry.sequence;
+
+        if (m_compare && m_compare(thread.greatest, key))
+            thread.greatest = key;
+
+        thread.lines.push_back(line);
+    }
+
+    if (number != -1)
+        place(number);
+}
+
+
+/*
+ * Insert the given thread into its place in the display order.
+ */
+void CThreadIndex::place(int thread)
+{
+    auto position = std::upper_bound(m_order.begin(), m_order.end(), thread,
+                                     [this](int a, int b)
+    {
+        return before(a, b);
+    });
+
+    m_order.insert(position, thread);
+}
+
+
+/*
+ * Find the messages, and threads, affected by those in the queue.
+ */
+void CThreadIndex::expand(std::vector<THREAD_KEY> &queue, std::unordered_set<THREAD_KEY> &found,
+                          std::unordered_set<int> &threads)
+{
+    while (!queue.empty())
+    {
+        THREAD_KEY key = queue.back();
+        queue.pop_back();
+
+        if (!found.insert(key).second)
+            continue;
+
+        THREAD_ENTRY &entry = m_entries[key];
+
+        /*
+         * Everything in the same thread.
+         */
+        if ((entry.thread != -1) && threads.insert(entry.thread).second)
+        {
+            for (THREAD_LINE &line : m_threads[entry.thread].lines)
+                queue.push_back(line.message);
+        }
+
+        /*
+         * Everything which has, or refers to, the same Message-IDs.
+         */
+        for (const std::string &id : entry.ids)
+        {
+            for (THREAD_KEY other : m_mentions[id])
+            {
+                if (found.find(other) == found.end())
+                    queue.push_back(other);
+            }
+        }
+    }
+}
+
+
+/*
+ * Should thread `a` be displayed before thread `b`?
+ */
+bool CThreadIndex::before(int a, int b)
+{
+    THREAD &ta = m_threads[a];
+    THREAD &tb = m_threads[b];
+
+    if (m_compare)
+    {
+        if (m_compare(ta.greatest, tb.greatest))
+            return true;
+
+        if (m_compare(tb.greatest, ta.greatest))
+            return false;
+    }
+
+    return (ta.first < tb.first);
+}
@@ -0,0 +1,239 @@
+/*
+ * thread_index.h - Maintain threads as messages come and go.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <functional>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "threader.h"
+
+
+/**
+ * The caller-chosen identifier of a message in a CThreadIndex.
+ */
+typedef size_t THREAD_KEY;
+
+
+
+/**
+ * This class holds the threads of a set of messages, and updates them
+ * as individual messages are inserted or removed.
+ *
+ * Messages interact with each other in only two ways when threaded: by
+ * referring to the same Message-IDs, or by their threads sharing the
+ * same subject.  So when a message comes or goes we find the messages
+ * which can be affected by that, re-thread only those with CThreader,
+ * and move the resulting threads to their place in the sorted list.
+ *
+ * The results are identical to threading every message from scratch,
+ * in the order in which they were inserted.
+ */
+class CThreadIndex
+{
+public:
+
+    /**
+     * Compare two messages, by key, returning true if the first should
+     * be displayed before the second.
+     */
+    typedef std::function<bool(THREAD_KEY, THREAD_KEY)> COMPARE;
+
+    /**
+     * Return the date of a message, by key.
+     */
+    typedef std::function<int64_t(THREAD_KEY)> DATE;
+
+    /**
+     * Constructor.
+     *
+     * `output` holds the signs used to indent the threads, as per
+     * CThreader.
+     */
+    CThreadIndex(const std::string &output = " ;`;-> ");
+
+    /**
+     * Set the function used to sort messages, if any.
+     *
+     * NOTE: The existing threads are not resorted, so this must always
+     * order messages in the same way.
+     */
+    void set_compare(COMPARE compare);
+
+    /**
+     * Set the function used to find the date of a message.
+     */
+    void set_date(DATE date);
+
+    /**
+     * Add the given messages, which follow all those already present.
+     */
+    void insert(const std::vector<THREAD_KEY> &keys, const std::vector<THREAD_MESSAGE> &messages);
+
+    /**
+     * Remove the given messages.
+     */
+    void remove(const std::vector<THREAD_KEY> &keys);
+
+    /**
+     * Is the given message present?
+     */
+    bool contains(THREAD_KEY key);
+
+    /**
+     * The keys of all the messages present.
+     */
+    std::vector<THREAD_KEY> keys();
+
+    /**
+     * The number of messages present.
+     */
+    size_t size();
+
+    /**
+     * Remove everything.
+     */
+    void clear();
+
+    /**
+     * Return the threaded messages, in display order.
+     *
+     * The `message` of each line holds the key of the message.
+     */
+    std::vector<THREAD_LINE> lines();
+
+private:
+
+    /**
+     * A single message.
+     */
+    typedef struct _thread_entry
+    {
+        /**
+         * The headers of the message.
+         */
+        THREAD_MESSAGE message;
+
+        /**
+         * The Message-IDs it has, or refers to.
+         */
+        std::vector<std::string> ids;
+
+        /**
+         * The order in which it was inserted.
+         */
+        uint64_t sequence;
+
+        /**
+         * The thread it belongs to, or -1.
+         */
+        int thread;
+    } THREAD_ENTRY;
+
+    /**
+     * A single thread.
+     */
+    typedef struct _thread
+    {
+        /**
+         * The messages of the thread, in display order.
+         */
+        std::vector<THREAD_LINE> lines;
+
+        /**
+         * The normalised subject it was grouped by, if any.
+         */
+        std::string subject;
+
+        /**
+         * The earliest inserted, and greatest, messages within it, which
+         * determine its place amongst the others.
+         */
+        uint64_t first;
+        THREAD_KEY greatest;
+    } THREAD;
+
+    /**
+     * Re-thread the given messages, and all those which they affect,
+     * replacing the given threads and any others they were part of.
+     */
+    void rethread(std::vector<THREAD_KEY> seeds, std::unordered_set<int> threads);
+
+    /**
+     * Add the messages which are affected by those in `queue` to `found`,
+     * and the threads which contain them to `threads`.
+     */
+    void expand(std::vector<THREAD_KEY> &queue, std::unordered_set<THREAD_KEY> &found,
+                std::unordered_set<int> &threads);
+
+    /**
+     * Insert the given thread into its place in the display order.
+     */
+    void place(int thread);
+
+    /**
+     * Should thread `a` be displayed before thread `b`?
+     */
+    bool before(int a, int b);
+
+private:
+
+    /**
+     * The threader we use.
+     */
+    CThreader m_threader;
+
+    /**
+     * Our functions to compare, and date, messages.
+     */
+    COMPARE m_compare;
+    DATE m_date;
+
+    /**
+     * Our messages, by key.
+     */
+    std::unordered_map<THREAD_KEY, THREAD_ENTRY> m_entries;
+
+    /**
+     * The messages which have, or refer to, each Message-ID.
+     */
+    std::unordered_map<std::string, std::unordered_set<THREAD_KEY> > m_mentions;
+
+    /**
+     * Our threads, by number, and in display order.
+     */
+    std::unordered_map<int, THREAD> m_threads;
+    std::vector<int> m_order;
+
+    /**
+     * The thread which was grouped by each subject.
+     */
+    std::unordered_map<std::string, int> m_subjects;
+
+    /**
+     * The sequence of the next message inserted, and the number of the
+     * next thread created.
+     */
+    uint64_t m_sequence;
+    int m_next_thread;
+};
@@ -0,0 +1,219 @@
+/*
+ * thread_index_test.cc - Test-cases for our CThreadIndex class.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <string>
+#include <vector>
+
+#include "thread_index.h"
+#include "CuTest.h"
+
+
+/**
+ * The messages we thread, each of which has the key of its offset
+ * plus 100.
+ */
+static std::vector<THREAD_MESSAGE> test_messages()
+{
+    const char *headers[][4] =
+    {
+        {"<a>", "", "", "Hello"},
+        {"<b>", "<a>", "<a>", "Re: Hello"},
+        {"<x>", "", "", "Unrelated"},
+        {"<c>", "<a> <b>", "", "Re: Hello"},
+        {"<d>", "<missing>", "", "Re: Lost"},
+        {"<e>", "<missing>", "", "Re: Lost"},
+        {"<f>", "", "", "Hello"},
+        {"<g>", "<x>", "", "Changed subject"},
+        {"<b>", "", "", "Duplicate"},
+        {"", "", "", "No ID"},
+        {"<h>", "<c>", "", "Re: Re: Hello"},
+        {"<i>", "", "", "Lost"},
+    };
+
+    std::vector<THREAD_MESSAGE> result;
+
+    for (size_t i = 0; i < sizeof(headers) / sizeof(headers[0]); i++)
+    {
+        THREAD_MESSAGE msg;
+        msg.message_id  = headers[i][0];
+        msg.references  = headers[i][1];
+        msg.in_reply_to = headers[i][2];
+        msg.subject     = headers[i][3];
+        result.push_back(msg);
+    }
+
+    return result;
+}
+
+
+/**
+ * Compare messages by key, in reverse.
+ */
+static bool test_compare(THREAD_KEY a, THREAD_KEY b)
+{
+    return (a > b);
+}
+
+
+/**
+ * Date messages by key, in reverse.
+ */
+static int64_t test_date(THREAD_KEY key)
+{
+    return (int64_t)(1000 - key);
+}
+
+
+/**
+ * Assert that the index holds the same threads as threading the given
+ * messages from scratch.
+ */
+static void assert_threads(CuTest * tc, CThreadIndex &index, bool sorted,
+                           const std::vector<THREAD_KEY> &keys)
+{
+    std::vector<THREAD_MESSAGE> all = test_messages();
+    std::vector<THREAD_MESSAGE> messages;
+
+    for (THREAD_KEY key : keys)
+        messages.push_back(all[key - 100]);
+
+    CThreader threader;
+    std::vector<THREAD_LINE> expected = threader.thread(messages,
+                                        sorted ? [&keys](size_t a, size_t b)
+    {
+        return test_compare(keys[a], keys[b]);
+    } : CThreader::COMPARE(nullptr),
+    [&keys](size_t offset)
+    {
+        return test_date(keys[offset]);
+    });
+
+    std::vector<THREAD_LINE> actual = index.lines();
+
+    CuAssertIntEquals(tc, keys.size(), index.size());
+    CuAssertIntEquals(tc, expected.size(), actual.size());
+
+    for (size_t i = 0; i < expected.size() && i < actual.size(); i++)
+    {
+        CuAssertIntEquals(tc, keys[expected[i].message], actual[i].message);
+        CuAssertStrEquals(tc, expected[i].indent.c_str(), actual[i].indent.c_str());
+        CuAssertTrue(tc, expected[i].root == actual[i].root);
+    }
+}
+
+
+/**
+ * Insert, and remove, messages one at a time, and in bulk.
+ */
+static void test_index(CuTest * tc, bool sorted)
+{
+    std::vector<THREAD_MESSAGE> all = test_messages();
+
+    CThreadIndex index;
+    index.set_date(test_date);
+
+    if (sorted)
+        index.set_compare(test_compare);
+
+    /*
+     * Insert the messages one at a time.
+     */
+    std::vector<THREAD_KEY> keys;
+
+    for (size_t i = 0; i < all.size(); i++)
+    {
+        keys.push_back(100 + i);
+        index.insert(std::vector<THREAD_KEY>(1, 100 + i), std::vector<THREAD_MESSAGE>(1, all[i]));
+        assert_threads(tc, index, sorted, keys);
+    }
+
+    /*
+     * Remove the parent of a thread, and the first holder of a
+     * duplicated Message-ID.
+     */
+    index.remove(std::vector<THREAD_KEY>(1, 100));
+    keys.erase(keys.begin());
+    assert_threads(tc, index, sorted, keys);
+
+    index.remove(std::vector<THREAD_KEY>(1, 101));
+    keys.erase(keys.begin());
+    assert_threads(tc, index, sorted, keys);
+
+    /*
+     * Remove several at once, then add them back.
+     */
+    std::vector<THREAD_KEY> removed;
+    removed.push_back(104);
+    removed.push_back(107);
+    removed.push_back(111);
+    index.remove(removed);
+
+    std::vector<THREAD_KEY> remaining;
+
+    for (THREAD_KEY key : keys)
+    {
+        if (key != 104 && key != 107 && key != 111)
+            remaining.push_back(key);
+    }
+
+    assert_threads(tc, index, sorted, remaining);
+
+    std::vector<THREAD_MESSAGE> messages;
+
+    for (THREAD_KEY key : removed)
+    {
+        messages.push_back(all[key - 100]);
+        remaining.push_back(key);
+    }
+
+    index.insert(removed, messages);
+    assert_threads(tc, index, sorted, remaining);
+
+    index.clear();
+    CuAssertIntEquals(tc, 0, index.size());
+    CuAssertIntEquals(tc, 0, index.lines().size());
+}
+
+
+/**
+ * Test the index in the order in which messages were inserted.
+ */
+void TestThreadIndexUnsorted(CuTest * tc)
+{
+    test_index(tc, false);
+}
+
+
+/**
+ * Test the index with messages, and threads, sorted.
+ */
+void TestThreadIndexSorted(CuTest * tc)
+{
+    test_index(tc, true);
+}
+
+
+CuSuite *
+thread_index_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestThreadIndexUnsorted);
+    SUITE_ADD_TEST(suite, TestThreadIndexSorted);
+    return suite;
+}
@@ -0,0 +1,134 @@
+/*
+ * thread_pool.cc - A simple pool of worker-threads.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include "thread_pool.h"
+
+
+/*
+ * Constructor.
+ */
+CThreadPool::CThreadPool(int threads)
+{
+    m_pending = 0;
+    m_stop    = false;
+
+    for (int i = 0; i < threads; i++)
+        m_threads.push_back(std::thread(&CThreadPool::worker, this));
+}
+
+
+/*
+ * Destructor.
+ */
+CThreadPool::~CThreadPool()
+{
+    wait();
+
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_stop = true;
+    }
+
+    m_queued.notify_all();
+
+    for (std::thread &t : m_threads)
+        t.join();
+}
+
+
+/*
+ * The default number of workers to use.
+ */
+int CThreadPool::default_size()
+{
+    int n = std::thread::hardware_concurrency();
+
+    return (n > 0 ? n : 1);
+}
+
+
+/*
+ * Queue a task for execution.
+ */
+void CThreadPool::add(std::function<void()> task)
+{
+    /*
+     * Without any workers we just run the task.
+     */
+    if (m_threads.empty())
+    {
+        task();
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_tasks.push_back(task);
+        m_pending += 1;
+    }
+
+    m_queued.notify_one();
+}
+
+
+/*
+ * Block until all queued tasks have completed.
+ */
+void CThreadPool::wait()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    while (m_pending > 0)
+        m_done.wait(lock);
+}
+
+
+/*
+ * The body of each worker-thread.
+ */
+void CThreadPool::worker()
+{
+    while (true)
+    {
+        std::function<void()> task;
+
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+
+            while (!m_stop && m_tasks.empty())
+                m_queued.wait(lock);
+
+            if (m_stop && m_tasks.empty())
+                return;
+
+            task = m_tasks.front();
+            m_tasks.pop_front();
+        }
+
+        task();
+
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_pending -= 1;
+
+            if (m_pending == 0)
+                m_done.notify_all();
+        }
+    }
+}
@@ -0,0 +1,122 @@
+/*
+ * thread_pool.h - A simple pool of worker-threads.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/**
+ * A fixed-size pool of worker-threads, which run queued tasks.
+ *
+ * Tasks must not touch the Lua interpreter, the screen, or the other
+ * singletons, as none of those are thread-safe.  The intended use is
+ * to run I/O-bound work concurrently, then `wait()` for it to finish
+ * before the main thread consumes the results.
+ *
+ * <pre>
+ * CThreadPool pool(4);
+ *
+ * for (auto m : maildirs)
+ *     pool.add([m]() { m->unread_messages(); });
+ *
+ * pool.wait();
+ * </pre>
+ */
+class CThreadPool
+{
+public:
+
+    /**
+     * Constructor.  Launch the given number of workers.
+     *
+     * If the count is less than one then tasks are executed immediately,
+     * in the calling thread, when they are added.
+     */
+    CThreadPool(int threads);
+
+    /**
+     * Destructor.  Wait for any pending tasks, then stop the workers.
+     */
+    ~CThreadPool();
+
+    /**
+     * Queue a task for execution.
+     */
+    void add(std::function<void()> task);
+
+    /**
+     * Block until all queued tasks have completed.
+     */
+    void wait();
+
+    /**
+     * The default number of workers to use: the number of CPUs.
+     */
+    static int default_size();
+
+private:
+
+    /**
+     * The body of each worker-thread.
+     */
+    void worker();
+
+private:
+
+    /**
+     * The worker-threads.
+     */
+    std::vector<std::thread> m_threads;
+
+    /**
+     * Tasks which have not yet been started.
+     */
+    std::deque<std::function<void()>> m_tasks;
+
+    /**
+     * The number of tasks which are queued, or running.
+     */
+    int m_pending;
+
+    /**
+     * Set when the workers should terminate.
+     */
+    bool m_stop;
+
+    /**
+     * Protects the members above.
+     */
+    std::mutex m_lock;
+
+    /**
+     * Signalled when a task is queued, or we're stopping.
+     */
+    std::condition_variable m_queued;
+
+    /**
+     * Signalled when the last pending task completes.
+     */
+    std::condition_variable m_done;
+};
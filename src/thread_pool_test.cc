@@ -0,0 +1,84 @@
+/*
+ * thread_pool_test.cc - Test-cases for our CThreadPool class.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <atomic>
+
+#include "thread_pool.h"
+#include "CuTest.h"
+
+
+/**
+ * Test that every task added to a pool is executed before wait() returns.
+ */
+void TestThreadPoolWait(CuTest * tc)
+{
+    std::atomic<int> count(0);
+
+    CThreadPool pool(4);
+
+    for (int i = 0; i < 1000; i++)
+    {
+        pool.add([&count]()
+        {
+            count += 1;
+        });
+    }
+
+    pool.wait();
+    CuAssertIntEquals(tc, 1000, count);
+
+    /*
+     * The pool may be reused after waiting.
+     */
+    pool.add([&count]()
+    {
+        count += 1;
+    });
+    pool.wait();
+    CuAssertIntEquals(tc, 1001, count);
+}
+
+
+/**
+ * Test that a pool without workers runs tasks immediately.
+ */
+void TestThreadPoolEmpty(CuTest * tc)
+{
+    int count = 0;
+
+    CThreadPool pool(0);
+
+    pool.add([&count]()
+    {
+        count += 1;
+    });
+
+    CuAssertIntEquals(tc, 1, count);
+    pool.wait();
+}
+
+
+CuSuite *
+thread_pool_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestThreadPoolWait);
+    SUITE_ADD_TEST(suite, TestThreadPoolEmpty);
+    return suite;
+}
@@ -0,0 +1,801 @@
+/*
+ * threader.cc - Group messages into threads.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <ctype.h>
+
+#include "threader.h"
+
+
+/*
+ * Constructor.
+ */
+CThreader::CThreader(const std::string &output) : m_messages(NULL)
+{
+    /*
+     * Split the signs at ';', skipping empty fields.
+     */
+    std::vector<std::string> signs;
+    size_t start = 0;
+
+    while (start <= output.size())
+    {
+        size_t end = output.find(';', start);
+
+        if (end == std::string::npos)
+            end = output.size();
+
+        if (end > start)
+            signs.push_back(output.substr(start, end - start));
+
+        start = end + 1;
+    }
+
+    signs.resize(3);
+
+    m_indent = signs[0];
+    m_root   = signs[1];
+    m_sign   = signs[2];
+}
+
+
+/*
+ * Thread the given messages.
+ */
+std::vector<THREAD_LINE> CThreader::thread(const std::vector<THREAD_MESSAGE> &messages,
+        COMPARE compare, DATE date)
+{
+    m_containers.clear();
+    m_containers.reserve(messages.size());
+    m_messages = &messages;
+    m_compare  = compare;
+
+    /*
+     * Containers by Message-ID.
+     */
+    std::unordered_map<std::string, int> ids;
+
+    /*
+     * 1. Link each message to those it refers to.
+     */
+    for (size_t i = 0; i < messages.size(); i++)
+    {
+        std::string id = message_id(messages[i].message_id);
+
+        /*
+         * A message without a Message-ID can't be threaded, so it is
+         * left as a root.
+         */
+        if (id.empty())
+        {
+            create(i);
+            continue;
+        }
+
+        /*
+         * 1.A: Find, or create, the container of this message.
+         */
+        int self;
+        auto found = ids.find(id);
+
+        if (found == ids.end())
+        {
+            self = create(i);
+            ids[id] = self;
+        }
+        else if (m_containers[found->second].message == -1)
+        {
+            self = found->second;
+            m_containers[self].message = i;
+        }
+        else
+        {
+            /*
+             * A duplicate Message-ID: keep the message, as a root,
+             * rather than losing it.
+             */
+            create(i);
+            continue;
+        }
+
+        /*
+         * 1.B: Link the containers of each reference together, in order,
+         * unless they're already linked or that would introduce a loop.
+         */
+        int prev = -1;
+
+        for (const std::string &ref : references(messages[i]))
+        {
+            int cur;
+            auto it = ids.find(ref);
+
+            if (it == ids.end())
+            {
+                cur = create(-1);
+                ids[ref] = cur;
+            }
+            else
+                cur = it->second;
+
+            if ((prev != -1) && (m_containers[cur].parent == -1) &&
+                    !has_descendant(cur, prev))
+                add_child(prev, cur);
+
+            prev = cur;
+        }
+
+        /*
+         * 1.C: Link this message beneath the last of them.
+         */
+        if ((prev != -1) && !has_descendant(self, prev))
+            add_child(prev, self);
+    }
+
+    /*
+     * 2. The root set is every container without a parent.
+     */
+    std::vector<int> roots;
+
+    for (size_t i = 0; i < m_containers.size(); i++)
+    {
+        if (m_containers[i].parent == -1)
+            roots.push_back(i);
+    }
+
+    /*
+     * 4. Prune empty containers.
+     */
+    for (int root : roots)
+        prune_empty(root);
+
+    /*
+     * 5.A/5.B: Find the container to group each subject beneath, preferring
+     * an empty one.
+     */
+    std::unordered_map<std::string, int> subjects;
+    std::vector<std::string> order;
+    std::vector<std::pair<int, std::string> > output;
+
+    for (int root : roots)
+    {
+        CONTAINER &c = m_containers[root];
+
+        if ((c.message == -1) && (c.first_child == -1))
+            continue;
+
+        std::string s = normalise_subject(subject(root));
+
+        if (s.empty())
+        {
+            output.push_back(std::make_pair(root, s));
+            continue;
+        }
+
+        auto it = subjects.find(s);
+
+        if (it == subjects.end())
+        {
+            subjects[s] = root;
+            order.push_back(s);
+        }
+        else if ((m_containers[it->second].message != -1) && (c.message == -1))
+            it->second = root;
+    }
+
+    /*
+     * 5.C: Group the roots by subject.
+     */
+    for (int root : roots)
+    {
+        CONTAINER &c = m_containers[root];
+
+        if ((c.message == -1) && (c.first_child == -1))
+            continue;
+
+        std::string s = normalise_subject(subject(root));
+
+        auto it = subjects.find(s);
+
+        if ((it == subjects.end()) || (it->second == root))
+            continue;
+
+        int target = it->second;
+        bool root_empty   = (m_containers[root].message == -1);
+        bool target_empty = (m_containers[target].message == -1);
+
+        if (root_empty && target_empty)
+        {
+            transfer_children(root, target);
+        }
+        else if (target_empty)
+        {
+            add_child(target, root);
+        }
+        else if (root_empty)
+        {
+            add_child(root, target);
+            it->second = root;
+        }
+        else
+        {
+            bool root_reply   = is_reply(subject(root));
+            bool target_reply = is_reply(subject(target));
+
+            /*
+             * Make a reply the child of a non-reply, otherwise group
+             * both beneath a new, empty, container.
+             */
+            if (root_reply && !target_reply)
+            {
+                add_child(target, root);
+            }
+            else if (!root_reply && target_reply)
+            {
+                add_child(root, target);
+                it->second = root;
+            }
+            else
+            {
+                int parent = create(-1);
+                add_child(parent, root);
+                add_child(parent, target);
+                it->second = parent;
+            }
+        }
+    }
+
+    /*
+     * Replace each empty container with its oldest child, if that isn't
+     * a reply, so that the results are deterministic.
+     */
+    for (const std::string &s : order)
+    {
+        int root = subjects[s];
+
+        if (m_containers[root].message != -1)
+        {
+            output.push_back(std::make_pair(root, s));
+            continue;
+        }
+
+        int oldest = -1;
+        int64_t oldest_date = 0;
+
+        for (int child : children(root))
+        {
+            if (m_containers[child].message == -1)
+                continue;
+
+            int64_t d = date ? date(m_containers[child].message) : 0;
+
+            if ((oldest == -1) || (d < oldest_date))
+            {
+                oldest = child;
+                oldest_date = d;
+            }
+        }
+
+        if ((oldest != -1) && !is_reply(subject(oldest)))
+        {
+            remove_child(oldest);
+            transfer_children(root, oldest);
+            root = oldest;
+        }
+
+        output.push_back(std::make_pair(root, s));
+    }
+
+    /*
+     * Order the threads by their first message, so that the results
+     * don't depend upon the order in which containers were created.
+     */
+    std::vector<std::pair<int, size_t> > first_of;
+
+    for (size_t i = 0; i < output.size(); i++)
+        first_of.push_back(std::make_pair(first(output[i].first), i));
+
+    std::sort(first_of.begin(), first_of.end());
+
+    /*
+     * Then sort the messages within each thread, and the threads by their
+     * greatest message.
+     */
+    if (m_compare)
+    {
+        std::vector<std::pair<int, size_t> > greatest_of;
+
+        for (auto &f : first_of)
+        {
+            int root = output[f.second].first;
+            sort(root);
+            greatest_of.push_back(std::make_pair(greatest(root), f.second));
+        }
+
+        std::stable_sort(greatest_of.begin(), greatest_of.end(),
+                         [this](const std::pair<int, size_t> &a, const std::pair<int, size_t> &b)
+        {
+            return m_compare(a.first, b.first);
+        });
+
+        first_of = greatest_of;
+    }
+
+    /*
+     * Flatten the threads.
+     */
+    std::vector<THREAD_LINE> result;
+    result.reserve(messages.size());
+    m_subjects.clear();
+
+    for (auto &f : first_of)
+    {
+        size_t start = result.size();
+        walk(output[f.second].first, "", result);
+
+        if (result.size() > start)
+        {
+            result[start].root = true;
+            m_subjects.push_back(output[f.second].second);
+        }
+    }
+
+    m_containers.clear();
+    m_messages = NULL;
+    m_compare  = nullptr;
+
+    return (result);
+}
+
+
+/*
+ * Remove "Re:" and "Fwd:" markers from the given subject.
+ *
+ * Each form is removed from the whole string in turn, exactly as the
+ * Lua patterns `R[Ee]:%s?`, `R[Ee]%[%d%]:%s?` and `F[wW][dD]:%s?` did.
+ */
+std::string CThreader::normalise_subject(const std::string &subject)
+{
+    std::string result = subject;
+
+    for (int pass = 0; pass < 3; pass++)
+    {
+        std::string out;
+        size_t i = 0;
+
+        while (i < result.size())
+        {
+            size_t len = 0;
+            const char *p = result.c_str() + i;
+            size_t left = result.size() - i;
+
+            if (pass == 0 && left >= 3 && p[0] == 'R' && (p[1] == 'e' || p[1] == 'E') && p[2] == ':')
+                len = 3;
+            else if (pass == 1 && left >= 6 && p[0] == 'R' && (p[1] == 'e' || p[1] == 'E') &&
+                     p[2] == '[' && isdigit(p[3]) && p[4] == ']' && p[5] == ':')
+                len = 6;
+            else if (pass == 2 && left >= 4 && p[0] == 'F' && (p[1] == 'w' || p[1] == 'W') &&
+                     (p[2] == 'd' || p[2] == 'D') && p[3] == ':')
+                len = 4;
+
+            if (len == 0)
+            {
+                out += result[i];
+                i += 1;
+                continue;
+            }
+
+            i += len;
+
+            if (i < result.size() && isspace(result[i]))
+                i += 1;
+        }
+
+        result = out;
+    }
+
+    return (result);
+}
+
+
+/*
+ * Does the given subject contain a "Re:" marker?
+ */
+bool CThreader::is_reply(const std::string &subject)
+{
+    for (size_t i = 0; i + 1 < subject.size(); i++)
+    {
+        if (subject[i] != 'R' || (subject[i + 1] != 'e' && subject[i + 1] != 'E'))
+            continue;
+
+        if (i + 2 < subject.size() && subject[i + 2] == ':')
+            return true;
+
+        if (i + 5 < subject.size() && subject[i + 2] == '[' &&
+                isdigit(subject[i + 3]) && subject[i + 4] == ']' && subject[i + 5] == ':')
+            return true;
+    }
+
+    return false;
+}
+
+
+/*
+ * Return the first "<message-id>" within the given header.
+ */
+std::string CThreader::message_id(const std::string &header)
+{
+    size_t start = header.find('<');
+
+    while (start != std::string::npos)
+    {
+        size_t end = header.find('>', start + 1);
+
+        if (end == std::string::npos)
+            break;
+
+        if (end > start + 1)
+            return (header.substr(start + 1, end - start - 1));
+
+        start = header.find('<', end + 1);
+    }
+
+    return "";
+}
+
+
+/*
+ * Return the Message-IDs the given message refers to.
+ */
+std::vector<std::string> CThreader::references(const THREAD_MESSAGE &message)
+{
+    std::vector<std::string> result;
+
+    /*
+     * Every "<id>" in the References header.
+     */
+    const std::string &refs = message.references;
+    size_t start = refs.find('<');
+
+    while (start != std::string::npos)
+    {
+        size_t end = refs.find('>', start + 1);
+
+        if (end == std::string::npos)
+            break;
+
+        if (end > start + 1)
+        {
+            result.push_back(refs.substr(start + 1, end - start - 1));
+            start = refs.find('<', end + 1);
+        }
+        else
+            start = refs.find('<', start + 1);
+    }
+
+    /*
+     * The last "<id>" in the In-Reply-To header.
+     */
+    const std::string &reply = message.in_reply_to;
+    std::string reply_to;
+    start = reply.rfind('<');
+
+    while (start != std::string::npos)
+    {
+        size_t end = reply.find('>', start + 1);
+
+        if ((end != std::string::npos) && (end > start + 1))
+        {
+            reply_to = reply.substr(start + 1, end - start - 1);
+            break;
+        }
+
+        if (start == 0)
+            break;
+
+        start = reply.rfind('<', start - 1);
+    }
+
+    if (!reply_to.empty() && (result.empty() || result.back() != reply_to))
+        result.push_back(reply_to);
+
+    return (result);
+}
+
+
+/*
+ * Create a new container.
+ */
+int CThreader::create(int message)
+{
+    CONTAINER c;
+    c.message     = message;
+    c.parent      = -1;
+    c.first_child = -1;
+    c.last_child  = -1;
+    c.next        = -1;
+    c.prev        = -1;
+    c.children    = 0;
+    c.subject_set = false;
+
+    m_containers.push_back(c);
+    return (m_containers.size() - 1);
+}
+
+
+/*
+ * Make `child` the last child of `parent`.
+ */
+void CThreader::add_child(int parent, int child)
+{
+    if (m_containers[child].parent != -1)
+        remove_child(child);
+
+    CONTAINER &p = m_containers[parent];
+    CONTAINER &c = m_containers[child];
+
+    c.parent = parent;
+    c.prev   = p.last_child;
+    c.next   = -1;
+
+    if (p.last_child != -1)
+        m_containers[p.last_child].next = child;
+    else
+        p.first_child = child;
+
+    p.last_child = child;
+    p.children  += 1;
+}
+
+
+/*
+ * Remove `child` from its parent.
+ */
+void CThreader::remove_child(int child)
+{
+    CONTAINER &c = m_containers[child];
+
+    if (c.parent == -1)
+        return;
+
+    CONTAINER &p = m_containers[c.parent];
+
+    if (c.prev != -1)
+        m_containers[c.prev].next = c.next;
+    else
+        p.first_child = c.next;
+
+    if (c.next != -1)
+        m_containers[c.next].prev = c.prev;
+    else
+        p.last_child = c.prev;
+
+    p.children -= 1;
+
+    c.parent = -1;
+    c.next   = -1;
+    c.prev   = -1;
+}
+
+
+/*
+ * Move all the children of `from` to `to`.
+ *
+ * NOTE: They're appended in reverse order, as the Lua implementation did.
+ */
+void CThreader::transfer_children(int from, int to)
+{
+    while (m_containers[from].last_child != -1)
+        add_child(to, m_containers[from].last_child);
+}
+
+
+/*
+ * Is `descendant` the same as, or a descendant of, `container`?
+ *
+ * We walk up from the descendant, which is bounded by the depth of the
+ * tree, rather than down through every child of the container.
+ */
+bool CThreader::has_descendant(int container, int descendant)
+{
+    while (descendant != -1)
+    {
+        if (descendant == container)
+            return true;
+
+        descendant = m_containers[descendant].parent;
+    }
+
+    return false;
+}
+
+
+/*
+ * Return the children of the given container.
+ */
+std::vector<int> CThreader::children(int container)
+{
+    std::vector<int> result;
+    result.reserve(m_containers[container].children);
+
+    for (int c = m_containers[container].first_child; c != -1; c = m_containers[c].next)
+        result.push_back(c);
+
+    return (result);
+}
+
+
+/*
+ * Remove empty containers beneath, and including, the given one.
+ */
+void CThreader::prune_empty(int container)
+{
+    std::vector<int> kids = children(container);
+
+    for (auto it = kids.rbegin(); it != kids.rend(); ++it)
+        prune_empty(*it);
+
+    CONTAINER &c = m_containers[container];
+
+    if (c.message != -1)
+        return;
+
+    if (c.parent != -1)
+    {
+        /*
+         * Replace an empty, non-root, container by its children.
+         */
+        int parent = c.parent;
+        transfer_children(container, parent);
+        remove_child(container);
+    }
+    else if (c.children == 1)
+    {
+        /*
+         * Replace an empty root by its only child.
+         */
+        int child = c.first_child;
+        remove_child(child);
+        transfer_children(child, container);
+        m_containers[container].message = m_containers[child].message;
+    }
+}
+
+
+/*
+ * The subject of a container, or of its first child if it is empty.
+ */
+const std::string &CThreader::subject(int container)
+{
+    CONTAINER &c = m_containers[container];
+
+    if (!c.subject_set)
+    {
+        int source = container;
+
+        while ((source != -1) && (m_containers[source].message == -1))
+            source = m_containers[source].first_child;
+
+        if (source != -1)
+            c.subject = (*m_messages)[m_containers[source].message].subject;
+
+        c.subject_set = true;
+    }
+
+    return (c.subject);
+}
+
+
+/*
+ * Sort the children of a container, recursively.
+ */
+void CThreader::sort(int container)
+{
+    std::vector<int> kids = children(container);
+
+    if (kids.empty())
+        return;
+
+    for (int child : kids)
+        sort(child);
+
+    std::stable_sort(kids.begin(), kids.end(), [this](int a, int b)
+    {
+        int ma = m_containers[a].message;
+        int mb = m_containers[b].message;
+
+        if ((ma == -1) || (mb == -1))
+            return (ma != -1);
+
+        return m_compare(ma, mb);
+    });
+
+    for (int child : kids)
+        add_child(container, child);
+}
+
+
+/*
+ * The first message, by offset, within a thread.
+ */
+int CThreader::first(int container)
+{
+    int result = m_containers[container].message;
+
+    for (int child = m_containers[container].first_child; child != -1;
+            child = m_containers[child].next)
+    {
+        int min = first(child);
+
+        if ((min != -1) && ((result == -1) || (min < result)))
+            result = min;
+    }
+
+    return (result);
+}
+
+
+/*
+ * The greatest message within a thread.
+ */
+int CThreader::greatest(int container)
+{
+    int result = m_containers[container].message;
+
+    for (int child = m_containers[container].first_child; child != -1;
+            child = m_containers[child].next)
+    {
+        int max = greatest(child);
+
+        if (max == -1)
+            continue;
+
+        if ((result == -1) || m_compare(result, max))
+            result = max;
+    }
+
+    return (result);
+}
+
+
+/*
+ * Append the messages beneath the given container to our output.
+ */
+void CThreader::walk(int container, std::string indent, std::vector<THREAD_LINE> &output)
+{
+    CONTAINER &c = m_containers[container];
+
+    if (c.message != -1)
+    {
+        THREAD_LINE line;
+        line.message = c.message;
+        line.indent  = indent;
+        line.root    = false;
+        output.push_back(line);
+
+        if (indent.empty())
+            indent = m_root + m_sign;
+
+        indent = m_indent + indent;
+    }
+    else
+        indent = m_sign;
+
+    for (int child = c.first_child; child != -1; child = m_containers[child].next)
+        walk(child, indent, output);
+}
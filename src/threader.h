@@ -0,0 +1,252 @@
+/*
+ * threader.h - Group messages into threads.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <functional>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+/**
+ * The headers of a single message which are used for threading.
+ */
+typedef struct _thread_message
+{
+    std::string message_id;
+    std::string references;
+    std::string in_reply_to;
+    std::string subject;
+} THREAD_MESSAGE;
+
+
+/**
+ * A single line of threaded output.
+ */
+typedef struct _thread_line
+{
+    /**
+     * The offset of the message within the input.
+     */
+    size_t message;
+
+    /**
+     * The indentation to display before the message.
+     */
+    std::string indent;
+
+    /**
+     * Is this the first message of a thread?
+     */
+    bool root;
+} THREAD_LINE;
+
+
+
+/**
+ * This class implements the threading algorithm described by Jamie
+ * Zawinski, with one difference in the fifth step, as used by the
+ * Lua `Threader` previously:
+ *
+ *   https://www.jwz.org/doc/threading.html
+ *
+ * Messages are linked via hash-maps of their Message-IDs, and each
+ * container records its parent and siblings, so that moving one is
+ * a constant-time operation, and checking for a loop only walks up
+ * the ancestors of a container rather than down its whole subtree.
+ *
+ * The threader knows nothing of CMessage objects, it operates upon
+ * the offsets of messages within the given vector.
+ */
+class CThreader
+{
+public:
+
+    /**
+     * Compare two messages, by offset, returning true if the first
+     * should be displayed before the second.
+     */
+    typedef std::function<bool(size_t, size_t)> COMPARE;
+
+    /**
+     * Return the date of a message, by offset.
+     */
+    typedef std::function<int64_t(size_t)> DATE;
+
+    /**
+     * Constructor.
+     *
+     * `output` holds the signs used to indent the threads, in the format
+     * of `threads.output`: "<indent>;<root-sign>;<sign>".
+     */
+    CThreader(const std::string &output = " ;`;-> ");
+
+    /**
+     * Thread the given messages, returning them in display order.
+     *
+     * The threads are ordered by their first message, unless `compare` is
+     * set, in which case the messages within each thread are sorted with
+     * it, and the threads are ordered by their greatest message.
+     *
+     * `date` is used to choose the root of a thread which was grouped by
+     * subject, and which has no message of its own.
+     */
+    std::vector<THREAD_LINE> thread(const std::vector<THREAD_MESSAGE> &messages,
+                                    COMPARE compare, DATE date);
+
+    /**
+     * The normalised subject each thread returned by the last call to
+     * `thread` was grouped by, in order, or "" if it wasn't.
+     */
+    const std::vector<std::string> &subjects()
+    {
+        return m_subjects;
+    };
+
+    /**
+     * Return the subject with any "Re:" and "Fwd:" markers removed.
+     */
+    static std::string normalise_subject(const std::string &subject);
+
+    /**
+     * Does the given subject contain a "Re:" marker?
+     */
+    static bool is_reply(const std::string &subject);
+
+    /**
+     * Return the first "<message-id>" within the given header, without
+     * the angle-brackets, or "" if there is none.
+     */
+    static std::string message_id(const std::string &header);
+
+    /**
+     * Return the Message-IDs a message refers to: those in its References
+     * header, followed by the last in its In-Reply-To header if that
+     * differs from the last reference.
+     */
+    static std::vector<std::string> references(const THREAD_MESSAGE &message);
+
+private:
+
+    /**
+     * A node in the thread-tree, which may or may not hold a message.
+     *
+     * Containers are held in a vector, and refer to each other by offset.
+     */
+    typedef struct _container
+    {
+        int message;
+        int parent;
+        int first_child;
+        int last_child;
+        int next;
+        int prev;
+        int children;
+        bool subject_set;
+        std::string subject;
+    } CONTAINER;
+
+    /**
+     * Create a new container, returning its offset.
+     */
+    int create(int message);
+
+    /**
+     * Make `child` the last child of `parent`, removing it from its
+     * previous parent.
+     */
+    void add_child(int parent, int child);
+
+    /**
+     * Remove `child` from its parent.
+     */
+    void remove_child(int child);
+
+    /**
+     * Move all the children of `from` to `to`.
+     */
+    void transfer_children(int from, int to);
+
+    /**
+     * Is `descendant` the same as, or a descendant of, `container`?
+     */
+    bool has_descendant(int container, int descendant);
+
+    /**
+     * Return the children of the given container.
+     */
+    std::vector<int> children(int container);
+
+    /**
+     * Remove empty containers beneath, and including, the given one.
+     */
+    void prune_empty(int container);
+
+    /**
+     * The subject of a container, or of its first child if it is empty.
+     */
+    const std::string &subject(int container);
+
+    /**
+     * Sort the children of a container, recursively.
+     */
+    void sort(int container);
+
+    /**
+     * The first message, by offset, within a thread.
+     */
+    int first(int container);
+
+    /**
+     * The greatest message within a thread.
+     */
+    int greatest(int container);
+
+    /**
+     * Append the messages beneath the given container to our output.
+     */
+    void walk(int container, std::string indent, std::vector<THREAD_LINE> &output);
+
+private:
+
+    /**
+     * The signs used to indent threads.
+     */
+    std::string m_indent;
+    std::string m_root;
+    std::string m_sign;
+
+    /**
+     * The containers, and the messages, we're threading.
+     */
+    std::vector<CONTAINER> m_containers;
+    const std::vector<THREAD_MESSAGE> *m_messages;
+
+    /**
+     * The comparison-function we're sorting with, if any.
+     */
+    COMPARE m_compare;
+
+    /**
+     * The subjects of the threads we last returned.
+     */
+    std::vector<std::string> m_subjects;
+};
@@ -0,0 +1,166 @@
+/*
+ * threader_test.cc - Test-cases for our CThreader class.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <string>
+#include <vector>
+
+#include "threader.h"
+#include "CuTest.h"
+
+
+/**
+ * Create a message with the given headers.
+ */
+static THREAD_MESSAGE make_message(std::string id, std::string refs,
+                                   std::string reply, std::string subject)
+{
+    THREAD_MESSAGE msg;
+    msg.message_id  = id;
+    msg.references  = refs;
+    msg.in_reply_to = reply;
+    msg.subject     = subject;
+    return msg;
+}
+
+
+/**
+ * Test the parsing of our headers.
+ */
+void TestThreaderHeaders(CuTest * tc)
+{
+    CuAssertStrEquals(tc, "Hello", CThreader::normalise_subject("Re: Hello").c_str());
+    CuAssertStrEquals(tc, "Hello", CThreader::normalise_subject("RE:Re[2]: Fwd: Hello").c_str());
+    CuAssertStrEquals(tc, "re: Hello", CThreader::normalise_subject("re: Hello").c_str());
+
+    CuAssertTrue(tc, CThreader::is_reply("Re: Hello"));
+    CuAssertTrue(tc, CThreader::is_reply("[list] Re[3]: Hello"));
+    CuAssertTrue(tc, !CThreader::is_reply("Fwd: Hello"));
+    CuAssertTrue(tc, !CThreader::is_reply("Hello"));
+
+    CuAssertStrEquals(tc, "a@b", CThreader::message_id(" <> <a@b> <c@d>").c_str());
+    CuAssertStrEquals(tc, "", CThreader::message_id("none").c_str());
+
+    std::vector<std::string> refs = CThreader::references(
+        make_message("<c>", "<a> <b>", "<x> (Steve) <b>", ""));
+    CuAssertIntEquals(tc, 2, refs.size());
+    CuAssertStrEquals(tc, "a", refs[0].c_str());
+    CuAssertStrEquals(tc, "b", refs[1].c_str());
+
+    refs = CThreader::references(make_message("<c>", "<a>", "<x> <y> junk", ""));
+    CuAssertIntEquals(tc, 2, refs.size());
+    CuAssertStrEquals(tc, "y", refs[1].c_str());
+}
+
+
+/**
+ * Test that replies are threaded beneath their parents.
+ */
+void TestThreaderReplies(CuTest * tc)
+{
+    std::vector<THREAD_MESSAGE> messages;
+    messages.push_back(make_message("<c>", "", "<b>", "Re: Hello"));
+    messages.push_back(make_message("<a>", "", "", "Hello"));
+    messages.push_back(make_message("<d>", "", "", "Other"));
+    messages.push_back(make_message("<b>", "<a>", "", "Re: Hello"));
+
+    CThreader threader;
+    std::vector<THREAD_LINE> lines = threader.thread(messages, nullptr, nullptr);
+
+    CuAssertIntEquals(tc, 4, lines.size());
+
+    CuAssertIntEquals(tc, 1, lines[0].message);
+    CuAssertStrEquals(tc, "", lines[0].indent.c_str());
+    CuAssertTrue(tc, lines[0].root);
+
+    CuAssertIntEquals(tc, 3, lines[1].message);
+    CuAssertStrEquals(tc, " `-> ", lines[1].indent.c_str());
+    CuAssertTrue(tc, !lines[1].root);
+
+    CuAssertIntEquals(tc, 0, lines[2].message);
+    CuAssertStrEquals(tc, "  `-> ", lines[2].indent.c_str());
+
+    CuAssertIntEquals(tc, 2, lines[3].message);
+    CuAssertTrue(tc, lines[3].root);
+
+    /*
+     * Sorting in reverse orders the threads by their newest message.
+     */
+    lines = threader.thread(messages, [](size_t a, size_t b)
+    {
+        return a > b;
+    }, nullptr);
+
+    CuAssertIntEquals(tc, 4, lines.size());
+    CuAssertIntEquals(tc, 2, lines[0].message);
+    CuAssertTrue(tc, lines[0].root);
+    CuAssertIntEquals(tc, 1, lines[1].message);
+    CuAssertTrue(tc, lines[1].root);
+    CuAssertIntEquals(tc, 3, lines[2].message);
+    CuAssertIntEquals(tc, 0, lines[3].message);
+}
+
+
+/**
+ * Test that messages without a common parent are grouped by subject,
+ * and that no message is ever lost.
+ */
+void TestThreaderSubjects(CuTest * tc)
+{
+    std::vector<THREAD_MESSAGE> messages;
+    messages.push_back(make_message("<a>", "<missing>", "", "Re: Hello"));
+    messages.push_back(make_message("<b>", "<missing>", "", "Re: Hello"));
+    messages.push_back(make_message("<c>", "", "", "Hello"));
+    messages.push_back(make_message("<c>", "", "", "Duplicate"));
+    messages.push_back(make_message("", "", "", "No ID"));
+
+    CThreader threader("..;+;> ");
+    std::vector<THREAD_LINE> lines = threader.thread(messages, nullptr,
+                                     [](size_t offset)
+    {
+        return (int64_t)(10 - offset);
+    });
+
+    CuAssertIntEquals(tc, 5, lines.size());
+
+    /*
+     * The replies are grouped beneath the original, which is the oldest.
+     */
+    CuAssertIntEquals(tc, 2, lines[0].message);
+    CuAssertTrue(tc, lines[0].root);
+    CuAssertIntEquals(tc, 1, lines[1].message);
+    CuAssertStrEquals(tc, "..+> ", lines[1].indent.c_str());
+    CuAssertIntEquals(tc, 0, lines[2].message);
+    CuAssertTrue(tc, !lines[2].root);
+
+    CuAssertIntEquals(tc, 3, lines[3].message);
+    CuAssertTrue(tc, lines[3].root);
+    CuAssertIntEquals(tc, 4, lines[4].message);
+    CuAssertTrue(tc, lines[4].root);
+}
+
+
+CuSuite *
+threader_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestThreaderHeaders);
+    SUITE_ADD_TEST(suite, TestThreaderReplies);
+    SUITE_ADD_TEST(suite, TestThreaderSubjects);
+    return suite;
+}
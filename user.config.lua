@@ -44,18 +44,6 @@ keymap['global']['^W'] = 'os.exit(1)'
 Config:set("global.iconv", 1)
 
 
---
--- The following flag configures our index-mode to only format
--- messages which are visible.
---
--- This is a huge performance boost if you have thousands of messages
--- in a folder, OR if you're using IMAP.
---
--- The downside is that searching through messages "/" and `?`,
--- will break, as items off-screen won't be formatted.
---
-Config:set("index.fast", 1)
-
 --
 -- Get our home-directory, as this is often used.
 --
@@ -184,7 +172,6 @@ sorting_method "file"
 --   -- Setup defaults
 --   Config:set( "imap.cache", HOME .. "/.lumail/imap.cache" )
 --   Config:set( "index.sort", "none" )
---   Config:set( "index.fast", "1" )
 --
 --   -- The proxy-program we're using
 --   Config:set( "imap.proxy", "/usr/share/lumail/imap-proxy" )